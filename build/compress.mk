@@ -0,0 +1,10 @@
+# zlib and libzstd are used for compressed programs and data files if
+# pkg-config can find them
+ifeq ($(shell pkg-config --exists zlib 2>/dev/null && echo yes),yes)
+  COMPRESSFLAGS += -DHAVE_ZLIB_H $(shell pkg-config --cflags zlib)
+  COMPRESSLIBS += $(shell pkg-config --libs zlib)
+endif
+ifeq ($(shell pkg-config --exists libzstd 2>/dev/null && echo yes),yes)
+  COMPRESSFLAGS += -DHAVE_ZSTD_H $(shell pkg-config --cflags libzstd)
+  COMPRESSLIBS += $(shell pkg-config --libs libzstd)
+endif
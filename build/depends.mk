@@ -143,7 +143,10 @@ $(SRCDIR)/iostate.o: $(IOSTATE_C)
 # Build HEAP.C
 HEAP_C = $(DEPCOMMON) \
 	$(SRCDIR)/heap.h \
-	$(SRCDIR)/miscprocs.h
+	$(SRCDIR)/miscprocs.h \
+	$(SRCDIR)/strings.h \
+	$(SRCDIR)/tokens.h \
+	$(SRCDIR)/stack.h
 
 $(SRCDIR)/heap.o: $(HEAP_C)
 
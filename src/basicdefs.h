@@ -180,13 +180,20 @@ typedef struct {
   void *dummy1;                         /* Padding on 32-bit */
 #endif
   int32 dimsize[MAXDIMS];               /* Sizes of the array dimemsions */
-  boolean offheap;                      /* TRUE if off heap */
+  int32 offheap;                        /* Where the array body is held (OFFHEAP_xxx) */
   void *parent;                         /* Address of parent variable record */
 #ifndef MATRIX64BIT
   void *dummy2;                         /* Padding on 32-bit */
 #endif
 } basicarray;
 
+/* Values of 'offheap' in 'basicarray' */
+
+#define OFFHEAP_NONE 0                  /* Array body is on the Basic heap */
+#define OFFHEAP_MALLOC 1                /* Off-heap array body was obtained by malloc() */
+#define OFFHEAP_MAPPED 2                /* Off-heap array body is a file mapping */
+#define OFFHEAP_PAGES 3                 /* Off-heap array body was obtained by 'map_offheap' */
+
 typedef union {
   char *charaddr;                       /* Pointer to a character */
   uint8 *uint8addr;                     /* Pointer to an unsigned 8-bit integer */
@@ -210,7 +217,8 @@ typedef struct {
   byte *whenaddr;                       /* Pointer to the code for that 'WHEN' */
 } whenvalue;
 
-typedef struct {
+typedef struct casetable {
+  struct casetable *caseflink;          /* Next table on the list of CASE tables on the heap */
   int32 whencount;                      /* Number of 'WHEN' cases in table */
   byte *defaultaddr;                    /* Address of 'OTHERWISE' code */
   whenvalue whentable[1];               /* First entry in table of WHEN cases */
@@ -280,12 +288,23 @@ typedef struct {
 
 typedef struct libfnproc {
   struct libfnproc *fpflink;            /* Pointer to next PROC/FN entry */
+  struct libfnproc *fphashflink;        /* Pointer to next PROC/FN entry in same hash chain */
   byte *fpline;                         /* Pointer to start of line containing DEF PROC/FN */
   int32 fphash;                         /* Hash value of PROC/FN's name */
   byte *fpname;                         /* Pointer to PROC/FN's name in source line */
   byte *fpmarker;                       /* Pointer to XFNPROCALL token in executable line */
 } libfnproc;
 
+/*
+** 'fnprocindex' entries make up the index of the procedures and functions
+** in a library that is saved with its tokenised copy in the cache
+*/
+
+typedef struct {
+  int32 fpoffset;                       /* Offset of line containing DEF PROC/FN from start of library */
+  int32 fphash;                         /* Hash value of PROC/FN's name */
+} fnprocindex;
+
 /* 'library' entries describe libraries loaded */
 
 typedef struct library {
@@ -294,6 +313,11 @@ typedef struct library {
   byte *libstart;                       /* Pointer to start of library in memory */
   int32 libsize;                        /* Size of library */
   libfnproc *libfplist;                 /* Pointer to list of procedures and functions in library */
+  libfnproc **libfphash;                /* Hash chains of entries in 'libfplist' or NIL */
+  int32 libfphashmask;                  /* Number of hash chains less one */
+  fnprocindex *libindex;                /* Index of procedures and functions if library is mapped or NIL */
+  int32 libindexsize;                   /* Number of entries in 'libindex' */
+  boolean libscanned;                   /* TRUE if library has been scanned for 'LIBRARY LOCAL' and 'DIM' */
   variable *varlists[VARLISTS];         /* Pointers to lists of variables, procedures and functions in library */
 } library;
 
@@ -495,6 +519,8 @@ typedef struct {
   byte *himem;                /* Address of top of basic stack */
   byte *end;                  /* Address of top of address space */
   byte *slotend;              /* Address of end of wimp slot under RISC OS */
+  byte *bigstart;             /* Start of large block area above HIMEM ('bigmem' mode) */
+  byte *bigtop;               /* Top of allocated part of large block area */
   byte *thisline;             /* Start of current line being executed */
   byte *current;              /* Current pointer into Basic program */
   byte *lastvartop;           /* Used to note the address of the top of the Basic heap */
@@ -513,6 +539,7 @@ typedef struct {
   library *liblist;           /* Pointer to list of libraries loaded via LIBRARY */
   library *installist;        /* Pointer to list of libraries loaded via INSTALL */
   char *loadpath;             /* List of directories to search for program and libraries */
+  char *cachedir;             /* Directory holding tokenised copies of programs read as text, or NIL */
   struct {
     unsigned int running:1;       /* TRUE if program is running */
     unsigned int loadngo:1;       /* TRUE if program should be loaded and run immediately */
@@ -520,6 +547,7 @@ typedef struct {
     unsigned int outofdata:1;     /* TRUE if program has run out of DATA statements */
     unsigned int has_offsets:1;   /* TRUE if program contains embedded offsets */
     unsigned int has_variables:1; /* TRUE if any variables have been created */
+    unsigned int linked:1;        /* TRUE if line number references were filled in when loading */
     unsigned int make_array:1;    /* TRUE if missing arrays should be created */
     unsigned int closefiles:1;    /* TRUE if any open files are closed at the end of the run */
     unsigned int inredir:1;       /* TRUE if input is being taken from a file */
@@ -528,6 +556,7 @@ typedef struct {
     unsigned int ignore_starcmd:1;/* TRUE if built-in '*' commands are ignored */
     unsigned int startfullscreen:1; /* TRUE if we start in fullscreen in SDL mode */
     unsigned int swsurface:1; /* TRUE if we want a software surface */
+    unsigned int batch:1;         /* TRUE if running in batch mode without a keyboard or screen */
   } runflags;                 /* Various runtime flags */
   struct {
     unsigned int enabled:1;   /* TRUE if any trace options are enabled */
@@ -568,6 +597,8 @@ typedef struct {
     unsigned int validsaved:1;    /* TRUE if 'savedstart' contains something valid */
     unsigned int validedit:1;     /* TRUE if 'edit_flags' contains something valid */
     unsigned int usedmmap:1;      /* TRUE if we used mmap to allocate memory */
+    unsigned int reserved:1;      /* TRUE if workspace is reserved and committed as it is used */
+    unsigned int filemapped:1;    /* TRUE if part of the workspace is mapped from a snapshot file */
   } misc_flags;
   byte savedstart[PRESERVED];     /* Save area for start of program when 'NEW' issued */
   int32 curcount;                 /* Number of entries on savedcur[] stack*/
@@ -581,12 +612,14 @@ typedef struct {
   int32 recdepth;                 /* Record depth of FN and flood-fill recursion */
   int32 xtab;                     /* X value of TAB(X,Y) */
   byte *lastsearch;               /* Place last proc/fn search reached */
+  casetable *caselist;            /* CASE tables created since the heap was last cleared */
   int32 linecount;                /* Used when reading a Basic program or library into memory */
   variable staticvars[STDVARS];   /* Static integer variables @%-Z% */
   variable *varlists[VARLISTS];   /* Pointers to lists of variables, procedures and functions */
   int64 centiseconds;             /* Centisecond timer, populated by sub-thread */
   int clocktype;                  /* Type of clock used in centisecond timer */
   int64 monotonictimebase;        /* Baseline for OS_ReadMonotonicTime */
+  uint64 statements;              /* Number of statements executed in batch mode */
   size_t memdump_lastaddr;        /* Last address used by LISTB/LISTW */
   int32 maxrecdepth;              /* Maximum FN recursion depth */
   char program[FNAMESIZE];        /* Name of program loaded */
@@ -623,6 +656,12 @@ typedef struct {
   boolean tekenabled;         /* Tektronix enabled in text mode (default: no) */
   boolean networking;         /* TRUE if networking is available */
   boolean lowercasekeywords;  /* Allow lower-case keywords? */
+  boolean bigmem;             /* Allow workspace larger than 4GB on 64-bit builds */
+  int32 hugepages;            /* Use huge pages for workspace and large off-heap arrays (HUGEPAGES_*) */
+  boolean prefault;           /* Commit workspace and large off-heap arrays when they are created */
+  int32 loadthreads;          /* Number of threads used to tokenise large programs */
+  boolean linklines;          /* Fill in line number references when programs are loaded */
+  boolean compressedfiles;    /* Decompress files read with OPENIN and compress files written with OPENOUT */
 #ifdef USE_SDL
   byte *modescreen_ptr;       /* Mode screen pointer to pixels memory */
   uint32 modescreen_sz;       /* Mode screen size */
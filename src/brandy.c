@@ -60,6 +60,7 @@
 #include "miscprocs.h"
 #include "evaluate.h"
 #include "net.h"
+#include "iostate.h"
 
 #ifdef USE_SDL
 extern threadmsg tmsg;
@@ -96,6 +97,8 @@ static void check_configfile(void);
 static void check_cmdline(int, char *[]);
 #ifndef BRANDYAPP
 static char *loadfile;                  /* Pointer to name of file to load when interpreter starts */
+static char *appimage;                  /* Name of standalone application image to write or NIL */
+static char *restorefile;               /* Name of snapshot to restore when interpreter starts or NIL */
 #endif
 
 /*
@@ -169,7 +172,7 @@ int main(int argc, char *argv[]) {
 #ifdef USE_SDL
   init_timer(); /* Initialise the timer thread */
   tmsg.bailout = -1;
-  if (pthread_create(&escape_thread_id, NULL, &escape_thread, NULL)) {
+  if (!basicvars.runflags.batch && pthread_create(&escape_thread_id, NULL, &escape_thread, NULL)) {
     fprintf(stderr, "Unable to create Escape handler thread.\n");
     exit(1);
   }
@@ -251,6 +254,8 @@ static void init1(void) {
   basicvars.runflags.loadngo = FALSE;         /* Do not start running program immediately */
   basicvars.runflags.quitatend = FALSE;       /* Do not exit from interpreter when program finishes */
   basicvars.runflags.ignore_starcmd = FALSE;  /* Do not ignore built-in '*' commands */
+  basicvars.runflags.batch = FALSE;           /* Run with a keyboard and screen */
+  basicvars.statements = 0;
   basicvars.escape_enabled = TRUE;            /* Allow the Escape key to stop execution */
 #ifdef DEFAULT_IGNORE
   basicvars.runflags.flag_cosmetic = FALSE;     /* Ignore all unsupported features */
@@ -261,6 +266,7 @@ static void init1(void) {
   basicvars.misc_flags.validedit = FALSE;       /* Contents of edit_flags are not valid */
 
   basicvars.loadpath = NIL;
+  basicvars.cachedir = NIL;
   basicvars.argcount = 0;
   basicvars.recdepth = 0;
   basicvars.xtab = 0;
@@ -279,6 +285,11 @@ static void init1(void) {
   matrixflags.hex64 = 0;              /* Decode hex as 64-bit? Default no = BASIC VI behaviour */
   matrixflags.bitshift64 = 0;         /* Bit shifts operate in 64-bit space? Default no = BASIC VI behaviour */
   matrixflags.pseudovarsunsigned = 0; /* Are memory pseudovariables unsigned on 32-bit? */
+  matrixflags.bigmem = 0;             /* Allow workspace over 4GB? Default no, addresses fit in 32 bits */
+  matrixflags.hugepages = HUGEPAGES_NONE; /* Use normal pages for the workspace and off-heap arrays */
+  matrixflags.prefault = FALSE;       /* Commit memory as it is touched, not when it is mapped */
+  matrixflags.loadthreads = 1;        /* Tokenise programs on the interpreter thread */
+  matrixflags.linklines = FALSE;      /* Fill in line number references when they are first used */
   matrixflags.tekenabled = 0;         /* Tektronix enabled in text mode (default: no) */
   matrixflags.tekspeed = 0;
   matrixflags.osbyte4val = 0;         /* Default OSBYTE 4 value */
@@ -296,6 +307,7 @@ static void init1(void) {
   matrixflags.printer = NULL;         /* By default, printer is closed */
   matrixflags.printer_ignore = 13;    /* By default, ignore carriage return characters */
   matrixflags.translatefname = 2;     /* 0 = Don't, 1 = Always, 2 = Attempt autodetect */
+  matrixflags.compressedfiles = FALSE; /* OPENIN and OPENOUT files are not compressed */
   matrixflags.startupmode = BRANDY_STARTUP_MODE;  /* Defaults to 0 */
 #ifndef BRANDY_NOVERCHECK
 #ifdef BRANDYAPP
@@ -451,7 +463,9 @@ static void check_configfile() {
       if(parameter) {
         char *sp;
         worksize = CAST(strtol(parameter, &sp, 10), size_t);  /* Fetch workspace size (n.b. no error checking) */
-        if (tolower(*sp)=='k') {          /* Size is in kilobytes */
+        if (sp==parameter && tolower(*sp)=='m') {  /* 'max' - Reserve as much as possible */
+          worksize = MAXWORKSPACE;
+        } else if (tolower(*sp)=='k') {          /* Size is in kilobytes */
           worksize = worksize*1024;
         } else if (tolower(*sp)=='m') {   /* Size is in megabytes */
           worksize = worksize*1024*1024;
@@ -477,6 +491,11 @@ static void check_configfile() {
         /* This is safe, the required space is allocated a few lines above. */
         STRLCPY(basicvars.loadpath, parameter, FNAMESIZE);
       }
+    } else if(!strncmp(item, "cachedir", 9)) {
+      if(parameter) {
+        if (basicvars.cachedir!=NIL) free(basicvars.cachedir);
+        basicvars.cachedir = strdup(parameter);
+      }
     } else if(!strncmp(item, "lib", 4)) {
       struct loadlib *p = malloc(sizeof(struct loadlib));
       if (p==NIL) {
@@ -502,6 +521,20 @@ static void check_configfile() {
       matrixflags.bitshift64 = TRUE;
     } else if(!strncmp(item, "pseudovarsunsigned", 19)) {
       matrixflags.pseudovarsunsigned = TRUE;
+#ifdef MATRIX64BIT
+    } else if(!strncmp(item, "bigmem", 7)) {
+      matrixflags.bigmem = TRUE;
+#endif
+    } else if(!strncmp(item, "hugepages", 10)) {
+      matrixflags.hugepages = HUGEPAGES_THP;
+    } else if(!strncmp(item, "hugetlb", 8)) {
+      matrixflags.hugepages = HUGEPAGES_TLB;
+    } else if(!strncmp(item, "prefault", 9)) {
+      matrixflags.prefault = TRUE;
+    } else if(!strncmp(item, "loadthreads", 12)) {
+      if(parameter) matrixflags.loadthreads = atoi(parameter);
+    } else if(!strncmp(item, "link", 5)) {
+      matrixflags.linklines = TRUE;
     }
   }
 
@@ -527,7 +560,10 @@ static void check_cmdline(int argc, char *argv[]) {
     p = argv[n];
     if (*p=='-' && !had_double_dash) {  /* Got an option */
       optchar = tolower(*(p+1));        /* Get first character of option name */
-      if (optchar=='h') {               /* -help */
+      if (optchar=='h' && tolower(*(p+2))=='u') {      /* -hugepages or -hugetlb */
+        matrixflags.hugepages = strlen(p)>5 && tolower(*(p+5))=='t' ? HUGEPAGES_TLB : HUGEPAGES_THP;
+      }
+      else if (optchar=='h') {          /* -help */
         show_help();
         exit(0);
       }
@@ -560,17 +596,48 @@ static void check_cmdline(int argc, char *argv[]) {
         }
       }
 #endif
+      else if (optchar=='c' && tolower(*(p+2))=='a') {  /* -cachedir */
+        n++;
+        if (n==argc)
+          cmderror(CMD_NOFILE, p);          /* Directory name missing */
+        else {
+          if (basicvars.cachedir!=NIL) free(basicvars.cachedir);
+          basicvars.cachedir = strdup(argv[n]);
+        }
+      }
 #ifndef BRANDYAPP
 #ifndef BRANDY_NOVERCHECK
       else if (optchar=='n' && tolower(*(p+2))=='o' && tolower(*(p+3))=='c') {  /* -nocheck */
         matrixflags.checknewver = FALSE;
       }
 #endif /* BRANDY_NOVERCHECK */
+      else if (optchar=='a' && tolower(*(p+2))=='p') {  /* -appimage */
+        n++;
+        if (n==argc)
+          cmderror(CMD_NOFILE, p);          /* Filename missing */
+        else
+          appimage = argv[n];
+      }
+      else if (optchar=='r' && tolower(*(p+2))=='e') {  /* -restore */
+        n++;
+        if (n==argc)
+          cmderror(CMD_NOFILE, p);          /* Filename missing */
+        else if (loadfile!=NIL)
+          cmderror(CMD_FILESUPP);           /* Program already supplied */
+        else {
+          restorefile = argv[n];
+          basicvars.runflags.quitatend = basicvars.runflags.loadngo = TRUE;
+        }
+      }
+      else if (optchar=='l' && tolower(*(p+2))=='o' && strlen(p)>5 && tolower(*(p+5))=='t') {  /* -loadthreads */
+        n++;
+        if (n<argc) matrixflags.loadthreads = atoi(argv[n]);
+      }
       else if (optchar == 'c' || optchar == 'q' || (optchar == 'l' && tolower(*(p+2)) == 'o')) {        /* -chain, -quit or -load */
         n++;
         if (n==argc)
           cmderror(CMD_NOFILE, p);      /* Filename missing */
-        else if (loadfile!=NIL)
+        else if (loadfile!=NIL || restorefile!=NIL)
           cmderror(CMD_FILESUPP);       /* Filename already supplied */
         else {
           loadfile = argv[n];
@@ -589,6 +656,8 @@ static void check_cmdline(int argc, char *argv[]) {
         basicvars.runflags.flag_cosmetic = FALSE;
       else if (optchar=='s' && tolower(*(p+2))=='t')    /* -strict  Error on cosmetic errors */
         basicvars.runflags.flag_cosmetic = TRUE;
+      else if (optchar=='l' && tolower(*(p+2))=='i' && tolower(*(p+3))=='n')  /* -link */
+        matrixflags.linklines = TRUE;
       else if (optchar=='l' && tolower(*(p+2))=='i') {  /* -lib */
         n++;
         if (n==argc)
@@ -609,8 +678,16 @@ static void check_cmdline(int argc, char *argv[]) {
           }
         }
       }
+      else if (optchar=='b' && tolower(*(p+2))=='a')    /* -batch  Run without keyboard and screen */
+        basicvars.runflags.batch = TRUE;
+#ifdef MATRIX64BIT
+      else if (optchar=='b' && tolower(*(p+2))=='i')    /* -bigmem  Allow workspace over 4GB */
+        matrixflags.bigmem = TRUE;
+#endif
       else if (optchar == 'n' && tolower(*(p+2))=='o' && tolower(*(p+3))=='s')  /* -nostar  Ignore '*' commands */
         basicvars.runflags.ignore_starcmd = TRUE;
+      else if (optchar=='p' && tolower(*(p+2))=='r')    /* -prefault  Commit workspace and large arrays up front */
+        matrixflags.prefault = TRUE;
       else if (optchar=='p') {              /* -path */
         n++;
         if (n==argc)
@@ -633,7 +710,9 @@ static void check_cmdline(int argc, char *argv[]) {
         else {
           char *sp;
           worksize = CAST(strtol(argv[n], &sp, 10), size_t);  /* Fetch workspace size (n.b. no error checking) */
-          if (tolower(*sp)=='k') {          /* Size is in kilobytes */
+          if (sp==argv[n] && tolower(*sp)=='m') {  /* 'max' - Reserve as much as possible */
+            worksize = MAXWORKSPACE;
+          } else if (tolower(*sp)=='k') {          /* Size is in kilobytes */
             worksize = worksize*1024;
           } else if (tolower(*sp)=='m') {   /* Size is in megabytes */
             worksize = worksize*1024*1024;
@@ -654,7 +733,7 @@ static void check_cmdline(int argc, char *argv[]) {
     }
 #ifndef BRANDYAPP
     else {                              /* Name of file to run supplied */
-      if (loadfile==NIL) {
+      if (loadfile==NIL && restorefile==NIL) {
         loadfile = p;                   /* Make note of name of file to load */
         basicvars.runflags.quitatend = basicvars.runflags.loadngo = TRUE;
       }
@@ -675,6 +754,13 @@ static void check_cmdline(int argc, char *argv[]) {
   if (loadfile != NIL) {
     basicvars.arglist->argvalue = loadfile;
   }
+  else if (restorefile != NIL) {
+    basicvars.arglist->argvalue = restorefile;
+  }
+  if (appimage != NIL && loadfile == NIL) {
+    cmderror(CMD_NOFILE, "-appimage");  /* Program to make image of missing */
+    exit(EXIT_FAILURE);
+  }
 #endif
 }
 
@@ -701,6 +787,26 @@ static void interpret_line(void) {
 }
 
 #ifndef BRANDYAPP
+/*
+** 'restore_program' restores the state of the program saved in the
+** snapshot file 'restorefile' by '*SNAPSHOT' and calls the procedure
+** named in it. If there is no procedure, control passes to the
+** command line instead
+*/
+static void restore_program(void) {
+  char entry[MAXNAMELEN];
+
+  restore_snapshot(restorefile, entry);
+  init_expressions();
+  if (entry[0] == asc_NUL) {
+    basicvars.runflags.quitatend = basicvars.runflags.loadngo = FALSE;
+    return;
+  }
+  snprintf(inputline, INPUTLEN, "PROC%s", entry);
+  tokenize(inputline, thisline, HASLINE, TRUE);
+  exec_thisline();
+}
+
 /*
 ** 'load_libraries' loads the libraries specified on the command line
 ** via the option '-lib'. In the event of an error control either
@@ -798,9 +904,15 @@ static void *run_interpreter(void *dummydata) {
     read_basic_block();
     run_program(basicvars.start);
 #else
-    if (liblist!=NIL) load_libraries();
+    if (restorefile!=NIL)       /* Snapshot of program to restore was given on command line */
+      restore_program();
+    else if (liblist!=NIL) load_libraries();
     if (loadfile!=NIL) {        /*  Name of program to load was given on command line */
       read_basic(loadfile);
+      if (appimage!=NIL) {        /* Save image for standalone application and end run */
+        write_appimage(appimage);
+        exit_interpreter(EXIT_SUCCESS);
+      }
       init_expressions();
       memset(basicvars.program, 0, FNAMESIZE);
       if (strlen(loadfile) < FNAMESIZE ) {
@@ -829,7 +941,15 @@ static void *run_interpreter(void *dummydata) {
 */
 void exit_interpreter_real(int retcode) {
   fileio_shutdown();
+#ifndef TARGET_RISCOS
+  flush_spool();
+#endif
   end_screen();
+  if (basicvars.runflags.batch) {       /* Report how long the run took */
+    fprintf(stderr, "%llu statements executed in %.2f seconds (%.2f seconds CPU)\n",
+     (unsigned long long)basicvars.statements, (mos_centiseconds()-basicvars.monotonictimebase)/100.0,
+     (double)clock()/CLOCKS_PER_SEC);
+  }
   kbd_quit();
   mos_final();
   restore_handlers();
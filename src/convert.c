@@ -68,7 +68,7 @@ int todigit(char x) {
 char *tonumber(char *cp, boolean *isinteger, int32 *intvalue, int64 *int64value, float64 *floatvalue) {
   int32 value = 0;
   int64 value64 = 0;
-  static float64 fpvalue = 0;
+  static THREADLOCAL float64 fpvalue = 0;
   int digits = 0;
   boolean isint, isneg;
 
@@ -144,7 +144,7 @@ char *tonumber(char *cp, boolean *isinteger, int32 *intvalue, int64 *int64value,
       isint = TRUE;
     }
     if (*cp=='.') {     /* Number contains a decimal point */
-      static float64 fltdiv;
+      static THREADLOCAL float64 fltdiv;
       if (isint) {
         isint = FALSE;
         fpvalue = TOFLOAT(value);
@@ -43,6 +43,7 @@
 #include "stack.h"
 #include "fileio.h"
 #include "screen.h"
+#include "functions.h"
 
 #ifdef TARGET_RISCOS
 #include "kernel.h"
@@ -53,6 +54,14 @@
 # include <zlib.h>
 #endif
 
+#ifdef TARGET_UNIX
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
 #define MARKERSIZE 4
 #define ENDMARKSIZE 8           /* Size of the sentinel value at the end of the program */
 
@@ -62,7 +71,7 @@ static byte *last_added;        /* Address of last line added to program */
 static boolean needsnumbers;    /* TRUE if a program need to be renumbered */
 
 #ifdef BRANDYAPP
-extern const char *_binary_app_start;
+extern const char _binary_app_start[];
 extern const int _binary_app_len;
 static unsigned long int blockptr;
 #endif
@@ -170,6 +179,7 @@ static void do_scrunge(int len, char *buf)
 ** to health
 */
 void clear_program(void) {
+  clear_varptrs();      /* Reset references in installed libraries as well as the program */
   clear_varlists();
   clear_strings();
   clear_heap();
@@ -190,6 +200,7 @@ void clear_program(void) {
   basicvars.runflags.running = FALSE;
   basicvars.runflags.has_offsets = FALSE;
   basicvars.runflags.has_variables = FALSE;
+  basicvars.runflags.linked = FALSE;
   basicvars.runflags.closefiles = TRUE;
   basicvars.runflags.make_array = FALSE;
   basicvars.tracehandle = 0;
@@ -215,8 +226,8 @@ void clear_program(void) {
 ** is being edited
 */
 static void adjust_heaplimits(void) {
-  basicvars.lomem = basicvars.vartop = (byte *)ALIGN((size_t)basicvars.top+ENDMARKSIZE);
-  basicvars.stacklimit.bytesp = basicvars.vartop+(size_t)STACKBUFFER;
+  basicvars.lomem = (byte *)ALIGN((size_t)basicvars.top+ENDMARKSIZE);
+  clear_heap();         /* Also discards anything on the heap's free lists */
 }
 
 /*
@@ -233,7 +244,7 @@ static void clear_refs(void) {
     clear_heap();
     clear_strings();
   }
-  if (basicvars.runflags.has_offsets) {
+  if (basicvars.runflags.has_offsets || basicvars.runflags.linked) {
     bp = basicvars.start;
     while (!AT_PROGEND(bp)) {
       clear_linerefs(bp);
@@ -248,10 +259,13 @@ static void clear_refs(void) {
       }
       lp = lp->libflink;
     }
+    clear_evalcache();
+    discard_reflog();
   }
   basicvars.liblist = NIL;
   basicvars.runflags.has_offsets = FALSE;
   basicvars.runflags.has_variables = FALSE;
+  basicvars.runflags.linked = FALSE;
 }
 
 
@@ -507,6 +521,383 @@ static int32 read_bbcfile(FILE *bbcfile, byte *base, byte *limit, int32 ftype) {
   return ALIGN(base - filebase + ENDMARKSIZE);
 }
 
+#ifdef TARGET_UNIX
+/*
+** Programs and libraries read in text form can have their tokenised
+** versions saved in the directory given by the 'cachedir' option, so
+** that the next time the same file is read it does not have to be
+** tokenised again. Each file in the cache starts with a 'progcache'
+** header, followed by the full name of the text file and then the
+** tokenised program as it is held in memory, up to and including the
+** end marker, and an index of the procedures and functions in it. The
+** program and index start on an 'ALIGN' boundary. The name of the cache
+** file is made from a hash of the text file's full name. The tokenised
+** copy is only used if the name, modification time and size of the
+** text file and the version of the interpreter all match those in the
+** header. The lines are checked with 'isvalid' as well in case the
+** cache file has been damaged.
+** Libraries loaded with 'INSTALL' are not read in from the cache but
+** mapped into memory, so that only the parts of the library that are
+** used are read. The procedures and functions are found via the index
+** rather than by going through the library, and lines are checked as
+** they are found (see 'search_library' in variables.c).
+*/
+#define CACHEMAGIC "BRTOKC3"
+#define CACHEVERSIONLEN 256
+
+#define CACHE_HASHBANG 1        /* First line of file started with a '#' */
+#define CACHE_RENUMBERED 2      /* Line numbers were added to the program */
+#define CACHE_HEX64 4           /* File was tokenised with 64-bit hex constants */
+
+typedef struct {
+  char magic[8];                        /* CACHEMAGIC */
+  char version[CACHEVERSIONLEN];        /* Version of interpreter that wrote the file */
+  int64 mtime;                          /* Modification time of text file */
+  int64 size;                           /* Size of text file */
+  int32 flags;                          /* CACHE_* flags */
+  int32 namelen;                        /* Length of name of text file */
+  int32 progsize;                       /* Size of tokenised program */
+  int32 indexsize;                      /* Number of entries in index of PROCs and FNs */
+} progcache;
+
+static progcache cachekey;              /* Header for the text file being read */
+static char cachename[FNAMESIZE];       /* Name of cache file or empty if not caching */
+static char cachepath[FNAMESIZE];       /* Full name of the text file being read */
+
+/*
+** 'find_cachedprog' sets up 'cachekey' and 'cachename' for the text
+** file 'textfile', whose name is in 'basicvars.filename'. It returns
+** FALSE if the file cannot be cached
+*/
+static boolean find_cachedprog(FILE *textfile) {
+  struct stat filestat;
+  uint64 hash = 14695981039346656037ull;
+  char *cp;
+
+  cachename[0] = asc_NUL;
+  if (basicvars.cachedir == NIL || fstat(fileno(textfile), &filestat) == -1) return FALSE;
+  if (realpath(basicvars.filename, cachepath) == NIL) return FALSE;
+  memset(&cachekey, 0, sizeof(progcache));
+  STRLCPY(cachekey.magic, CACHEMAGIC, sizeof(cachekey.magic));
+#ifdef BRANDY_GITCOMMIT
+  snprintf(cachekey.version, CACHEVERSIONLEN, "%s %s", IDSTRING, BRANDY_GITCOMMIT);
+#else
+  STRLCPY(cachekey.version, IDSTRING, CACHEVERSIONLEN);
+#endif
+  cachekey.mtime = filestat.st_mtime;
+  cachekey.size = filestat.st_size;
+  cachekey.namelen = strlen(cachepath);
+  for (cp = cachepath; *cp != asc_NUL; cp++) hash = (hash ^ CAST(*cp, byte)) * 1099511628211ull;
+  snprintf(cachename, FNAMESIZE, "%s%c%016llx.bbt", basicvars.cachedir, DIR_SEP, (unsigned long long)hash);
+  return TRUE;
+}
+
+/*
+** 'open_cachedprog' opens the cache file for the text file described by
+** 'cachekey' and reads its header into 'header'. It returns the handle
+** of the file or NIL if there is no usable copy of the program in it
+*/
+static FILE *open_cachedprog(progcache *header) {
+  FILE *cachefile;
+
+  cachefile = fopen(cachename, "rb");
+  if (cachefile == NIL) return NIL;
+  if (fread(header, sizeof(progcache), 1, cachefile) != 1
+   || memcmp(header->magic, cachekey.magic, sizeof(header->magic)) != 0
+   || strncmp(header->version, cachekey.version, CACHEVERSIONLEN) != 0
+   || header->mtime != cachekey.mtime || header->size != cachekey.size
+   || (header->flags & CACHE_HEX64) != (matrixflags.hex64 ? CACHE_HEX64 : 0)
+   || header->namelen != cachekey.namelen
+   || fread(basicvars.stringwork, 1, header->namelen, cachefile) != header->namelen
+   || memcmp(basicvars.stringwork, cachepath, header->namelen) != 0
+   || header->progsize < ENDMARKSIZE || header->indexsize < 0) {
+    fclose(cachefile);
+    return NIL;
+  }
+  return cachefile;
+}
+
+/*
+** 'load_cachedprog' reads the tokenised copy of the text file described
+** by 'cachekey' into memory at 'base', if there is a usable one in the
+** cache. It returns the size of the program or zero if the file has to
+** be read and tokenised
+*/
+static int32 load_cachedprog(byte *base, byte *limit) {
+  FILE *cachefile;
+  progcache header;
+  byte *bp;
+  int32 size;
+
+  cachefile = open_cachedprog(&header);
+  if (cachefile == NIL) return 0;
+  if (base+header.progsize >= limit
+   || fseek(cachefile, ALIGN(sizeof(progcache)+header.namelen), SEEK_SET) != 0
+   || fread(base, 1, header.progsize, cachefile) != header.progsize) {
+    fclose(cachefile);
+    return 0;
+  }
+  fclose(cachefile);
+  bp = base;
+  size = header.progsize-ENDMARKSIZE;
+  while (bp-base < size && isvalid(bp)) bp+=GET_LINELEN(bp);
+  if (bp-base != size || !AT_PROGEND(bp)) return 0;
+  if (header.flags & CACHE_HASHBANG) basicvars.runflags.quitatend = basicvars.runflags.loadngo;
+  if ((header.flags & CACHE_RENUMBERED) && !basicvars.runflags.loadngo) emulate_printf("Line numbers added to program\r\n");
+  return ALIGN(header.progsize);
+}
+
+/*
+** 'save_cachedprog' writes the tokenised program of 'size' bytes at
+** 'base' to the cache. It is written to a temporary file first which
+** is then renamed so that another copy of the interpreter reading the
+** same program never sees a partly written file. Any errors are ignored
+*/
+static void save_cachedprog(byte *base, int32 size, int32 flags) {
+  FILE *cachefile;
+  fnprocindex *index;
+  char tempname[FNAMESIZE+16];
+  byte padding[sizeof(size_t)+sizeof(double)];
+  size_t padlen;
+  boolean ok;
+
+  cachekey.flags = flags | (matrixflags.hex64 ? CACHE_HEX64 : 0);
+  cachekey.progsize = size;
+  index = index_procfns(base, &cachekey.indexsize);
+  snprintf(tempname, sizeof(tempname), "%s.%d", cachename, (int)getpid());
+  mkdir(basicvars.cachedir, 0777);
+  cachefile = fopen(tempname, "wb");
+  if (cachefile == NIL) {
+    free(index);
+    return;
+  }
+  memset(padding, 0, sizeof(padding));
+  padlen = ALIGN(sizeof(progcache)+cachekey.namelen)-(sizeof(progcache)+cachekey.namelen);
+  ok = fwrite(&cachekey, sizeof(progcache), 1, cachefile) == 1
+   && fwrite(cachepath, 1, cachekey.namelen, cachefile) == cachekey.namelen
+   && fwrite(padding, 1, padlen, cachefile) == padlen
+   && fwrite(base, 1, size, cachefile) == size
+   && fwrite(padding, 1, ALIGN(size)-size, cachefile) == ALIGN(size)-size;
+  if (ok && cachekey.indexsize > 0)
+    ok = fwrite(index, sizeof(fnprocindex), cachekey.indexsize, cachefile) == cachekey.indexsize;
+  free(index);
+  if (!ok) {
+    fclose(cachefile);
+    remove(tempname);
+    return;
+  }
+  if (fclose(cachefile) != 0 || rename(tempname, cachename) != 0) remove(tempname);
+}
+#endif
+
+/*
+** 'add_tokenline' adds the tokenised line 'tokenline' to the program
+** being read in at 'base'. It returns the address of the byte after
+** the line or NIL if there is no room for it
+*/
+static byte *add_tokenline(byte *tokenline, byte *base, byte *limit) {
+  int32 length;
+
+  if (GET_LINENO(tokenline)==NOLINENO) {
+    save_lineno(tokenline, 0);  /* Otherwise renumber goes a bit funny */
+    needsnumbers = TRUE;
+  }
+  length = GET_LINELEN(tokenline);
+  if (length>0) {       /* Line length is not zero so include line */
+    if (base+length>=limit) return NIL; /* No room left */
+    memmove(base, tokenline, length);
+    base+=length;
+  }
+  return base;
+}
+
+#ifdef TARGET_UNIX
+/*
+** Large programs can be tokenised on several threads at once. The lines
+** are read into 'srctext' in batches of up to SRCBATCH lines and each
+** batch is split into one chunk per thread. The threads tokenise their
+** lines into buffers of their own which are then copied to the program
+** in order. A thread skips any line that contains an error or that would
+** produce a warning. Those lines are tokenised again as the program is
+** put together so that messages appear as they would otherwise
+*/
+#define SRCBATCH 16384          /* Most lines read before they are tokenised */
+#define MINCHUNK 2048           /* Fewest lines worth handing to a thread */
+#define MAXLOADTHREADS 64       /* Most threads used to tokenise a program */
+
+typedef struct {
+  int32 first, count;           /* First line in chunk and number of lines */
+  byte *tokens;                 /* Buffer holding the tokenised lines */
+  size_t size;                  /* Size of 'tokens' */
+} tokenchunk;
+
+static char *srctext;           /* Text of lines read but not tokenised yet */
+static size_t srcused, srcsize; /* Bytes in use in and size of 'srctext' */
+static size_t *srclines;        /* Offset of each line in 'srctext' */
+static int32 *toklengths;       /* Length of each tokenised line or -1 to tokenise it again */
+static int32 srccount, srcmax;  /* Number of lines in 'srctext' and room in 'srclines' */
+static int32 srclinecount;      /* Value of 'basicvars.linecount' before first line in batch */
+static int32 srcthreads;        /* Number of threads to use */
+static tokenchunk chunks[MAXLOADTHREADS];
+
+/*
+** 'load_threads' returns the number of threads to use to tokenise
+** a program. This is the number given by the 'loadthreads' option or
+** one per processor if that is zero, but no more than the number of
+** processors available
+*/
+static int32 load_threads(void) {
+  long cpus;
+  int32 threads = matrixflags.loadthreads;
+
+  if (threads==1) return 1;
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus<1) cpus = 1;
+  if (threads<=0 || threads>cpus) threads = cpus;
+  return MIN(threads, MAXLOADTHREADS);
+}
+
+/*
+** 'add_srcline' adds a line of 'length' characters to the batch of lines
+** to be tokenised. It returns FALSE if there is not enough memory
+*/
+static boolean add_srcline(char *text, size_t length) {
+  if (srccount==srcmax) {
+    int32 newmax = srcmax==0 ? 1024 : MIN(srcmax*2, SRCBATCH);
+    size_t *newlines = realloc(srclines, newmax*sizeof(size_t));
+    int32 *newlengths;
+    if (newlines==NIL) return FALSE;
+    srclines = newlines;
+    newlengths = realloc(toklengths, newmax*sizeof(int32));
+    if (newlengths==NIL) return FALSE;
+    toklengths = newlengths;
+    srcmax = newmax;
+  }
+  if (srcused+length+1>srcsize) {
+    size_t newsize = srcsize==0 ? 65536 : srcsize*2;
+    char *newtext;
+    while (newsize<srcused+length+1) newsize*=2;
+    newtext = realloc(srctext, newsize);
+    if (newtext==NIL) return FALSE;
+    srctext = newtext;
+    srcsize = newsize;
+  }
+  if (srccount==0) srclinecount = basicvars.linecount-1;
+  srclines[srccount] = srcused;
+  memcpy(srctext+srcused, text, length+1);
+  srcused+=length+1;
+  srccount++;
+  return TRUE;
+}
+
+/*
+** 'release_srclines' frees the memory used to hold lines waiting
+** to be tokenised
+*/
+static void release_srclines(void) {
+  free(srctext);
+  free(srclines);
+  free(toklengths);
+  srctext = NIL;
+  srclines = NIL;
+  toklengths = NIL;
+  srcused = srcsize = 0;
+  srccount = srcmax = 0;
+}
+
+/*
+** 'tokenise_chunk' is the function run by each thread that is
+** tokenising part of a batch of lines
+*/
+static void *tokenise_chunk(void *arg) {
+  tokenchunk *cp = arg;
+  size_t used = 0;
+  int32 n, last = cp->first+cp->count;
+
+  for (n=cp->first; n<last && cp->tokens!=NIL; n++) {
+    if (cp->size-used<MAXSTATELEN) {    /* Make sure there is room for the longest line */
+      byte *newtokens = realloc(cp->tokens, cp->size*2);
+      if (newtokens==NIL) break;
+      cp->tokens = newtokens;
+      cp->size*=2;
+    }
+    if (try_tokenize(srctext+srclines[n], cp->tokens+used, HASLINE)) {
+      toklengths[n] = GET_LINELEN(cp->tokens+used);
+      used+=toklengths[n];
+    }
+    else {
+      toklengths[n] = -1;
+    }
+  }
+  while (n<last) toklengths[n++] = -1;  /* Ran out of memory. Leave the rest to the main thread */
+  return NIL;
+}
+
+/*
+** 'tokenise_srclines' tokenises the batch of lines in 'srctext' and
+** adds them to the program being read in at 'base'. It returns the
+** address of the byte after the last line or NIL if the program does
+** not fit
+*/
+static byte *tokenise_srclines(byte *base, byte *limit) {
+  pthread_t threads[MAXLOADTHREADS];
+  boolean started[MAXLOADTHREADS];
+  byte tokenline[MAXSTATELEN];
+  int32 nthreads, perchunk, n, t;
+
+  DEBUGFUNCMSGIN;
+  nthreads = MIN(srcthreads, srccount/MINCHUNK);
+  basicvars.linecount = srclinecount;
+  if (nthreads<2) {     /* Not worth using threads for this batch */
+    for (n=0; n<srccount && base!=NIL; n++) {
+      basicvars.linecount++;
+      tokenize(srctext+srclines[n], tokenline, HASLINE, FALSE);
+      base = add_tokenline(tokenline, base, limit);
+    }
+  }
+  else {
+    prepare_tokenize();
+    perchunk = (srccount+nthreads-1)/nthreads;
+    for (t=0; t<nthreads; t++) {
+      tokenchunk *cp = &chunks[t];
+      cp->first = t*perchunk;
+      cp->count = MIN(perchunk, srccount-cp->first);
+      cp->size = 2*(srclines[cp->first+cp->count-1]-srclines[cp->first])+MAXSTATELEN;
+      free(cp->tokens);         /* In case an error stopped the last batch being put together */
+      cp->tokens = malloc(cp->size);
+      started[t] = pthread_create(&threads[t], NIL, tokenise_chunk, cp)==0;
+      if (!started[t]) tokenise_chunk(cp);
+    }
+    for (t=0; t<nthreads; t++) {
+      if (started[t]) pthread_join(threads[t], NIL);
+    }
+    for (t=0; t<nthreads && base!=NIL; t++) {
+      tokenchunk *cp = &chunks[t];
+      byte *tp = cp->tokens;
+      for (n=cp->first; n<cp->first+cp->count && base!=NIL; n++) {
+        basicvars.linecount++;
+        if (toklengths[n]>=0) {
+          base = add_tokenline(tp, base, limit);
+          tp+=toklengths[n];
+        }
+        else {          /* Tokenise line again to report the problem */
+          tokenize(srctext+srclines[n], tokenline, HASLINE, FALSE);
+          base = add_tokenline(tokenline, base, limit);
+        }
+      }
+    }
+    for (t=0; t<nthreads; t++) {
+      free(chunks[t].tokens);
+      chunks[t].tokens = NIL;
+    }
+  }
+  srccount = 0;
+  srcused = 0;
+  DEBUGFUNCMSGOUT;
+  return base;
+}
+#endif
+
 /*
 ** 'read_textfile' reads a Basic program that is in text form,
 ** storing it at 'base'. 'limit' marks the highest address it can
@@ -528,7 +919,18 @@ static int32 read_textfile(FILE *textfile, byte *base, byte *limit, boolean sile
   byte tokenline[MAXSTATELEN];
   boolean gzipped = FALSE;
 #ifdef HAVE_ZLIB_H
-  gzFile gzipfile;
+  gzFile gzipfile = NIL;
+#endif
+#ifdef TARGET_UNIX
+  int32 cacheflags = 0;
+  if (find_cachedprog(textfile)) {
+    length = load_cachedprog(base, limit);
+    if (length > 0) {
+      matrixflags.scrunge = FALSE;      /* Scrunged programs are never cached */
+      fclose(textfile);
+      return length;
+    }
+  }
 #endif
   fseek (textfile, 0, 0);
   tokenline[2] = 0;
@@ -542,6 +944,9 @@ static int32 read_textfile(FILE *textfile, byte *base, byte *limit, boolean sile
     error(ERR_BADPROG);
     return 0;
   }
+#ifdef TARGET_UNIX
+  if (matrixflags.scrunge) cachename[0] = asc_NUL;  /* Do not keep a readable copy of a scrunged program */
+#endif
   gzipped = (tokenline[0] == 0x1F && tokenline[1] == 0x8B && tokenline[2] == 8);
   if (gzipped) {
 #ifdef HAVE_ZLIB_H
@@ -568,6 +973,9 @@ static int32 read_textfile(FILE *textfile, byte *base, byte *limit, boolean sile
   needsnumbers = FALSE;         /* This will be set by tokenise_line() above */
   basicvars.linecount = 0;      /* Number of line being read from file */
   filebase = base;
+#ifdef TARGET_UNIX
+  srcthreads = load_threads();
+#endif
 #ifdef HAVE_ZLIB_H
   if (gzipped)
     result = gzgets(gzipfile, basicvars.stringwork, INPUTLEN);
@@ -576,6 +984,9 @@ static int32 read_textfile(FILE *textfile, byte *base, byte *limit, boolean sile
   result = multifgets(basicvars.stringwork, INPUTLEN, textfile);
     if (result!=NIL && basicvars.stringwork[0]=='#') {  /* Ignore first line if it starts with a '#' */
     basicvars.runflags.quitatend=basicvars.runflags.loadngo;
+#ifdef TARGET_UNIX
+    cacheflags |= CACHE_HASHBANG;
+#endif
 #ifdef HAVE_ZLIB_H
     if (gzipped)
       result = gzgets(gzipfile, basicvars.stringwork, INPUTLEN);
@@ -583,7 +994,7 @@ static int32 read_textfile(FILE *textfile, byte *base, byte *limit, boolean sile
 #endif
     result = multifgets(basicvars.stringwork, INPUTLEN, textfile);
   }
-  while (result!=NIL) {
+  while (result!=NIL && base!=NIL) {
     basicvars.linecount++;
     length = strlen(basicvars.stringwork);
     if (matrixflags.scrunge) do_scrunge(length, basicvars.stringwork);
@@ -593,28 +1004,24 @@ static int32 read_textfile(FILE *textfile, byte *base, byte *limit, boolean sile
     while (length>=0 && isspace(basicvars.stringwork[length]));
     length++;
     basicvars.stringwork[length] = asc_NUL;
-    tokenize(basicvars.stringwork, tokenline, HASLINE, FALSE);
-    if (GET_LINENO(tokenline)==NOLINENO) {
-      save_lineno(tokenline, 0);        /* Otherwise renumber goes a bit funny */
-      needsnumbers = TRUE;
+#ifdef TARGET_UNIX
+    if (srcthreads>1 && add_srcline(basicvars.stringwork, length)) {
+      if (srccount==SRCBATCH) base = tokenise_srclines(base, limit);
     }
-    length = GET_LINELEN(tokenline);
-    if (length>0) {     /* Line length is not zero so include line */
-      if (base+length>=limit) { /* No room left */
-#ifdef HAVE_ZLIB_H
-        if (gzipped)
-          gzclose (gzipfile);
-        else
-#endif
-        fclose(textfile);
-        basicvars.misc_flags.badprogram=1; /* The program is incomplete, thus corrupt */
-        matrixflags.lowercasekeywords=lck;
-        error(ERR_NOROOM);
-        return 0;
+    else {
+      if (srccount>0) {
+        base = tokenise_srclines(base, limit);
+        basicvars.linecount++;  /* Count the line just read again */
+      }
+      if (base!=NIL) {
+        tokenize(basicvars.stringwork, tokenline, HASLINE, FALSE);
+        base = add_tokenline(tokenline, base, limit);
       }
-      memmove(base, tokenline, length);
-      base+=length;
     }
+#else
+    tokenize(basicvars.stringwork, tokenline, HASLINE, FALSE);
+    base = add_tokenline(tokenline, base, limit);
+#endif
 #ifdef HAVE_ZLIB_H
     if (gzipped)
       result = gzgets(gzipfile, basicvars.stringwork, INPUTLEN);
@@ -622,12 +1029,22 @@ static int32 read_textfile(FILE *textfile, byte *base, byte *limit, boolean sile
 #endif
     result = multifgets(basicvars.stringwork, INPUTLEN, textfile);
   }
+#ifdef TARGET_UNIX
+  if (srccount>0 && base!=NIL) base = tokenise_srclines(base, limit);
+  release_srclines();
+#endif
 #ifdef HAVE_ZLIB_H
   if (gzipped)
     gzclose (gzipfile);
   else
 #endif
   fclose(textfile);
+  if (base==NIL) {      /* No room left */
+    basicvars.misc_flags.badprogram=1; /* The program is incomplete, thus corrupt */
+    matrixflags.lowercasekeywords=lck;
+    error(ERR_NOROOM);
+    return 0;
+  }
   basicvars.linecount = 0;
   if (base+ENDMARKSIZE>=limit) {
     matrixflags.lowercasekeywords=lck;
@@ -640,6 +1057,9 @@ static int32 read_textfile(FILE *textfile, byte *base, byte *limit, boolean sile
     renumber_program(filebase, 1, 1);
   }
   matrixflags.lowercasekeywords=lck;
+#ifdef TARGET_UNIX
+  if (cachename[0] != asc_NUL) save_cachedprog(filebase, base-filebase+ENDMARKSIZE, cacheflags | (needsnumbers ? CACHE_RENUMBERED : 0));
+#endif
   return ALIGN(base-filebase+ENDMARKSIZE);
 }
 
@@ -811,25 +1231,13 @@ void read_basic(char *name) {
   basicvars.top+=length;
   basicvars.misc_flags.badprogram = FALSE;
   adjust_heaplimits();
+  if (matrixflags.linklines) link_linenums(basicvars.start);
 #ifdef DEBUG
   if (basicvars.debug_flags.debug)
     fprintf(stderr, "Program is loaded at page=&%p,  top=&%p\n", basicvars.page, basicvars.top);
 #endif
 }
 
-#ifdef BRANDYAPP
-void read_basic_block() {
-  int32 length;
-
-  last_added = NIL;
-  clear_program();
-  length = read_textblock(basicvars.top, basicvars.himem, basicvars.runflags.loadngo);
-  basicvars.top+=length;
-  basicvars.misc_flags.badprogram = FALSE;
-  adjust_heaplimits();
-}
-#endif
-
 /*
 ** 'link_library' is called to add a library to the relevant library list
 */
@@ -865,8 +1273,230 @@ static void link_library(char *name, byte *base, int32 size, boolean onheap) {
   lp->libstart = base;
   lp->libsize = size;
   lp->libfplist = NIL;
+  lp->libfphash = NIL;
+  lp->libindex = NIL;
+  lp->libindexsize = 0;
+  lp->libscanned = FALSE;
   for (n=0; n<VARLISTS; n++) lp->varlists[n] = NIL;
+  if (matrixflags.linklines) link_linenums(base);
+}
+
+#ifdef TARGET_UNIX
+/*
+** 'map_cachedlib' maps the tokenised copy of the library 'name' being
+** loaded via 'INSTALL' from the cache into memory, if there is a usable
+** one, and adds it to the installed library list. The mapping is a
+** private one so that references filled in when the library is used
+** do not change the file. Every line is checked with 'isvalid', as in
+** 'load_cachedprog', and every entry in the index has to point at the
+** start of a line. It returns TRUE if the library was mapped or FALSE
+** if it has to be read in
+*/
+static boolean map_cachedlib(char *name) {
+  FILE *cachefile;
+  progcache header;
+  struct stat filestat;
+  byte *base, *lib, *bp;
+  size_t offset, mapsize;
+  fnprocindex *index;
+  int32 n, size;
+
+  cachefile = open_cachedprog(&header);
+  if (cachefile == NIL) return FALSE;
+  offset = ALIGN(sizeof(progcache)+header.namelen);
+  mapsize = offset+ALIGN(header.progsize)+header.indexsize*sizeof(fnprocindex);
+  if (fstat(fileno(cachefile), &filestat) == -1 || filestat.st_size != mapsize) {
+    fclose(cachefile);
+    return FALSE;
+  }
+  base = mmap(NIL, mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(cachefile), 0);
+  fclose(cachefile);
+  if (base == MAP_FAILED) return FALSE;
+  lib = base+offset;
+  index = CAST(lib+ALIGN(header.progsize), fnprocindex *);
+  size = header.progsize-ENDMARKSIZE;
+  bp = lib;
+  n = 0;
+  while (bp-lib < size && GET_LINELEN(bp) <= size-(bp-lib) && isvalid(bp)) {
+    if (n < header.indexsize && index[n].fpoffset == bp-lib) n++;
+    bp+=GET_LINELEN(bp);
+  }
+  if (bp-lib != size || !AT_PROGEND(bp) || n != header.indexsize) {
+    munmap(base, mapsize);
+    return FALSE;
+  }
+#ifdef DEBUG
+  if (basicvars.debug_flags.debug)
+    fprintf(stderr, "Mapped library '%s' at %p, size = %d\n", name, lib, header.progsize);
+#endif
+  link_library(name, lib, header.progsize, FALSE);
+  basicvars.installist->libindex = index;
+  basicvars.installist->libindexsize = header.indexsize;
+  return TRUE;
+}
+#endif
+
+/*
+** A standalone application built with BRANDYAPP can have either the
+** text of the program embedded in it or a tokenised image of the
+** program made by running the interpreter with the option '-appimage',
+** which saves it having to be tokenised every time the application
+** starts. The image starts with an 'appimage' header, followed by the
+** tokenised program as it is held in memory and then the libraries
+** installed with '-lib' in the order they were installed. Each library
+** is preceded by an 'appimagelib' header and the name of the library.
+** The image can only be used by the same version of the interpreter
+** as the one that made it. Line number references are not filled in
+** in the image as they are addresses in memory, but if the image was
+** made with '-link' this is done when the application starts.
+*/
+#define APPMAGIC "BRAPPI1"
+#define APPVERSIONLEN 256
+#define APPBYTEORDER 0x01020304
+
+#define APP_LINKED 1            /* Fill in line number references at startup */
+
+typedef struct {
+  char magic[8];                        /* APPMAGIC */
+  char version[APPVERSIONLEN];          /* Version of interpreter that made the image */
+  int32 byteorder;                      /* APPBYTEORDER */
+  int32 flags;                          /* APP_* flags */
+  int32 progsize;                       /* Size of tokenised program */
+  int32 libcount;                       /* Number of libraries that follow it */
+} appimage;
+
+typedef struct {
+  int32 namelen;                        /* Length of name of library */
+  int32 libsize;                        /* Size of tokenised library */
+} appimagelib;
+
+static void set_appversion(char *version) {
+  memset(version, 0, APPVERSIONLEN);
+#ifdef BRANDY_GITCOMMIT
+  snprintf(version, APPVERSIONLEN, "%s %s", IDSTRING, BRANDY_GITCOMMIT);
+#else
+  STRLCPY(version, IDSTRING, APPVERSIONLEN);
+#endif
+}
+
+#ifdef BRANDYAPP
+/*
+** 'load_appimage' copies the program in the tokenised image embedded
+** in the application to 'base' and installs the libraries that go
+** with it. It returns the size of the program or zero if what is
+** embedded is the text of the program. The image was checked when it
+** was made so the lines are not checked again here
+*/
+static int32 load_appimage(byte *base, byte *limit) {
+  byte *blob = (byte *)&_binary_app_start;
+  appimage header;
+  appimagelib libheader;
+  char version[APPVERSIONLEN];
+  char libname[FNAMESIZE];
+  byte *bp, *libbase;
+  int32 n;
+
+  if (_binary_app_len < (int)sizeof(appimage) || memcmp(blob, APPMAGIC, sizeof(header.magic)) != 0) return 0;
+  memcpy(&header, blob, sizeof(appimage));
+  set_appversion(version);
+  if (strncmp(header.version, version, APPVERSIONLEN) != 0 || header.byteorder != APPBYTEORDER) {
+    error(ERR_BADPROG);
+    return 0;
+  }
+  if (base+header.progsize >= limit) {
+    error(ERR_NOROOM);
+    return 0;
+  }
+  bp = blob+sizeof(appimage);
+  memcpy(base, bp, header.progsize);
+  bp+=header.progsize;
+  if (header.flags & APP_LINKED) matrixflags.linklines = TRUE;
+  for (n=0; n<header.libcount; n++) {
+    memcpy(&libheader, bp, sizeof(appimagelib));
+    bp+=sizeof(appimagelib);
+    if (libheader.namelen >= FNAMESIZE) {
+      error(ERR_BADPROG);
+      return 0;
+    }
+    memcpy(libname, bp, libheader.namelen);
+    libname[libheader.namelen] = asc_NUL;
+    bp+=libheader.namelen;
+    libbase = malloc(libheader.libsize);
+    if (libbase==NIL) {
+      error(ERR_LIBSIZE, libname);
+      return 0;
+    }
+    memcpy(libbase, bp, libheader.libsize);
+    bp+=libheader.libsize;
+    link_library(libname, libbase, libheader.libsize, FALSE);
+  }
+  return header.progsize;
+}
+
+void read_basic_block() {
+  int32 length;
+
+  last_added = NIL;
+  clear_program();
+  length = load_appimage(basicvars.top, basicvars.himem);
+  if (length==0) length = read_textblock(basicvars.top, basicvars.himem, basicvars.runflags.loadngo);
+  basicvars.top+=length;
+  basicvars.misc_flags.badprogram = FALSE;
+  adjust_heaplimits();
+  if (matrixflags.linklines) link_linenums(basicvars.start);
+}
+
+#else
+
+/*
+** 'write_imagelibs' writes the installed libraries in the list starting
+** at 'lp' to the image file, oldest first so that they are installed
+** in the same order when the application starts
+*/
+static boolean write_imagelibs(FILE *imagefile, library *lp) {
+  appimagelib libheader;
+
+  if (lp==NIL) return TRUE;
+  if (!write_imagelibs(imagefile, lp->libflink)) return FALSE;
+  libheader.namelen = strlen(lp->libname);
+  libheader.libsize = lp->libsize;
+  return fwrite(&libheader, sizeof(appimagelib), 1, imagefile) == 1
+   && fwrite(lp->libname, 1, libheader.namelen, imagefile) == libheader.namelen
+   && fwrite(lp->libstart, 1, lp->libsize, imagefile) == lp->libsize;
+}
+
+/*
+** 'write_appimage' saves the program in memory and any installed
+** libraries as an image to be embedded in a standalone application
+*/
+void write_appimage(char *name) {
+  FILE *imagefile;
+  appimage header;
+  library *lp;
+
+  if (basicvars.runflags.has_offsets || basicvars.runflags.linked) clear_refs();
+  memset(&header, 0, sizeof(appimage));
+  STRLCPY(header.magic, APPMAGIC, sizeof(header.magic));
+  set_appversion(header.version);
+  header.byteorder = APPBYTEORDER;
+  header.flags = matrixflags.linklines ? APP_LINKED : 0;
+  header.progsize = basicvars.top-basicvars.start;
+  for (lp = basicvars.installist; lp!=NIL; lp = lp->libflink) header.libcount++;
+  imagefile = fopen(name, "wb");
+  if (imagefile==NIL) {
+    error(ERR_NOTCREATED, name);
+    return;
+  }
+  if (fwrite(&header, sizeof(appimage), 1, imagefile) != 1
+   || fwrite(basicvars.start, 1, header.progsize, imagefile) != header.progsize
+   || !write_imagelibs(imagefile, basicvars.installist)) {
+    fclose(imagefile);
+    error(ERR_WRITEFAIL, name);
+    return;
+  }
+  if (fclose(imagefile) != 0) error(ERR_WRITEFAIL, name);
 }
+#endif
 
 /*
 ** 'read_bbclib' reads a tokenised BBC BASIC library file.
@@ -911,6 +1541,12 @@ static void read_bbclib(FILE *libfile, char *name, boolean onheap, int32 ftype)
 static void read_textlib(FILE *libfile, char *name, boolean onheap) {
   int32 size;
   byte *base;
+#ifdef TARGET_UNIX
+  if (!onheap && find_cachedprog(libfile) && map_cachedlib(name)) {
+    fclose(libfile);
+    return;
+  }
+#endif
   base = basicvars.vartop;
   size = read_textfile(libfile, base, basicvars.stacktop.bytesp, TRUE);
   if (onheap) {
@@ -39,6 +39,8 @@ extern void clear_tables(void);
 extern void read_basic(char *);
 #ifdef BRANDYAPP
 extern void read_basic_block(void);
+#else
+extern void write_appimage(char *);
 #endif
 extern void write_basic(char *);
 extern void read_library(char *, boolean);
@@ -148,6 +148,12 @@ static void handle_signal(int signo) {
 #endif
     DEBUGFUNCMSGOUT;
     error(ERR_ADDREXCEPT);
+#ifdef SIGBUS
+  case SIGBUS:          /* A file mapped into memory has been truncated */
+    DEBUGFUNCMSGOUT;
+    fileio_checkmaps();
+    error(ERR_CANTREAD);
+#endif
 #if defined(TARGET_UNIX) | defined(TARGET_MACOSX)
   case SIGCONT:
 #ifdef TARGET_MINGW
@@ -221,14 +227,14 @@ void init_errors(void) {
     (void) signal(SIGFPE, handle_signal);
     (void) signal(SIGSEGV, handle_signal);
     (void) signal(SIGABRT, handle_signal);
-    (void) signal(SIGINT, handle_signal);
+    if (!basicvars.runflags.batch) (void) signal(SIGINT, handle_signal);  /* Batch mode: Ctrl-C kills the run */
 #ifdef TARGET_DJGPP
     sigintkey = __djgpp_set_sigint_key(ESCKEY);
 #endif
 
 #ifdef TARGET_MINGW
     /* Launch a thread to poll the escape key to emulate asynchronous SIGINTs */
-    if (sigintthread == 0)
+    if (sigintthread == 0 && !basicvars.runflags.batch)
       sigintthread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)&watch_escape, NULL, 0, NULL);
 #endif
 
@@ -250,7 +256,10 @@ void init_errors(void) {
     (void) sigaction(SIGFPE, &sa, NULL);
     (void) sigaction(SIGSEGV, &sa, NULL);
     (void) sigaction(SIGABRT, &sa, NULL);
-    (void) sigaction(SIGINT, &sa, NULL);
+#ifdef SIGBUS
+    (void) sigaction(SIGBUS, &sa, NULL);
+#endif
+    if (!basicvars.runflags.batch) (void) sigaction(SIGINT, &sa, NULL);  /* Batch mode: Ctrl-C kills the run */
 #if defined(TARGET_UNIX) | defined(TARGET_MACOSX)
     (void) sigaction(SIGCONT, &sa, NULL);
 #endif
@@ -271,6 +280,9 @@ void restore_handlers(void) {
     (void) signal(SIGFPE, SIG_DFL);
     (void) signal(SIGSEGV, SIG_DFL);
     (void) signal(SIGABRT, SIG_DFL);
+#ifdef SIGBUS
+    (void) signal(SIGBUS, SIG_DFL);
+#endif
     (void) signal(SIGINT, SIG_DFL);
 #if defined(TARGET_UNIX) | defined(TARGET_MACOSX)
     (void) signal(SIGCONT, SIG_DFL);
@@ -371,6 +383,14 @@ void show_help(void) {
   printf("  -version       Print version\n");
   printf("  -size <size>   Set Basic workspace size to <size> bytes when starting\n");
   printf("                 Suffix with K, M or G to specify size in KiB, MiB or GiB.\n");
+#ifdef MATRIX64BIT
+  printf("  -bigmem        Allow a workspace larger than 4GB for large arrays\n");
+#endif
+#ifdef TARGET_LINUX
+  printf("  -hugepages     Use transparent huge pages for workspace and large arrays\n");
+  printf("  -hugetlb       Use explicit (hugetlbfs) huge pages for workspace and arrays\n");
+  printf("  -prefault      Commit workspace and large arrays when they are created\n");
+#endif
 #ifdef USE_SDL
   printf("  -fullscreen    Start Brandy in fullscreen mode\n");
   printf("  -nofull        Never use fullscreen mode\n");
@@ -383,10 +403,18 @@ void show_help(void) {
 #ifndef BRANDYAPP
   printf("  -nocheck       Skip new version check on immediate mode startup\n");
   printf("  -path <list>   Look for programs and libraries in directories in list <list>\n");
+#ifdef TARGET_UNIX
+  printf("  -cachedir <dir> Keep tokenised copies of programs and libraries in <dir>\n");
+  printf("  -loadthreads <n> Tokenise large programs and libraries using <n> threads\n");
+#endif
   printf("  -load <file>   Load Basic program <file> when the interpreter starts\n");
   printf("  -chain <file>  Run Basic program <file> and stay in interpreter when it ends\n");
   printf("  -quit <file>   Run Basic program <file> and leave interpreter when it ends\n");
+  printf("  -batch         Run without keyboard or screen and report run time at the end\n");
   printf("  -lib <file>    Load the Basic library <file> when the interpreter starts\n");
+  printf("  -link          Fill in line number references when programs are loaded\n");
+  printf("  -appimage <file> Save program and libraries as image for a standalone app\n");
+  printf("  -restore <file> Restore program saved by *SNAPSHOT in <file> and run it\n");
 #ifdef DEFAULT_IGNORE
   printf("  -strict        'Unsupported features' generate errors\n");
 #else
@@ -633,6 +661,10 @@ static detail errortable [] = {
 /* ERR_NODIR */         {NONFATAL, NOPARM,  189, "Unable to create directory"},
 /* ERR_FILELOCKED */    {NONFATAL, NOPARM,  195, "This item is locked to stop changes being made to it"},
 /* ERR_BAD_OSFILE */    {NONFATAL, NOPARM, 1026, "Bad OSFile call"},
+/* ERR_BAD_OSGBPB */    {NONFATAL, NOPARM,    0, "Bad OSGBPB call"},
+/* ERR_BADSNAPSHOT */   {NONFATAL, STRING,    0, "'%s' is not a snapshot that can be restored here"},
+/* ERR_SNAPOFFHEAP */   {NONFATAL, NOPARM,    0, "Off-heap arrays cannot be saved in a snapshot"},
+/* ERR_COMPRESSED */    {NONFATAL, NOPARM,    0, "This operation is not possible on a compressed file"},
 //
 // DO NOT PUT ANYTHING BELOW THIS LINE - THIS MUST BE THE LAST ERROR
 /* HIGHERROR */         {FATAL,    NOPARM,    0, "You should never see this"} /* ALWAYS leave this as the last error */
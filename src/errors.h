@@ -204,6 +204,10 @@ typedef enum {
     ERR_NODIR,          /* 104885 (189), Unable to create directory */
     ERR_FILELOCKED,     /* 67779  (195), This item is locked */
     ERR_BAD_OSFILE,     /* 1026, Bad OSFile call */
+    ERR_BAD_OSGBPB,     /* 0, Bad OSGBPB call */
+    ERR_BADSNAPSHOT,    /* 0, Snapshot cannot be restored */
+    ERR_SNAPOFFHEAP,    /* 0, Off-heap arrays cannot be saved in a snapshot */
+    ERR_COMPRESSED,     /* 0, Operation not possible on a compressed file */
 // No more errors
     HIGHERROR           /* Leave last, dummy error */
 } errnum;
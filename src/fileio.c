@@ -28,6 +28,7 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <unistd.h>
@@ -44,6 +45,20 @@
 #endif
 #include "keyboard.h"
 
+#ifdef TARGET_UNIX
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <errno.h>
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+#endif
+
 
 /* Floating point number format */
 enum {XMIXED_ENDIAN, XLITTLE_ENDIAN, XBIG_ENDIAN, XBIG_MIXED_ENDIAN} double_type;
@@ -58,18 +73,30 @@ typedef struct {
   eofstate eofstatus;           /* Current end-of-file status */
   boolean lastwaswrite;         /* TRUE if the last operation on a file was a write */
   int nethandle;                /* network handle */
+  byte *mapbase;                /* Start of file in memory if it has been mapped or NIL */
+  size_t mapsize;               /* Size of mapped file */
+  size_t mappos;                /* Current file pointer in mapped file */
+  struct asyncblock *async;     /* State of background reading or writing or NIL */
 } fileblock;
 
 #ifdef TARGET_RISCOS
 #define MAXFILES 4              /* Maximum number of files that can be open simultaneously - only tracks networking on RISC OS */
 #define FIRSTHANDLE 4           /* Number of first handle */
+
+static fileblock fileinfo [MAXFILES+1];
 #else
-#define MAXFILES 256            /* Maximum number of files that can be open simultaneously */
+#define INITFILES 256           /* Initial size of the file table. It doubles in size when it is full */
 #define FIRSTHANDLE 254         /* Number of first handle */
+#define HIGHHANDLE 256          /* Handle of entry FIRSTHANDLE, the first that cannot use a handle below 255 */
+
+static fileblock initialfiles [INITFILES];
+static fileblock *fileinfo;     /* Table of open files, 'initialfiles' until it has to grow */
+static int32 maxfiles;          /* Number of entries in the table */
+static int32 initialfree [INITFILES];
+static int32 *freeheap;         /* Min-heap of the indexes of unused entries, 'initialfree' until the table grows */
+static int32 freecount;         /* Number of entries in 'freeheap' */
 #endif
 
-static fileblock fileinfo [MAXFILES+1];
-
 /*
 ** 'isapath' returns TRUE if the file name passed to it is a pathname, that
 ** is, contains directories as well as a file name, and FALSE if it consists
@@ -306,12 +333,14 @@ int32 fileio_bget(int32 handle) {
 
 /*
 ** 'fileio_getdol' reads a string from a file. It saves the text read at
-** 'buffer'. Note that there is no check on the size of the buffer
-** so it is up to the functions that call this one to ensure that the
-** buffer is large enough to hold MAXSTRING (65536) characters.
+** 'buffer' and sets '*text' to point at it. Note that there is no check
+** on the size of the buffer so it is up to the functions that call this
+** one to ensure that the buffer is large enough to hold MAXSTRING (65536)
+** characters.
 */
-int32 fileio_getdol(int32 handle, char *buffer) {
+int32 fileio_getdol(int32 handle, char *buffer, char **text) {
   int32 length = 0;
+  *text = buffer;
   do {
     int32 ch = fileio_bget(handle);
     if (ch==_kernel_ERROR) report();    /* Function returned -2 = SWI call failed */
@@ -449,24 +478,25 @@ void fileio_bput(int32 handle, int32 value) {
 }
 
 /*
-** 'fileio_bputstr' writes a string to a file
+** 'fileio_putblock' writes 'count' bytes at 'buffer' to a file with
+** a single call rather than a byte at a time
 */
-void fileio_bputstr(int32 handle, char *string, int32 length) {
+void fileio_putblock(int32 handle, void *buffer, size_t count) {
   if (handle==0) {
     error(ERR_BADHANDLE);
     return;
   }
 #ifndef NONET
   if ((handle <= FIRSTHANDLE) && (fileinfo[handle].filetype==NETWORK)) {
-    if(net_bputstr(fileinfo[handle].nethandle, string, length)) error(ERR_CANTWRITE);
+    if(net_bputstr(fileinfo[handle].nethandle, buffer, count)) error(ERR_CANTWRITE);
   } else {
 #endif
     _kernel_oserror *oserror;
     _kernel_swi_regs regs;
     regs.r[0] = 2;      /* OS_GBPB 2 = write to file at current file pointer position */
     regs.r[1] = handle;
-    regs.r[2] = TOINT((int)string);
-    regs.r[3] = length;
+    regs.r[2] = TOINT((int)buffer);
+    regs.r[3] = count;
     oserror = _kernel_swi(OS_GBPB, &regs, &regs);
     if (oserror!=NIL) {
       error(ERR_CMDFAIL, oserror->errmess);
@@ -478,6 +508,53 @@ void fileio_bputstr(int32 handle, char *string, int32 length) {
 #endif
 }
 
+/*
+** 'fileio_bputstr' writes a string to a file
+*/
+void fileio_bputstr(int32 handle, char *string, int32 length) {
+  fileio_putblock(handle, string, length);
+}
+
+/*
+** 'fileio_getblock' reads up to 'count' bytes from file 'handle' into
+** 'buffer' with a single call rather than a byte at a time. It returns
+** the number of bytes read, which is less than 'count' if the end of
+** the file was reached. Unlike BGET, reading at the end of the file is
+** not an error
+*/
+size_t fileio_getblock(int32 handle, void *buffer, size_t count) {
+  size_t length = 0;
+  if (handle==0) {
+    error(ERR_BADHANDLE);
+    return 0;
+  }
+#ifndef NONET
+  if ((handle <= FIRSTHANDLE) && (fileinfo[handle].filetype==NETWORK)) {
+    while (length<count) {      /* Take whatever has been received */
+      int32 ch = net_bget(fileinfo[handle].nethandle);
+      if (ch<0) break;
+      CAST(buffer, byte *)[length++] = ch;
+    }
+  } else {
+#endif
+    _kernel_oserror *oserror;
+    _kernel_swi_regs regs;
+    regs.r[0] = 4;      /* OS_GBPB 4 = read from file at current file pointer position */
+    regs.r[1] = handle;
+    regs.r[2] = TOINT((int)buffer);
+    regs.r[3] = count;
+    oserror = _kernel_swi(OS_GBPB, &regs, &regs);
+    if (oserror!=NIL) {
+      error(ERR_CMDFAIL, oserror->errmess);
+      return 0;
+    }
+    length = count-regs.r[3];
+#ifndef NONET
+  }
+#endif
+  return length;
+}
+
 /*
 ** 'fileio_printint' writes a four byte integer to a file in binary
 ** preceded with 0x40 to mark it as an integer.
@@ -595,6 +672,15 @@ int32 fileio_eof(int32 handle) {
   return result==0 ? FALSE : TRUE;
 }
 
+/*
+** 'fileio_async' would turn asynchronous mode on or off for a file.
+** RISC OS's filing systems do their own buffering so the mode is not
+** provided
+*/
+boolean fileio_async(int32 handle, boolean on) {
+  return FALSE;
+}
+
 /*
 ** 'fileio_shutdown' is called at the end of the run of the
 ** interpreter. This is not required under RISC OS
@@ -635,248 +721,1070 @@ void init_fileio(void) {
 #define UPMODE "r+"
 #endif
 
+#define MAPTHRESHOLD 65536      /* Files opened for input at least this size are mapped into memory */
+
 /*
 ** 'map_handle' maps a Basic-style file handle to the corresponding entry
-** in the 'fileinfo' table and checks that the handle is valid
+** in the 'fileinfo' table and checks that the handle is valid. Entries
+** up to FIRSTHANDLE have handles counting down from FIRSTHANDLE as they
+** always have done. Entries after that have handles counting up from
+** HIGHHANDLE
 */
 static int32 map_handle(int32 handle) {
-  handle = FIRSTHANDLE-handle;
-  if (handle<0 || handle>=MAXFILES || fileinfo[handle].filetype==CLOSED) error(ERR_BADHANDLE);
+  if (handle>=HIGHHANDLE)
+    handle = handle-HIGHHANDLE+FIRSTHANDLE;
+  else if (handle>0 && handle<=FIRSTHANDLE)
+    handle = FIRSTHANDLE-handle;
+  else {
+    handle = -1;
+  }
+  if (handle<0 || handle>=maxfiles || fileinfo[handle].filetype==CLOSED) error(ERR_BADHANDLE);
   return handle;
 }
 
 /*
-** 'fileio_openin' opens a file for input
+** 'make_handle' returns the Basic-style file handle for entry 'n'
 */
-int32 fileio_openin(char *name, int32 namelen) {
-  FILE *thefile;
-  int32 n;
-  char filename [FNAMESIZE];
+static int32 make_handle(int32 n) {
+  return n<FIRSTHANDLE ? FIRSTHANDLE-n : n-FIRSTHANDLE+HIGHHANDLE;
+}
 
-  if ((namelen < 0) || (namelen > (FNAMESIZE - 1))) {
-    error(ERR_INVALIDFNAME);
-    return 0;
-  }
-  for (n=0; n<MAXFILES && fileinfo[n].stream!=NIL; n++);        /* Find an unused handle */
-  if (n>=MAXFILES) {
-    error(ERR_MAXHANDLE);
-    return 0;
+/*
+** 'init_entries' marks entries 'first' to 'last'-1 in the 'fileinfo'
+** table as unused and puts them in the free heap. This is only done
+** when the heap is empty, so adding them in order keeps it a heap
+*/
+static void init_entries(int32 first, int32 last) {
+  int32 n;
+  for (n=first; n<last; n++) {
+    fileinfo[n].stream = NIL;
+    fileinfo[n].filetype = CLOSED;
+    fileinfo[n].eofstatus = ATEOF;
+    fileinfo[n].mapbase = NIL;
+    fileinfo[n].async = NIL;
+    freeheap[n-first] = n;
   }
-  memmove(filename, name, namelen);
-  filename[namelen] = asc_NUL;
-  thefile = fopen(filename, INMODE);
-  if (thefile==NIL) {
-    char filenameb[FNAMESIZE];
-    STRLCPY(filenameb, filename, FNAMESIZE);
-    /* Append a .bbc suffix and try again */
-    STRLCAT(filenameb, ".bbc", FNAMESIZE);
-    thefile = fopen(filenameb, INMODE);
-    if (thefile==NIL) {
-      if (matrixflags.translatefname == 0) {
-        return 0;
-      } else {
-        char *tfilename = translatefname(filename);
-        thefile = fopen(tfilename, INMODE);
-        if (thefile==NIL) {
-          return 0; /* Could not open file - Return null handle */
-        } else {
-          /* We had to translate so set flags to always translate on save */
-          matrixflags.translatefname = 1;
-        }
+  freecount = last-first;
+}
+
+/*
+** 'find_entry' returns the index of the entry in the 'fileinfo' table
+** that the next file opened will use. This is the lowest unused entry,
+** so that the same handle as before is always the next one used. If
+** every entry is in use the table is doubled in size. It returns -1 if
+** the table cannot be made any larger. The entry is only taken out of
+** the free heap by 'claim_entry' once the file has been opened
+*/
+static int32 find_entry(void) {
+  fileblock *newinfo;
+  int32 *newheap;
+  if (freecount==0) {
+    if (fileinfo==initialfiles) {
+      newinfo = malloc(2*maxfiles*sizeof(fileblock));
+      newheap = malloc(2*maxfiles*sizeof(int32));
+      if (newinfo==NIL || newheap==NIL) {
+        free(newinfo);
+        free(newheap);
+        return -1;
       }
+      memcpy(newinfo, fileinfo, maxfiles*sizeof(fileblock));
     }
+    else {
+      newheap = realloc(freeheap, 2*maxfiles*sizeof(int32));
+      if (newheap==NIL) return -1;
+      freeheap = newheap;       /* A heap larger than needed does no harm */
+      newinfo = realloc(fileinfo, 2*maxfiles*sizeof(fileblock));
+      if (newinfo==NIL) return -1;
+    }
+    fileinfo = newinfo;
+    freeheap = newheap;
+    init_entries(maxfiles, 2*maxfiles);
+    maxfiles = 2*maxfiles;
   }
-  fileinfo[n].stream = thefile;
-  fileinfo[n].filetype = OPENIN;
-  fileinfo[n].eofstatus = OKAY;
-  fileinfo[n].lastwaswrite = FALSE;
-  return FIRSTHANDLE-n;
+  return freeheap[0];
 }
 
 /*
-** 'fileio_openout' opens file 'name' for output, creating the
-** file (or recreating it if it already exists).
-** Note that the file is opened with mode "w+" so that it can be
-** both written to and read from. RISC OS allows files opened for
-** output to be read from as well
+** 'claim_entry' removes entry 'n', the one returned by 'find_entry',
+** from the top of the free heap
 */
-int32 fileio_openout(char *name, int32 namelen) {
-  FILE *thefile;
-  int32 n;
-  char filename [FNAMESIZE];
-
-  if ((namelen < 0) || (namelen > (FNAMESIZE - 1))) {
-    error(ERR_INVALIDFNAME);
-    return 0;
-  }
-  for (n=0; n<MAXFILES && fileinfo[n].stream!=NIL; n++);        /* Find an unused handle */
-  if (n>=MAXFILES) {
-    error(ERR_MAXHANDLE);
-    return 0;
-  }
-  memmove(filename, name, namelen);
-  filename[namelen] = asc_NUL;
-  if(matrixflags.translatefname == 1) {
-    char *tfilename = translatefname(filename);
-    thefile = fopen(tfilename, OUTMODE);
-  } else {
-    thefile = fopen(filename, OUTMODE);
-  }
-  if (thefile==NIL) {
-    error(ERR_OPENWRITE, filename);
-    return 0;
-  }
-  fileinfo[n].stream = thefile;
-  fileinfo[n].filetype = OPENOUT;
-  fileinfo[n].eofstatus = OKAY;
-  fileinfo[n].lastwaswrite = FALSE;
-  return FIRSTHANDLE-n;
+static void claim_entry(int32 n) {
+  int32 parent, child, last;
+  last = freeheap[--freecount];
+  parent = 0;
+  while ((child = 2*parent+1)<freecount) {
+    if (child+1<freecount && freeheap[child+1]<freeheap[child]) child++;
+    if (last<=freeheap[child]) break;
+    freeheap[parent] = freeheap[child];
+    parent = child;
+  }
+  freeheap[parent] = last;
 }
 
 /*
-** 'fileio_openup' opens a file for update. The file must exist
-** already. The file can both be read from and written to
+** 'release_entry' puts entry 'n' back in the free heap
 */
-int32 fileio_openup(char *name, int32 namelen) {
-  FILE *thefile;
-  int32 n;
-  char filename [FNAMESIZE];
-  char filenameb[FNAMESIZE];
-  char *tfilename;
+static void release_entry(int32 n) {
+  int32 child, parent;
+  child = freecount++;
+  while (child>0 && freeheap[parent = (child-1)/2]>n) {
+    freeheap[child] = freeheap[parent];
+    child = parent;
+  }
+  freeheap[child] = n;
+}
 
-  if ((namelen < 0) || (namelen > (FNAMESIZE - 1))) {
-    error(ERR_INVALIDFNAME);
-    return 0;
-  }
-  for (n=0; n<MAXFILES && fileinfo[n].stream!=NIL; n++);        /* Find an unused handle */
-  if (n>=MAXFILES) {
-    error(ERR_MAXHANDLE);
-    return 0;
-  }
-  memmove(filename, name, namelen);
-  filename[namelen] = asc_NUL;
-#ifndef NONET
-  /* Check, does it start "ip4:" if so use network handler to open it. */
-  if (!strncmp(filename, "ip0:", 4) || !strncmp(filename, "ip4:", 4) || !strncmp(filename, "ip6:", 4)) {
-    int handle;
-    handle=brandynet_connect(filename+4, filename[2], 1);
-    if (handle == -1) return 0;
-    fileinfo[n].stream = (void *)42; /* Not used, but != NIL */
-    fileinfo[n].filetype = NETWORK;
-    fileinfo[n].eofstatus = OKAY;
-    fileinfo[n].lastwaswrite = FALSE;
-    fileinfo[n].nethandle = handle;
-    return FIRSTHANDLE-n;
-  } else {
-#endif
-    thefile = fopen(filename, UPMODE);
-    if (thefile==NIL) {
-      STRLCPY(filenameb, filename, FNAMESIZE);
-      STRLCAT(filenameb, ".bbc", FNAMESIZE); /* Append a .bbc suffix and try again */
-      thefile = fopen(filenameb, UPMODE);
-      if (thefile==NIL) {
-        if (matrixflags.translatefname == 0) {
-          return 0;
-        } else {
-          tfilename=translatefname(filename);
-          thefile = fopen(tfilename, UPMODE);
-          if (thefile==NIL) {
-            return 0; /* Could not open file - Return null handle */
-          } else {
-            /* We had to translate so set flags to always translate on save */
-            matrixflags.translatefname = 1;
-          }
-        }
-      }
-    }
-    fileinfo[n].stream = thefile;
-    fileinfo[n].filetype = OPENUP;
-    fileinfo[n].eofstatus = OKAY;
-    fileinfo[n].lastwaswrite = FALSE;
-    return FIRSTHANDLE-n;
-#ifndef NONET
+/*
+** 'open_file' opens file 'name' with 'fopen'. If the process has run
+** out of file descriptors, its limit is raised as far as it is allowed
+** to go and the file tried again
+*/
+static FILE *open_file(char *name, char *mode) {
+  FILE *thefile = fopen(name, mode);
+#ifdef TARGET_UNIX
+  struct rlimit limit;
+  if (thefile==NIL && errno==EMFILE && getrlimit(RLIMIT_NOFILE, &limit)==0 && limit.rlim_cur<limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit)==0) thefile = fopen(name, mode);
   }
 #endif
+  return thefile;
 }
 
+#ifdef TARGET_UNIX
 /*
-** 'close_file' is a function used locally to close a file or network channel
+** 'map_infile' maps the file opened for input with 'fileinfo' entry 'n'
+** into memory if it is a regular file of at least MAPTHRESHOLD bytes.
+** BGET#, GET$#, PTR# and EOF# then work directly on the mapping rather
+** than going through stdio. The stream is kept open to hold the file
+** and for the operations that are not handled specially. If the file
+** cannot be mapped it is simply read via the stream
 */
-static void close_file(int32 handle) {
-#ifndef NONET
-  if ((handle <= FIRSTHANDLE) && (fileinfo[handle].filetype == NETWORK)) {
-    brandynet_close(fileinfo[handle].nethandle);
-    fileinfo[handle].stream = NIL;
-    fileinfo[handle].filetype = CLOSED;
-    fileinfo[handle].lastwaswrite = FALSE;
-    fileinfo[handle].nethandle = -1;
-  } else {
+static void map_infile(int32 n) {
+  struct stat filestat;
+  void *base;
+
+  if (fstat(fileno(fileinfo[n].stream), &filestat) == -1 || !S_ISREG(filestat.st_mode)
+   || filestat.st_size < MAPTHRESHOLD || (uint64)filestat.st_size > (size_t)-1) return;
+  base = mmap(NIL, filestat.st_size, PROT_READ, MAP_PRIVATE, fileno(fileinfo[n].stream), 0);
+  if (base == MAP_FAILED) return;
+  madvise(base, filestat.st_size, MADV_SEQUENTIAL);
+  fileinfo[n].mapbase = base;
+  fileinfo[n].mapsize = filestat.st_size;
+  fileinfo[n].mappos = 0;
+}
 #endif
-    fclose(fileinfo[handle].stream);
-    fileinfo[handle].stream = NIL;
-    fileinfo[handle].filetype = CLOSED;
-    fileinfo[handle].lastwaswrite = FALSE;
-#ifndef NONET
+
+/*
+** 'refresh_map' checks that mapped file 'n' is still the size it was
+** when it was mapped, as another program could have changed it since.
+** If the file has grown it is mapped again so that the new data can be
+** read. If it has shrunk, the mapping is dropped and the file is read
+** via its stream from then on, as touching the part of the mapping past
+** the new end of the file raises SIGBUS. The function returns TRUE if
+** the mapping was changed
+*/
+static boolean refresh_map(int32 n) {
+#ifdef TARGET_UNIX
+  struct stat filestat;
+  void *base;
+
+  if (fileinfo[n].mapbase==NIL || fstat(fileno(fileinfo[n].stream), &filestat) == -1
+   || (uint64)filestat.st_size == fileinfo[n].mapsize) return FALSE;
+  if ((uint64)filestat.st_size > fileinfo[n].mapsize && (uint64)filestat.st_size <= (size_t)-1) {
+    base = mmap(NIL, filestat.st_size, PROT_READ, MAP_PRIVATE, fileno(fileinfo[n].stream), 0);
+    if (base != MAP_FAILED) {
+      madvise(base, filestat.st_size, MADV_SEQUENTIAL);
+      munmap(fileinfo[n].mapbase, fileinfo[n].mapsize);
+      fileinfo[n].mapbase = base;
+      fileinfo[n].mapsize = filestat.st_size;
+      return TRUE;
+    }
   }
+  fseek(fileinfo[n].stream, fileinfo[n].mappos, SEEK_SET);
+  munmap(fileinfo[n].mapbase, fileinfo[n].mapsize);
+  fileinfo[n].mapbase = NIL;
+  return TRUE;
+#else
+  return FALSE;
 #endif
 }
 
 /*
-** 'fileio_close' closes the file given by 'handle' or all open files
-** if 'handle' is zero
+** 'fileio_checkmaps' is called when SIGBUS is raised to deal with any
+** mapped file that has been truncated by another program
 */
-void fileio_close(int32 handle) {
+void fileio_checkmaps(void) {
   int32 n;
-  if (handle==0) {      /* Close all open files */
-    for (n=0; n<MAXFILES; n++) {
-      if (fileinfo[n].filetype!=CLOSED) close_file(n);
-    }
-  }
-  else {        /* close one file */
-    n = map_handle(handle);
-    if (fileinfo[n].filetype!=CLOSED) close_file(n);
+
+  for (n=0; n<maxfiles; n++) {
+    if (fileinfo[n].filetype!=CLOSED) refresh_map(n);
   }
 }
 
+#ifdef TARGET_UNIX
 /*
-** 'fileio_bget' returns the next character from file 'handle'.
-** Note that RISC OS allows you to read from a file that has been opened for
-** writing. One byte can be read. The next attempt to read anything will
-** result in an end-of-file error.
+** A file opened with OPENIN or OPENOUT can be switched into asynchronous
+** mode. A background thread then reads ahead of the program into a ring
+** of blocks or writes out the blocks the program has filled, so that the
+** program and the file I/O overlap. 'current' is the block the program
+** is working on and 'queued' is the number of blocks, starting with
+** 'current' when reading and ending just before it when writing, that
+** are full. Apart from the program's position in its block ('curpos' and
+** 'curlen'), everything is protected by 'lock'
+**
+** Compressed files are handled the same way. The thread decompresses
+** the file into the blocks as it reads it or compresses the blocks as
+** it writes them, so the program only ever sees the uncompressed data
+** and this mode cannot be turned off for them
 */
-int32 fileio_bget(int32 handle) {
-  int32 ch;
+#define ASYNCBLOCKS 4           /* Number of blocks in the ring */
+#define ASYNCBLOCKSIZE 65536    /* Size of each block */
+
+enum {NOCODEC, GZIPCODEC, ZSTDCODEC};   /* Compression used for a file */
+
+typedef struct asyncblock {
+  pthread_t thread;             /* Background thread */
+  pthread_mutex_t lock;
+  pthread_cond_t changed;       /* Signalled when a block is filled, read, written or handed over */
+  int fd;                       /* File descriptor used by the thread */
+  boolean writing;              /* TRUE if writing behind, FALSE if reading ahead */
+  boolean stop;                 /* TRUE to make the thread finish */
+  boolean ateof;                /* TRUE if the thread has reached the end of the file */
+  boolean failed;               /* TRUE if a read or write failed */
+  int32 current;                /* Block the program is reading or filling */
+  int32 queued;                 /* Number of full blocks */
+  size_t curpos;                /* Program's offset in the current block */
+  size_t curlen;                /* Bytes available to the program in the current block */
+  int64 fileoffset;             /* Where the thread reads or writes next */
+  int64 position;               /* Program's file pointer */
+  size_t blocklen[ASYNCBLOCKS];
+  byte *block[ASYNCBLOCKS];
+  int32 codec;                  /* Compression used for the file */
+  byte *packed;                 /* Compressed data being read or written by the thread */
+  size_t packedpos;             /* Offset of the next unused compressed byte when reading */
+  size_t packedlen;             /* Number of bytes in 'packed' when reading */
+  boolean unfinished;           /* TRUE if the zstd data read so far stops part way through a frame */
+#ifdef HAVE_ZLIB_H
+  z_stream gzip;
+#endif
+#ifdef HAVE_ZSTD_H
+  ZSTD_DStream *zstdin;
+  ZSTD_CStream *zstdout;
+#endif
+} asyncblock;
 
-  if (handle==0) {
-    error(ERR_BADHANDLE);
-    return 0;
-  }
-  handle = map_handle(handle);
-#ifndef NONET
-  if (fileinfo[handle].filetype == NETWORK) {
-    ch=net_bget(fileinfo[handle].nethandle);
-    if (ch == -2) {
-      if (fileinfo[handle].eofstatus == PENDING) {
-        fileinfo[handle].eofstatus = ATEOF;
-        error(ERR_HITEOF);
-        return 0;
-      } else {
-        fileinfo[handle].eofstatus = PENDING;
-      }
-    }
-  } else {
+#if defined(HAVE_ZLIB_H) || defined(HAVE_ZSTD_H)
+/*
+** 'packed_read' reads the next block of compressed data into the
+** 'packed' buffer. It returns the number of bytes read, zero at the
+** end of the file or -1 if the read failed
+*/
+static ssize_t packed_read(asyncblock *ap) {
+  ssize_t done = pread(ap->fd, ap->packed, ASYNCBLOCKSIZE, ap->fileoffset);
+  if (done>0) ap->fileoffset+=done;
+  ap->packedpos = 0;
+  ap->packedlen = done>0 ? done : 0;
+  return done;
+}
 #endif
-    if (fileinfo[handle].eofstatus!=OKAY) {     /* If EOF is pending, flag an error */
-      fileinfo[handle].eofstatus = ATEOF;
-      error(ERR_HITEOF);
-      return 0;
+
+/*
+** 'packed_write' writes 'count' bytes at 'data' to the file at the
+** thread's file offset. It returns FALSE if they could not all be
+** written
+*/
+static boolean packed_write(asyncblock *ap, byte *data, size_t count) {
+  ssize_t done;
+  size_t total;
+  for (total=0; total<count; total+=done) {
+    done = pwrite(ap->fd, data+total, count-total, ap->fileoffset+total);
+    if (done<=0) break;
+  }
+  ap->fileoffset+=total;
+  return total==count;
+}
+
+#ifdef HAVE_ZLIB_H
+/*
+** 'gzip_read' decompresses the next part of a gzip file into 'block'.
+** Files made of several gzip members are read as one. A file that
+** ends part of the way through a member is treated as a read error
+** once the data before that point has been returned
+*/
+static ssize_t gzip_read(asyncblock *ap, byte *block) {
+  z_stream *zp = &ap->gzip;
+  int result;
+  zp->next_out = block;
+  zp->avail_out = ASYNCBLOCKSIZE;
+  while (zp->avail_out>0) {
+    if (zp->avail_in==0) {
+      ssize_t done = packed_read(ap);
+      if (done<0 || (done==0 && zp->total_in>0 && zp->avail_out==ASYNCBLOCKSIZE)) return -1;
+      if (done==0) break;
+      zp->next_in = ap->packed;
+      zp->avail_in = done;
     }
-    else if (fileinfo[handle].filetype==OPENOUT) {      /* If file is open for output, read one char */
-      fileinfo[handle].eofstatus = PENDING;
+    result = inflate(zp, Z_NO_FLUSH);
+    if (result==Z_STREAM_END)
+      inflateReset(zp);         /* Another member might follow */
+    else if (result!=Z_OK && result!=Z_BUF_ERROR) {
+      return -1;
     }
-    if (fileinfo[handle].lastwaswrite) {                /* Ensure everything has been written to disk first */
-      fflush(fileinfo[handle].stream);
-      fileinfo[handle].lastwaswrite = FALSE;
+  }
+  return ASYNCBLOCKSIZE-zp->avail_out;
+}
+
+/*
+** 'gzip_write' compresses 'count' bytes at 'data' and writes out the
+** compressed data as the 'packed' buffer fills. If 'finish' is TRUE
+** the gzip stream is completed
+*/
+static boolean gzip_write(asyncblock *ap, byte *data, size_t count, boolean finish) {
+  z_stream *zp = &ap->gzip;
+  int result;
+  zp->next_in = data;
+  zp->avail_in = count;
+  do {
+    zp->next_out = ap->packed;
+    zp->avail_out = ASYNCBLOCKSIZE;
+    result = deflate(zp, finish ? Z_FINISH : Z_NO_FLUSH);
+    if (result==Z_STREAM_ERROR || !packed_write(ap, ap->packed, ASYNCBLOCKSIZE-zp->avail_out)) return FALSE;
+  } while (zp->avail_out==0 || (finish && result!=Z_STREAM_END));
+  return TRUE;
+}
+#endif
+
+#ifdef HAVE_ZSTD_H
+/*
+** 'zstd_read' decompresses the next part of a zstd file into 'block'
+*/
+static ssize_t zstd_read(asyncblock *ap, byte *block) {
+  ZSTD_inBuffer input;
+  ZSTD_outBuffer output = {block, ASYNCBLOCKSIZE, 0};
+  size_t result;
+  while (output.pos<output.size) {
+    if (ap->packedpos==ap->packedlen) {
+      ssize_t done = packed_read(ap);
+      if (done<0 || (done==0 && ap->unfinished && output.pos==0)) return -1;
+      if (done==0) break;
+    }
+    input.src = ap->packed;
+    input.size = ap->packedlen;
+    input.pos = ap->packedpos;
+    result = ZSTD_decompressStream(ap->zstdin, &output, &input);
+    if (ZSTD_isError(result)) return -1;
+    ap->unfinished = result!=0;
+    ap->packedpos = input.pos;
+  }
+  return output.pos;
+}
+
+/*
+** 'zstd_write' is the zstd version of 'gzip_write'
+*/
+static boolean zstd_write(asyncblock *ap, byte *data, size_t count, boolean finish) {
+  ZSTD_inBuffer input = {data, count, 0};
+  ZSTD_outBuffer output;
+  size_t remaining;
+  do {
+    output.dst = ap->packed;
+    output.size = ASYNCBLOCKSIZE;
+    output.pos = 0;
+    remaining = ZSTD_compressStream2(ap->zstdout, &output, &input, finish ? ZSTD_e_end : ZSTD_e_continue);
+    if (ZSTD_isError(remaining) || !packed_write(ap, ap->packed, output.pos)) return FALSE;
+  } while (input.pos<input.size || (finish && remaining>0));
+  return TRUE;
+}
+#endif
+
+/*
+** 'async_read' fills 'block' with the next part of the file, which is
+** decompressed if need be. It returns the number of bytes in the
+** block, zero at the end of the file or -1 if the read failed
+*/
+static ssize_t async_read(asyncblock *ap, byte *block) {
+  ssize_t done;
+  switch (ap->codec) {
+#ifdef HAVE_ZLIB_H
+  case GZIPCODEC:
+    return gzip_read(ap, block);
+#endif
+#ifdef HAVE_ZSTD_H
+  case ZSTDCODEC:
+    return zstd_read(ap, block);
+#endif
+  }
+  done = pread(ap->fd, block, ASYNCBLOCKSIZE, ap->fileoffset);
+  if (done>0) ap->fileoffset+=done;
+  return done;
+}
+
+/*
+** 'async_write' writes 'count' bytes at 'data' to the file, compressing
+** them if need be. 'finish' is TRUE for the last call when the file is
+** compressed. It returns FALSE if the write failed
+*/
+static boolean async_write(asyncblock *ap, byte *data, size_t count, boolean finish) {
+  switch (ap->codec) {
+#ifdef HAVE_ZLIB_H
+  case GZIPCODEC:
+    return gzip_write(ap, data, count, finish);
+#endif
+#ifdef HAVE_ZSTD_H
+  case ZSTDCODEC:
+    return zstd_write(ap, data, count, finish);
+#endif
+  }
+  return packed_write(ap, data, count);
+}
+
+/*
+** 'codec_start' sets up the compression or decompression of the file
+** ready for the thread to start at the beginning of it. It returns
+** FALSE if this cannot be done
+*/
+static boolean codec_start(asyncblock *ap) {
+  ap->packedpos = ap->packedlen = 0;
+  ap->unfinished = FALSE;
+  switch (ap->codec) {
+#ifdef HAVE_ZLIB_H
+  case GZIPCODEC:
+    memset(&ap->gzip, 0, sizeof(z_stream));
+    if (ap->writing) return deflateInit2(&ap->gzip, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY)==Z_OK;
+    return inflateInit2(&ap->gzip, 15+16)==Z_OK;
+#endif
+#ifdef HAVE_ZSTD_H
+  case ZSTDCODEC:
+    if (ap->writing) {
+      ap->zstdout = ZSTD_createCStream();
+      return ap->zstdout!=NIL;
+    }
+    ap->zstdin = ZSTD_createDStream();
+    return ap->zstdin!=NIL && !ZSTD_isError(ZSTD_initDStream(ap->zstdin));
+#endif
+  }
+  return TRUE;
+}
+
+/*
+** 'codec_end' frees what 'codec_start' set up
+*/
+static void codec_end(asyncblock *ap) {
+  switch (ap->codec) {
+#ifdef HAVE_ZLIB_H
+  case GZIPCODEC:
+    if (ap->writing) deflateEnd(&ap->gzip); else inflateEnd(&ap->gzip);
+    break;
+#endif
+#ifdef HAVE_ZSTD_H
+  case ZSTDCODEC:
+    ZSTD_freeCStream(ap->zstdout);
+    ZSTD_freeDStream(ap->zstdin);
+    ap->zstdout = NIL;
+    ap->zstdin = NIL;
+    break;
+#endif
+  }
+}
+
+/*
+** 'async_thread' is the background thread of a file in asynchronous mode
+*/
+static void *async_thread(void *arg) {
+  asyncblock *ap = arg;
+  int32 slot;
+  ssize_t done;
+  boolean written;
+
+  pthread_mutex_lock(&ap->lock);
+  while (!ap->stop) {
+    if (ap->writing && ap->queued>0 && !ap->failed) {   /* Write out the oldest block */
+      slot = (ap->current-ap->queued+ASYNCBLOCKS) % ASYNCBLOCKS;
+      pthread_mutex_unlock(&ap->lock);
+      written = async_write(ap, ap->block[slot], ap->blocklen[slot], FALSE);
+      pthread_mutex_lock(&ap->lock);
+      if (!written) ap->failed = TRUE;
+      ap->queued--;
+      pthread_cond_broadcast(&ap->changed);
+    }
+    else if (!ap->writing && ap->queued<ASYNCBLOCKS && !ap->ateof && !ap->failed) {    /* Read the next block */
+      slot = (ap->current+ap->queued) % ASYNCBLOCKS;
+      pthread_mutex_unlock(&ap->lock);
+      done = async_read(ap, ap->block[slot]);
+      pthread_mutex_lock(&ap->lock);
+      if (done<0)
+        ap->failed = TRUE;
+      else if (done==0)
+        ap->ateof = TRUE;
+      else {
+        ap->blocklen[slot] = done;
+        ap->queued++;
+      }
+      pthread_cond_broadcast(&ap->changed);
+    }
+    else {
+      pthread_cond_wait(&ap->changed, &ap->lock);
+    }
+  }
+  if (ap->writing && ap->codec!=NOCODEC && !ap->failed && !async_write(ap, NIL, 0, TRUE)) ap->failed = TRUE;
+  pthread_mutex_unlock(&ap->lock);
+  return NIL;
+}
+
+/*
+** 'async_start' starts the background thread reading or writing at
+** file offset 'offset'. It returns FALSE if the thread cannot be created
+*/
+static boolean async_start(asyncblock *ap, int64 offset) {
+  ap->stop = ap->ateof = ap->failed = FALSE;
+  ap->current = ap->queued = 0;
+  ap->curpos = 0;
+  ap->curlen = ap->writing ? ASYNCBLOCKSIZE : 0;
+  ap->fileoffset = ap->position = offset;
+  if (!codec_start(ap)) return FALSE;
+  if (pthread_create(&ap->thread, NIL, async_thread, ap)==0) return TRUE;
+  codec_end(ap);
+  return FALSE;
+}
+
+/*
+** 'async_stop' makes the background thread finish and waits for it
+*/
+static void async_stop(asyncblock *ap) {
+  pthread_mutex_lock(&ap->lock);
+  ap->stop = TRUE;
+  pthread_cond_broadcast(&ap->changed);
+  pthread_mutex_unlock(&ap->lock);
+  pthread_join(ap->thread, NIL);
+  codec_end(ap);
+}
+
+/*
+** 'async_nextblock' is called when the program has read everything in
+** the current block. It hands the block back to the background thread
+** and waits for the next one. It returns FALSE at the end of the file
+*/
+static boolean async_nextblock(asyncblock *ap) {
+  boolean failed;
+
+  pthread_mutex_lock(&ap->lock);
+  if (ap->curlen>0) {
+    ap->current = (ap->current+1) % ASYNCBLOCKS;
+    ap->queued--;
+    ap->curpos = ap->curlen = 0;
+    pthread_cond_broadcast(&ap->changed);
+  }
+  while (ap->queued==0 && !ap->ateof && !ap->failed) pthread_cond_wait(&ap->changed, &ap->lock);
+  if (ap->queued>0) ap->curlen = ap->blocklen[ap->current];
+  failed = ap->failed && ap->queued==0;
+  pthread_mutex_unlock(&ap->lock);
+  if (failed) error(ERR_CANTREAD);
+  return ap->curlen>0;
+}
+
+/*
+** 'async_queue' passes the part of the current block that the program
+** has filled to the background thread to write. The caller must hold
+** the lock
+*/
+static void async_queue(asyncblock *ap) {
+  if (ap->curpos>0) {
+    ap->blocklen[ap->current] = ap->curpos;
+    ap->current = (ap->current+1) % ASYNCBLOCKS;
+    ap->queued++;
+    ap->curpos = 0;
+    pthread_cond_broadcast(&ap->changed);
+  }
+}
+
+/*
+** 'async_handover' hands the current block over to be written and waits
+** for a free one. If 'wait' is TRUE it also waits for everything to be
+** written
+*/
+static void async_handover(asyncblock *ap, boolean wait) {
+  boolean failed;
+
+  pthread_mutex_lock(&ap->lock);
+  async_queue(ap);
+  while ((ap->queued==ASYNCBLOCKS || (wait && ap->queued>0)) && !ap->failed) pthread_cond_wait(&ap->changed, &ap->lock);
+  failed = ap->failed;
+  pthread_mutex_unlock(&ap->lock);
+  if (failed) error(ERR_CANTWRITE);
+}
+
+/*
+** 'async_getc' returns the next byte from a file being read ahead or
+** EOF at the end of the file
+*/
+static int32 async_getc(asyncblock *ap) {
+  if (ap->curpos>=ap->curlen && !async_nextblock(ap)) return EOF;
+  ap->position++;
+  return ap->block[ap->current][ap->curpos++];
+}
+
+/*
+** 'async_skip' moves the program on by 'count' bytes in a file being
+** read ahead, stopping at the end of the file
+*/
+static void async_skip(asyncblock *ap, int64 count) {
+  size_t chunk;
+  while (count>0 && (ap->curpos<ap->curlen || async_nextblock(ap))) {
+    chunk = ap->curlen-ap->curpos;
+    if (chunk>count) chunk = count;
+    ap->curpos+=chunk;
+    ap->position+=chunk;
+    count-=chunk;
+  }
+}
+
+/*
+** 'async_putc' adds a byte to the data being written behind
+*/
+static void async_putc(asyncblock *ap, int32 value) {
+  if (ap->curpos==ASYNCBLOCKSIZE) async_handover(ap, FALSE);
+  ap->block[ap->current][ap->curpos++] = value;
+  ap->position++;
+}
+
+/*
+** 'async_free' frees the asynchronous mode state 'ap' once its thread
+** has finished or if it never started
+*/
+static void async_free(asyncblock *ap) {
+  int32 b;
+  pthread_mutex_destroy(&ap->lock);
+  pthread_cond_destroy(&ap->changed);
+  for (b=0; b<ASYNCBLOCKS; b++) free(ap->block[b]);
+  free(ap->packed);
+  free(ap);
+}
+
+/*
+** 'async_release' returns file 'n' to synchronous operation, writing
+** out anything still waiting to be written and leaving the stream's
+** file pointer where the program expects it to be. It returns FALSE if
+** the data could not all be written
+*/
+static boolean async_release(int32 n) {
+  asyncblock *ap = fileinfo[n].async;
+  boolean failed;
+
+  if (ap->writing) {     /* Wait for everything to be written */
+    pthread_mutex_lock(&ap->lock);
+    async_queue(ap);
+    while (ap->queued>0 && !ap->failed) pthread_cond_wait(&ap->changed, &ap->lock);
+    pthread_mutex_unlock(&ap->lock);
+  }
+  async_stop(ap);
+  failed = ap->writing && ap->failed;
+  if (ap->codec==NOCODEC) fseek(fileinfo[n].stream, ap->position, SEEK_SET);
+  async_free(ap);
+  fileinfo[n].async = NIL;
+  return !failed;
+}
+
+/*
+** 'async_off' is used when an operation that the background thread
+** does not handle is carried out on file 'n'. Compressed files can
+** only be read or written through the thread
+*/
+static void async_off(int32 n) {
+  if (fileinfo[n].async->codec!=NOCODEC) error(ERR_COMPRESSED);
+  if (!async_release(n)) error(ERR_CANTWRITE);
+}
+
+/*
+** 'async_create' puts file 'n' into asynchronous mode, with the data
+** compressed or decompressed using 'codec'. It returns FALSE if there
+** is not enough memory or the thread cannot be started
+*/
+static boolean async_create(int32 n, int32 codec) {
+  asyncblock *ap;
+  int32 b;
+
+  ap = calloc(1, sizeof(asyncblock));
+  if (ap==NIL) return FALSE;
+  for (b=0; b<ASYNCBLOCKS && (ap->block[b] = malloc(ASYNCBLOCKSIZE))!=NIL; b++);
+  if (codec!=NOCODEC) ap->packed = malloc(ASYNCBLOCKSIZE);
+  fflush(fileinfo[n].stream);
+  fileinfo[n].lastwaswrite = FALSE;
+  ap->fd = fileno(fileinfo[n].stream);
+  ap->writing = fileinfo[n].filetype==OPENOUT;
+  ap->codec = codec;
+  pthread_mutex_init(&ap->lock, NIL);
+  pthread_cond_init(&ap->changed, NIL);
+  if (b<ASYNCBLOCKS || (codec!=NOCODEC && ap->packed==NIL) || !async_start(ap, ftell(fileinfo[n].stream))) {
+    async_free(ap);
+    return FALSE;
+  }
+  fileinfo[n].async = ap;
+  return TRUE;
+}
+
+/*
+** 'find_codec' returns the compression used by the file opened for
+** input as entry 'n', going by the first few bytes of the file. It
+** returns NOCODEC if the file is not compressed in a way that this
+** build of the interpreter can read
+*/
+static int32 find_codec(int32 n) {
+  byte magic[4];
+  if (pread(fileno(fileinfo[n].stream), magic, sizeof(magic), 0)!=sizeof(magic)) return NOCODEC;
+#ifdef HAVE_ZLIB_H
+  if (magic[0]==0x1F && magic[1]==0x8B && magic[2]==8) return GZIPCODEC;
+#endif
+#ifdef HAVE_ZSTD_H
+  if (magic[0]==0x28 && magic[1]==0xB5 && magic[2]==0x2F && magic[3]==0xFD) return ZSTDCODEC;
+#endif
+  return NOCODEC;
+}
+
+/*
+** 'name_codec' returns the compression to use for a file being written
+** going by the suffix of its name 'name'
+*/
+static int32 name_codec(char *name) {
+#if defined(HAVE_ZLIB_H) || defined(HAVE_ZSTD_H)
+  size_t length = strlen(name);
+#endif
+#ifdef HAVE_ZLIB_H
+  if (length>3 && strcmp(name+length-3, ".gz")==0) return GZIPCODEC;
+#endif
+#ifdef HAVE_ZSTD_H
+  if (length>4 && strcmp(name+length-4, ".zst")==0) return ZSTDCODEC;
+#endif
+  return NOCODEC;
+}
+
+/*
+** 'open_compressed' switches file 'n', which has just been opened, to
+** compressing or decompressing its data with 'codec'. If this cannot
+** be done the file is closed again
+*/
+static void open_compressed(int32 n, int32 codec) {
+  if (async_create(n, codec)) return;
+  fclose(fileinfo[n].stream);
+  fileinfo[n].stream = NIL;
+  fileinfo[n].filetype = CLOSED;
+  error(ERR_NOROOM);
+}
+#endif
+
+/*
+** 'fileio_async' turns asynchronous mode on or off for the file with
+** handle 'handle'. Only files opened with OPENIN or OPENOUT on which
+** the file pointer can be set can use the mode. A file that OPENIN has
+** mapped into memory is unmapped first. It returns TRUE if the mode is
+** now on
+*/
+boolean fileio_async(int32 handle, boolean on) {
+#ifdef TARGET_UNIX
+  int32 n;
+
+  if (handle==0) {
+    error(ERR_BADHANDLE);
+    return FALSE;
+  }
+  n = map_handle(handle);
+  if (!on) {
+    if (fileinfo[n].async!=NIL && fileinfo[n].async->codec!=NOCODEC) return TRUE;
+    if (fileinfo[n].async!=NIL) async_off(n);
+    return FALSE;
+  }
+  if (fileinfo[n].async!=NIL) return TRUE;
+  if ((fileinfo[n].filetype!=OPENIN && fileinfo[n].filetype!=OPENOUT)
+   || (fileinfo[n].mapbase==NIL && ftell(fileinfo[n].stream)==-1)) return FALSE;
+  if (fileinfo[n].mapbase!=NIL) {
+    fseek(fileinfo[n].stream, fileinfo[n].mappos, SEEK_SET);
+    munmap(fileinfo[n].mapbase, fileinfo[n].mapsize);
+    fileinfo[n].mapbase = NIL;
+  }
+  return async_create(n, NOCODEC);
+#else
+  return FALSE;
+#endif
+}
+
+/*
+** 'fileio_openin' opens a file for input
+*/
+int32 fileio_openin(char *name, int32 namelen) {
+  FILE *thefile;
+  int32 n;
+#ifdef TARGET_UNIX
+  int32 codec;
+#endif
+  char filename [FNAMESIZE];
+
+  if ((namelen < 0) || (namelen > (FNAMESIZE - 1))) {
+    error(ERR_INVALIDFNAME);
+    return 0;
+  }
+  n = find_entry();     /* Find an unused handle */
+  if (n<0) {
+    error(ERR_MAXHANDLE);
+    return 0;
+  }
+  memmove(filename, name, namelen);
+  filename[namelen] = asc_NUL;
+  thefile = open_file(filename, INMODE);
+  if (thefile==NIL) {
+    char filenameb[FNAMESIZE];
+    STRLCPY(filenameb, filename, FNAMESIZE);
+    /* Append a .bbc suffix and try again */
+    STRLCAT(filenameb, ".bbc", FNAMESIZE);
+    thefile = open_file(filenameb, INMODE);
+    if (thefile==NIL) {
+      if (matrixflags.translatefname == 0) {
+        return 0;
+      } else {
+        char *tfilename = translatefname(filename);
+        thefile = open_file(tfilename, INMODE);
+        if (thefile==NIL) {
+          return 0; /* Could not open file - Return null handle */
+        } else {
+          /* We had to translate so set flags to always translate on save */
+          matrixflags.translatefname = 1;
+        }
+      }
+    }
+  }
+  fileinfo[n].stream = thefile;
+  fileinfo[n].filetype = OPENIN;
+  fileinfo[n].eofstatus = OKAY;
+  fileinfo[n].lastwaswrite = FALSE;
+#ifdef TARGET_UNIX
+  if (matrixflags.compressedfiles && (codec = find_codec(n))!=NOCODEC)
+    open_compressed(n, codec);
+  else {
+    map_infile(n);
+  }
+#endif
+  claim_entry(n);
+  return make_handle(n);
+}
+
+/*
+** 'fileio_openout' opens file 'name' for output, creating the
+** file (or recreating it if it already exists).
+** Note that the file is opened with mode "w+" so that it can be
+** both written to and read from. RISC OS allows files opened for
+** output to be read from as well
+*/
+int32 fileio_openout(char *name, int32 namelen) {
+  FILE *thefile;
+  int32 n;
+#ifdef TARGET_UNIX
+  int32 codec;
+#endif
+  char filename [FNAMESIZE];
+
+  if ((namelen < 0) || (namelen > (FNAMESIZE - 1))) {
+    error(ERR_INVALIDFNAME);
+    return 0;
+  }
+  n = find_entry();     /* Find an unused handle */
+  if (n<0) {
+    error(ERR_MAXHANDLE);
+    return 0;
+  }
+  memmove(filename, name, namelen);
+  filename[namelen] = asc_NUL;
+  if(matrixflags.translatefname == 1) {
+    char *tfilename = translatefname(filename);
+    thefile = open_file(tfilename, OUTMODE);
+  } else {
+    thefile = open_file(filename, OUTMODE);
+  }
+  if (thefile==NIL) {
+    error(ERR_OPENWRITE, filename);
+    return 0;
+  }
+  fileinfo[n].stream = thefile;
+  fileinfo[n].filetype = OPENOUT;
+  fileinfo[n].eofstatus = OKAY;
+  fileinfo[n].lastwaswrite = FALSE;
+#ifdef TARGET_UNIX
+  if (matrixflags.compressedfiles && (codec = name_codec(filename))!=NOCODEC) open_compressed(n, codec);
+#endif
+  claim_entry(n);
+  return make_handle(n);
+}
+
+/*
+** 'fileio_openup' opens a file for update. The file must exist
+** already. The file can both be read from and written to
+*/
+int32 fileio_openup(char *name, int32 namelen) {
+  FILE *thefile;
+  int32 n;
+  char filename [FNAMESIZE];
+  char filenameb[FNAMESIZE];
+  char *tfilename;
+
+  if ((namelen < 0) || (namelen > (FNAMESIZE - 1))) {
+    error(ERR_INVALIDFNAME);
+    return 0;
+  }
+  n = find_entry();     /* Find an unused handle */
+  if (n<0) {
+    error(ERR_MAXHANDLE);
+    return 0;
+  }
+  memmove(filename, name, namelen);
+  filename[namelen] = asc_NUL;
+#ifndef NONET
+  /* Check, does it start "ip4:" if so use network handler to open it. */
+  if (!strncmp(filename, "ip0:", 4) || !strncmp(filename, "ip4:", 4) || !strncmp(filename, "ip6:", 4)) {
+    int handle;
+    handle=brandynet_connect(filename+4, filename[2], 1);
+    if (handle == -1) return 0;
+    fileinfo[n].stream = (void *)42; /* Not used, but != NIL */
+    fileinfo[n].filetype = NETWORK;
+    fileinfo[n].eofstatus = OKAY;
+    fileinfo[n].lastwaswrite = FALSE;
+    fileinfo[n].nethandle = handle;
+    claim_entry(n);
+    return make_handle(n);
+  } else {
+#endif
+    thefile = open_file(filename, UPMODE);
+    if (thefile==NIL) {
+      STRLCPY(filenameb, filename, FNAMESIZE);
+      STRLCAT(filenameb, ".bbc", FNAMESIZE); /* Append a .bbc suffix and try again */
+      thefile = open_file(filenameb, UPMODE);
+      if (thefile==NIL) {
+        if (matrixflags.translatefname == 0) {
+          return 0;
+        } else {
+          tfilename=translatefname(filename);
+          thefile = open_file(tfilename, UPMODE);
+          if (thefile==NIL) {
+            return 0; /* Could not open file - Return null handle */
+          } else {
+            /* We had to translate so set flags to always translate on save */
+            matrixflags.translatefname = 1;
+          }
+        }
+      }
+    }
+    fileinfo[n].stream = thefile;
+    fileinfo[n].filetype = OPENUP;
+    fileinfo[n].eofstatus = OKAY;
+    fileinfo[n].lastwaswrite = FALSE;
+    claim_entry(n);
+    return make_handle(n);
+#ifndef NONET
+  }
+#endif
+}
+
+/*
+** 'close_file' is a function used locally to close a file or network
+** channel. Its entry in 'fileinfo' goes back in the free heap
+*/
+static void close_file(int32 handle) {
+  boolean written = TRUE;
+#ifndef NONET
+  if (fileinfo[handle].filetype == NETWORK) {
+    brandynet_close(fileinfo[handle].nethandle);
+    fileinfo[handle].stream = NIL;
+    fileinfo[handle].filetype = CLOSED;
+    fileinfo[handle].lastwaswrite = FALSE;
+    fileinfo[handle].nethandle = -1;
+  } else {
+#endif
+#ifdef TARGET_UNIX
+    if (fileinfo[handle].async!=NIL) written = async_release(handle);
+    if (fileinfo[handle].mapbase!=NIL) munmap(fileinfo[handle].mapbase, fileinfo[handle].mapsize);
+#endif
+    fileinfo[handle].mapbase = NIL;
+    fclose(fileinfo[handle].stream);
+    fileinfo[handle].stream = NIL;
+    fileinfo[handle].filetype = CLOSED;
+    fileinfo[handle].lastwaswrite = FALSE;
+#ifndef NONET
+  }
+#endif
+  release_entry(handle);
+  if (!written) error(ERR_CANTWRITE);
+}
+
+/*
+** 'fileio_close' closes the file given by 'handle' or all open files
+** if 'handle' is zero
+*/
+void fileio_close(int32 handle) {
+  int32 n;
+  if (handle==0) {      /* Close all open files */
+    for (n=0; n<maxfiles; n++) {
+      if (fileinfo[n].filetype!=CLOSED) close_file(n);
+    }
+  }
+  else {        /* close one file */
+    n = map_handle(handle);
+    if (fileinfo[n].filetype!=CLOSED) close_file(n);
+  }
+}
+
+/*
+** 'fileio_bget' returns the next character from file 'handle'.
+** Note that RISC OS allows you to read from a file that has been opened for
+** writing. One byte can be read. The next attempt to read anything will
+** result in an end-of-file error.
+*/
+int32 fileio_bget(int32 handle) {
+  int32 ch;
+
+  if (handle==0) {
+    error(ERR_BADHANDLE);
+    return 0;
+  }
+  handle = map_handle(handle);
+#ifndef NONET
+  if (fileinfo[handle].filetype == NETWORK) {
+    ch=net_bget(fileinfo[handle].nethandle);
+    if (ch == -2) {
+      if (fileinfo[handle].eofstatus == PENDING) {
+        fileinfo[handle].eofstatus = ATEOF;
+        error(ERR_HITEOF);
+        return 0;
+      } else {
+        fileinfo[handle].eofstatus = PENDING;
+      }
+    }
+  } else {
+#endif
+    if (fileinfo[handle].eofstatus!=OKAY) {     /* If EOF is pending, flag an error */
+      fileinfo[handle].eofstatus = ATEOF;
+      error(ERR_HITEOF);
+      return 0;
+    }
+    else if (fileinfo[handle].filetype==OPENOUT) {      /* If file is open for output, read one char */
+      fileinfo[handle].eofstatus = PENDING;
+    }
+    if (fileinfo[handle].mapbase!=NIL && fileinfo[handle].mappos>=fileinfo[handle].mapsize) refresh_map(handle);
+    if (fileinfo[handle].mapbase!=NIL) {        /* File is mapped - Take character from memory */
+      if (fileinfo[handle].mappos<fileinfo[handle].mapsize) return fileinfo[handle].mapbase[fileinfo[handle].mappos++];
+      fileinfo[handle].eofstatus = PENDING;
+      return 0;
+    }
+#ifdef TARGET_UNIX
+    if (fileinfo[handle].async!=NIL && fileinfo[handle].async->writing) async_off(handle);
+    if (fileinfo[handle].async!=NIL) {          /* File is being read ahead */
+      ch = async_getc(fileinfo[handle].async);
+      if (ch==EOF) {
+        fileinfo[handle].eofstatus = PENDING;
+        ch = 0;
+      }
+      return ch;
+    }
+#endif
+    if (fileinfo[handle].lastwaswrite) {                /* Ensure everything has been written to disk first */
+      fflush(fileinfo[handle].stream);
+      fileinfo[handle].lastwaswrite = FALSE;
     }
     ch = fgetc(fileinfo[handle].stream);        /* Read a character */
     if (ch==EOF) {
@@ -898,8 +1806,11 @@ int32 fileio_bget(int32 handle) {
 ** characters). Note that there is no check on the size of the buffer
 ** so it is up to the functions that call this one to ensure that the
 ** buffer is large enough to hold MAXSTRING (65536) characters.
+** '*text' is set to point at the text read. This is 'buffer' unless the
+** file is mapped into memory, in which case it is the line in the file
+** itself and nothing is copied.
 */
-int32 fileio_getdol(int32 handle, char *buffer) {
+int32 fileio_getdol(int32 handle, char *buffer, char **text) {
   char *p;
   int32 length;
 
@@ -913,15 +1824,68 @@ int32 fileio_getdol(int32 handle, char *buffer) {
     error(ERR_HITEOF);
     return 0;
   }
-  if (fileinfo[handle].lastwaswrite) {          /* Ensure everything has been written to disk first */
-    fflush(fileinfo[handle].stream);
-    fileinfo[handle].lastwaswrite = FALSE;
+  if (fileinfo[handle].mapbase!=NIL && fileinfo[handle].mappos>=fileinfo[handle].mapsize) refresh_map(handle);
+  if (fileinfo[handle].mapbase!=NIL) {          /* File is mapped - Find the line in memory */
+    size_t avail = fileinfo[handle].mapsize-fileinfo[handle].mappos;
+    if (fileinfo[handle].mappos>=fileinfo[handle].mapsize) {
+      error(ERR_CANTREAD);
+      return 0;
+    }
+    if (avail>MAXSTRING-1) avail = MAXSTRING-1; /* Same limit as 'fgets' below */
+    *text = CAST(fileinfo[handle].mapbase+fileinfo[handle].mappos, char *);
+    p = memchr(*text, asc_LF, avail);
+    if (p==NIL && avail<MAXSTRING-1 && refresh_map(handle)) return fileio_getdol(handle, buffer, text); /* Rest of line might have been added */
+    if (p==NIL) {
+      length = avail;
+      fileinfo[handle].mappos+=length;
+    }
+    else {
+      length = p-*text;
+      fileinfo[handle].mappos+=length+1;
+      if (length>0 && *(p-1)==asc_CR) length--; /* Got a 'carriage return-linefeed' pair */
+    }
+    p = memchr(*text, asc_NUL, length);
+    if (p!=NIL) length = p-*text;       /* Text stops at a NUL as it does when read with 'fgets' */
+    return length;
+  }
+  *text = buffer;
+#ifdef TARGET_UNIX
+  if (fileinfo[handle].async!=NIL && fileinfo[handle].async->writing) async_off(handle);
+  if (fileinfo[handle].async!=NIL) {            /* File is being read ahead - Do what 'fgets' does */
+    asyncblock *ap = fileinfo[handle].async;
+    size_t chunk;
+    p = NIL;
+    length = 0;
+    while (p==NIL && length<MAXSTRING-1 && (ap->curpos<ap->curlen || async_nextblock(ap))) {
+      chunk = ap->curlen-ap->curpos;
+      if (chunk>MAXSTRING-1-length) chunk = MAXSTRING-1-length;
+      p = memchr(ap->block[ap->current]+ap->curpos, asc_LF, chunk);
+      if (p!=NIL) chunk = CAST(p, byte *)-(ap->block[ap->current]+ap->curpos)+1;
+      memcpy(buffer+length, ap->block[ap->current]+ap->curpos, chunk);
+      ap->curpos+=chunk;
+      ap->position+=chunk;
+      length+=chunk;
+    }
+    if (length==0) {
+      error(ERR_CANTREAD);
+      return 0;
+    }
+    buffer[length] = asc_NUL;
   }
-  p = fgets(buffer, MAXSTRING, fileinfo[handle].stream);
-  if (p==NIL) {
-    error(ERR_CANTREAD);      /* Read failed utterly */
-    return 0;
+  else {
+#endif
+    if (fileinfo[handle].lastwaswrite) {        /* Ensure everything has been written to disk first */
+      fflush(fileinfo[handle].stream);
+      fileinfo[handle].lastwaswrite = FALSE;
+    }
+    p = fgets(buffer, MAXSTRING, fileinfo[handle].stream);
+    if (p==NIL) {
+      error(ERR_CANTREAD);      /* Read failed utterly */
+      return 0;
+    }
+#ifdef TARGET_UNIX
   }
+#endif
   length = strlen(buffer);
   p = buffer+length-1;  /* Point at line end character */
   if (*p==asc_LF) {     /* Got a 'linefeed' at the end of the line */
@@ -931,9 +1895,22 @@ int32 fileio_getdol(int32 handle, char *buffer) {
   return length;
 }
 
-static int32 fileio_read(FILE *handle) {
+/*
+** 'fileio_read' reads the next byte for INPUT# from file 'n', which
+** can be mapped into memory or being read ahead
+*/
+static int32 fileio_read(int32 n) {
   int32 ch;
-  ch = fgetc(handle);
+  if (fileinfo[n].mapbase!=NIL && fileinfo[n].mappos>=fileinfo[n].mapsize) refresh_map(n);
+  if (fileinfo[n].mapbase!=NIL)
+    ch = fileinfo[n].mappos<fileinfo[n].mapsize ? fileinfo[n].mapbase[fileinfo[n].mappos++] : EOF;
+#ifdef TARGET_UNIX
+  else if (fileinfo[n].async!=NIL)
+    ch = async_getc(fileinfo[n].async);
+#endif
+  else {
+    ch = fgetc(fileinfo[n].stream);
+  }
   if (ch==EOF) error(ERR_CANTREAD);
   return ch;
 }
@@ -954,7 +1931,6 @@ static int32 fileio_read(FILE *handle) {
 ** byte floating point format
 */
 void fileio_getnumber(int32 handle, boolean *isint, int64 *ip, float64 *fp) {
-  FILE *stream;
   int32 n, marker;
   char temp[sizeof(float64)];
 
@@ -969,51 +1945,53 @@ void fileio_getnumber(int32 handle, boolean *isint, int64 *ip, float64 *fp) {
     error(ERR_HITEOF);
     return;
   }
+#ifdef TARGET_UNIX
+  if (fileinfo[handle].async!=NIL && fileinfo[handle].async->writing) async_off(handle);
+#endif
   if (fileinfo[handle].lastwaswrite) {  /* Ensure everything has been written to disk first */
     fflush(fileinfo[handle].stream);
     fileinfo[handle].lastwaswrite = FALSE;
   }
-  stream = fileinfo[handle].stream;
-  marker = fileio_read(stream);
+  marker = fileio_read(handle);
   switch (marker) {
   case PRINT_INT:
     *ip = 0;
-    for (n=24; n>=0; n-=8) *ip |= fileio_read(stream) << n;
+    for (n=24; n>=0; n-=8) *ip |= fileio_read(handle) << n;
     *isint = TRUE;
     break;
   case PRINT_UINT8:
-    *ip = fileio_read(stream);
+    *ip = fileio_read(handle);
     *isint = TRUE;
     break;
   case PRINT_INT64:
     *ip = 0;
-    for (n=56; n>=0; n-=8) *ip |= (int64)fileio_read(stream) << n;
+    for (n=56; n>=0; n-=8) *ip |= (int64)fileio_read(handle) << n;
     *isint = TRUE;
     break;
   case PRINT_FLOAT:
     switch (double_type) {
     case XMIXED_ENDIAN:
-      for (n=0; n<sizeof(float64); n++) temp[n] = fileio_read(stream);
+      for (n=0; n<sizeof(float64); n++) temp[n] = fileio_read(handle);
       break;
     case XLITTLE_ENDIAN:
-      for (n=0; n<sizeof(float64); n++) temp[n^4] = fileio_read(stream);
+      for (n=0; n<sizeof(float64); n++) temp[n^4] = fileio_read(handle);
       break;
     case XBIG_ENDIAN:
-      for (n=0; n<sizeof(float64); n++) temp[n^3] = fileio_read(stream);
+      for (n=0; n<sizeof(float64); n++) temp[n^3] = fileio_read(handle);
       break;
     case XBIG_MIXED_ENDIAN:
-      for (n=0; n<sizeof(float64); n++) temp[n^7] = fileio_read(stream);
+      for (n=0; n<sizeof(float64); n++) temp[n^7] = fileio_read(handle);
     }
     memmove(fp, temp, sizeof(float64));
     *isint = FALSE;
     break;
   case PRINT_FLOAT5: { /* Acorn's five byte format */
     int32 exponent;
-    int32 mantissa = fileio_read(stream);
-    mantissa |= fileio_read(stream) << 8;
-    mantissa |= fileio_read(stream) << 16;
-    mantissa |= fileio_read(stream) << 24;
-    exponent = fileio_read(stream);
+    int32 mantissa = fileio_read(handle);
+    mantissa |= fileio_read(handle) << 8;
+    mantissa |= fileio_read(handle) << 16;
+    mantissa |= fileio_read(handle) << 24;
+    exponent = fileio_read(handle);
     if (exponent || mantissa) {
       *fp = ((mantissa & 0x7FFFFFFF) / 4294967296.0 + 0.5)
             * pow (2, exponent - 0x80)
@@ -1039,7 +2017,6 @@ void fileio_getnumber(int32 handle, boolean *isint, int64 *ip, float64 *fp) {
 ** that is, the last character of the string is first.
 */
 int32 fileio_getstring(int32 handle, char *p) {
-  FILE *stream;
   int32 marker, length = 0, n;
 
   if (handle==0) {
@@ -1052,21 +2029,23 @@ int32 fileio_getstring(int32 handle, char *p) {
     error(ERR_HITEOF);
     return 0;
   }
+#ifdef TARGET_UNIX
+  if (fileinfo[handle].async!=NIL && fileinfo[handle].async->writing) async_off(handle);
+#endif
   if (fileinfo[handle].lastwaswrite) {          /* Ensure everything has been written to disk first */
     fflush(fileinfo[handle].stream);
     fileinfo[handle].lastwaswrite = FALSE;
   }
-  stream = fileinfo[handle].stream;
-  marker = fileio_read(stream);
+  marker = fileio_read(handle);
   switch (marker) {
   case PRINT_SHORTSTR:  /* Reading short string in 'Acorn' format */
-    length = fileio_read(stream);
-    for (n=1; n<=length; n++) p[length-n] = fileio_read(stream);
+    length = fileio_read(handle);
+    for (n=1; n<=length; n++) p[length-n] = fileio_read(handle);
     break;
   case PRINT_LONGSTR:   /* Reading long string */
     length = 0;         /* Start by reading the string length (four bytes, little endian) */
-    for (n=0; n<sizeof(int32); n++) length+=fileio_read(stream)<<(n*BYTESHIFT);
-    for (n=0; n<length; n++) p[n] = fileio_read(stream);
+    for (n=0; n<sizeof(int32); n++) length+=fileio_read(handle)<<(n*BYTESHIFT);
+    for (n=0; n<length; n++) p[n] = fileio_read(handle);
     break;
   default:
     error(ERR_TYPESTR);
@@ -1074,18 +2053,50 @@ int32 fileio_getstring(int32 handle, char *p) {
   return length;
 }
 
-static void fileio_write(FILE *stream, int32 value) {
+/*
+** 'fileio_write' writes a byte to file 'n', which can be being
+** written behind
+*/
+static void fileio_write(int32 n, int32 value) {
   int32 result;
-  result = fputc(value, stream);
+#ifdef TARGET_UNIX
+  if (fileinfo[n].async!=NIL) {
+    async_putc(fileinfo[n].async, value);
+    return;
+  }
+#endif
+  result = fputc(value, fileinfo[n].stream);
   if (result==EOF) error(ERR_CANTWRITE);
 }
 
+/*
+** 'write_block' writes 'count' bytes at 'buffer' to file 'n'
+*/
+static void write_block(int32 n, void *buffer, size_t count) {
+#ifdef TARGET_UNIX
+  asyncblock *ap = fileinfo[n].async;
+  if (ap!=NIL) {        /* Copy the data into the blocks being written behind */
+    size_t chunk;
+    while (count>0) {
+      if (ap->curpos==ASYNCBLOCKSIZE) async_handover(ap, FALSE);
+      chunk = ASYNCBLOCKSIZE-ap->curpos;
+      if (chunk>count) chunk = count;
+      memcpy(ap->block[ap->current]+ap->curpos, buffer, chunk);
+      ap->curpos+=chunk;
+      ap->position+=chunk;
+      buffer = CAST(buffer, byte *)+chunk;
+      count-=chunk;
+    }
+    return;
+  }
+#endif
+  if (fwrite(buffer, 1, count, fileinfo[n].stream)!=count) error(ERR_CANTWRITE);
+}
+
 /*
 ** 'fileio_bput' writes a character to a file
 */
 void fileio_bput(int32 handle, int32 value) {
-  int32 result;
-
   if (handle==0) {
     error(ERR_BADHANDLE);
     return;
@@ -1101,11 +2112,7 @@ void fileio_bput(int32 handle, int32 value) {
       return;
     }
     fileinfo[handle].eofstatus = OKAY;
-    result = fputc(value, fileinfo[handle].stream);
-    if (result==EOF) {
-      error(ERR_CANTWRITE);
-      return;
-    }
+    fileio_write(handle, value);
     fileinfo[handle].lastwaswrite = TRUE;
 #ifndef NONET
   }
@@ -1113,11 +2120,10 @@ void fileio_bput(int32 handle, int32 value) {
 }
 
 /*
-** 'fileio_bputstr' writes a string to a file
+** 'fileio_putblock' writes 'count' bytes at 'buffer' to a file with
+** a single call rather than a byte at a time
 */
-void fileio_bputstr(int32 handle, char *string, int32 length) {
-  int32 result;
-
+void fileio_putblock(int32 handle, void *buffer, size_t count) {
   if (handle==0) {
     error(ERR_BADHANDLE);
     return;
@@ -1125,7 +2131,7 @@ void fileio_bputstr(int32 handle, char *string, int32 length) {
   handle = map_handle(handle);
 #ifndef NONET
   if (fileinfo[handle].filetype==NETWORK) {
-    if(net_bputstr(fileinfo[handle].nethandle, string, length)) error(ERR_CANTWRITE);
+    if(net_bputstr(fileinfo[handle].nethandle, buffer, count)) error(ERR_CANTWRITE);
   } else {
 #endif
     if (fileinfo[handle].filetype==OPENIN) {
@@ -1133,17 +2139,94 @@ void fileio_bputstr(int32 handle, char *string, int32 length) {
       return;
     }
     fileinfo[handle].eofstatus = OKAY;
-    result = fwrite(string, sizeof(char), length, fileinfo[handle].stream);
-    if (result!=length) {
-      error(ERR_CANTWRITE);
-      return;
-    }
+    write_block(handle, buffer, count);
     fileinfo[handle].lastwaswrite = TRUE;
 #ifndef NONET
   }
 #endif
 }
 
+/*
+** 'fileio_bputstr' writes a string to a file
+*/
+void fileio_bputstr(int32 handle, char *string, int32 length) {
+  fileio_putblock(handle, string, length);
+}
+
+/*
+** 'fileio_getblock' reads up to 'count' bytes from file 'handle' into
+** 'buffer' with a single call rather than a byte at a time. It returns
+** the number of bytes read, which is less than 'count' if the end of
+** the file was reached, in which case 'pending end of file' is set as
+** it is for BGET. Unlike BGET, reading at the end of the file is not
+** an error
+*/
+size_t fileio_getblock(int32 handle, void *buffer, size_t count) {
+  size_t result;
+  int32 ch;
+
+  if (handle==0) {
+    error(ERR_BADHANDLE);
+    return 0;
+  }
+  handle = map_handle(handle);
+#ifndef NONET
+  if (fileinfo[handle].filetype==NETWORK) {
+    for (result=0; result<count; result++) {    /* Take whatever has been received */
+      ch = net_bget(fileinfo[handle].nethandle);
+      if (ch<0) break;
+      CAST(buffer, byte *)[result] = ch;
+    }
+    return result;
+  }
+#endif
+  if (fileinfo[handle].mapbase!=NIL && fileinfo[handle].mappos+count>fileinfo[handle].mapsize) refresh_map(handle);
+  if (fileinfo[handle].mapbase!=NIL) {          /* File is mapped - Copy straight from memory */
+    result = 0;
+    if (fileinfo[handle].mappos<fileinfo[handle].mapsize) result = fileinfo[handle].mapsize-fileinfo[handle].mappos;
+    if (result>count) result = count;
+    memcpy(buffer, fileinfo[handle].mapbase+fileinfo[handle].mappos, result);
+    fileinfo[handle].mappos+=result;
+    fileinfo[handle].eofstatus = result<count ? PENDING : OKAY;
+    return result;
+  }
+#ifdef TARGET_UNIX
+  if (fileinfo[handle].async!=NIL && fileinfo[handle].async->writing) async_off(handle);
+  if (fileinfo[handle].async!=NIL) {            /* File is being read ahead - Copy from its blocks */
+    asyncblock *ap = fileinfo[handle].async;
+    size_t chunk;
+    result = 0;
+    while (result<count && (ap->curpos<ap->curlen || async_nextblock(ap))) {
+      chunk = ap->curlen-ap->curpos;
+      if (chunk>count-result) chunk = count-result;
+      memcpy(CAST(buffer, byte *)+result, ap->block[ap->current]+ap->curpos, chunk);
+      ap->curpos+=chunk;
+      ap->position+=chunk;
+      result+=chunk;
+    }
+    fileinfo[handle].eofstatus = result<count ? PENDING : OKAY;
+    return result;
+  }
+#endif
+  if (fileinfo[handle].lastwaswrite) {          /* Ensure everything has been written to disk first */
+    fflush(fileinfo[handle].stream);
+    fileinfo[handle].lastwaswrite = FALSE;
+  }
+  result = fread(buffer, 1, count, fileinfo[handle].stream);
+  if (result<count) {
+    if (ferror(fileinfo[handle].stream)) {
+      clearerr(fileinfo[handle].stream);
+      error(ERR_CANTREAD);
+      return 0;
+    }
+    fileinfo[handle].eofstatus = PENDING;
+  }
+  else {
+    fileinfo[handle].eofstatus = OKAY;
+  }
+  return result;
+}
+
 /*
 ** 'fileio_printint' writes a four byte integer to a file in binary
 ** preceded with 0x40 to mark it as an integer.
@@ -1151,7 +2234,6 @@ void fileio_bputstr(int32 handle, char *string, int32 length) {
 ** with the Acorn interpreter
 */
 void fileio_printint(int32 handle, int32 value) {
-  FILE *stream;
   int32 n;
 
   if (handle==0) {
@@ -1164,14 +2246,12 @@ void fileio_printint(int32 handle, int32 value) {
     return;
   }
   fileinfo[handle].eofstatus = OKAY;
-  stream = fileinfo[handle].stream;
-  fileio_write(stream, PRINT_INT);
-  for (n=24; n>=0; n-=8) fileio_write(stream, value >> n);
+  fileio_write(handle, PRINT_INT);
+  for (n=24; n>=0; n-=8) fileio_write(handle, value >> n);
   fileinfo[handle].lastwaswrite = TRUE;
 }
 
 void fileio_printuint8(int32 handle, uint8 value) {
-  FILE *stream;
 
   if (handle==0) {
     error(ERR_BADHANDLE);
@@ -1183,14 +2263,12 @@ void fileio_printuint8(int32 handle, uint8 value) {
     return;
   }
   fileinfo[handle].eofstatus = OKAY;
-  stream = fileinfo[handle].stream;
-  fileio_write(stream, PRINT_UINT8);
-  fileio_write(stream, value);
+  fileio_write(handle, PRINT_UINT8);
+  fileio_write(handle, value);
   fileinfo[handle].lastwaswrite = TRUE;
 }
 
 void fileio_printint64(int32 handle, int64 value) {
-  FILE *stream;
   int32 n;
 
   if (handle==0) {
@@ -1203,9 +2281,8 @@ void fileio_printint64(int32 handle, int64 value) {
     return;
   }
   fileinfo[handle].eofstatus = OKAY;
-  stream = fileinfo[handle].stream;
-  fileio_write(stream, PRINT_INT64);
-  for (n=56; n>=0; n-=8) fileio_write(stream, value >> n);
+  fileio_write(handle, PRINT_INT64);
+  for (n=56; n>=0; n-=8) fileio_write(handle, value >> n);
   fileinfo[handle].lastwaswrite = TRUE;
 }
 
@@ -1218,7 +2295,6 @@ void fileio_printint64(int32 handle, int64 value) {
 ** code was written by Darren Salt
 */
 void fileio_printfloat(int32 handle, float64 value) {
-  FILE *stream;
   int32 n;
   char temp[sizeof(float64)];
 
@@ -1232,21 +2308,20 @@ void fileio_printfloat(int32 handle, float64 value) {
     return;
   }
   fileinfo[handle].eofstatus = OKAY;
-  stream = fileinfo[handle].stream;
-  fileio_write(stream, PRINT_FLOAT);
+  fileio_write(handle, PRINT_FLOAT);
   memmove(temp, &value, sizeof(float64));
   switch (double_type) {
   case XMIXED_ENDIAN:
-    for (n=0; n<sizeof(float64); n++) fileio_write(stream, temp[n]);
+    for (n=0; n<sizeof(float64); n++) fileio_write(handle, temp[n]);
     break;
   case XLITTLE_ENDIAN:
-    for (n=0; n<sizeof(float64); n++) fileio_write(stream, temp[n^4]);
+    for (n=0; n<sizeof(float64); n++) fileio_write(handle, temp[n^4]);
     break;
   case XBIG_ENDIAN:
-    for (n=0; n<sizeof(float64); n++) fileio_write(stream, temp[n^3]);
+    for (n=0; n<sizeof(float64); n++) fileio_write(handle, temp[n^3]);
     break;
   case XBIG_MIXED_ENDIAN:
-    for (n=0; n<sizeof(float64); n++) fileio_write(stream, temp[n^7]);
+    for (n=0; n<sizeof(float64); n++) fileio_write(handle, temp[n^7]);
   }
   fileinfo[handle].lastwaswrite = TRUE;
 }
@@ -1261,7 +2336,6 @@ void fileio_printfloat(int32 handle, float64 value) {
 ** character order
 */
 void fileio_printstring(int32 handle, char *string, int32 length) {
-  FILE *stream;
   int32 n;
 
   if (handle==0) {
@@ -1274,25 +2348,19 @@ void fileio_printstring(int32 handle, char *string, int32 length) {
     return;
   }
   fileinfo[handle].eofstatus = OKAY;
-  stream = fileinfo[handle].stream;
   if (length<SHORT_STRING) {    /* Write string in Acorn format */
-    fileio_write(stream, PRINT_SHORTSTR);
-    fileio_write(stream, length);
-    if (length>0) for (n=length-1; n>=0; n--) fileio_write(stream, string[n]);
+    fileio_write(handle, PRINT_SHORTSTR);
+    fileio_write(handle, length);
+    if (length>0) for (n=length-1; n>=0; n--) fileio_write(handle, string[n]);
   }
   else {        /* Long string - Use interpreter's extended format */
-    int32 result;
     int32 temp = length;
-    fileio_write(stream, PRINT_LONGSTR);
+    fileio_write(handle, PRINT_LONGSTR);
     for (n=0; n<sizeof(int32); n++) {   /* Write four byte length to file */
-      fileio_write(stream, temp & BYTEMASK);
+      fileio_write(handle, temp & BYTEMASK);
       temp = temp>>BYTESHIFT;
     }
-    result = fwrite(string, sizeof(char), length, stream);
-    if (result!=length) {
-      error(ERR_CANTWRITE);
-      return;
-    }
+    write_block(handle, string, length);
   }
   fileinfo[handle].lastwaswrite = TRUE;
 }
@@ -1308,6 +2376,55 @@ void fileio_setptr(int32 handle, int64 newoffset) {
     return;
   }
   handle = map_handle(handle);
+  refresh_map(handle);
+  if (fileinfo[handle].mapbase!=NIL) {          /* File is mapped - Just move the pointer */
+    if (newoffset<0) {
+      error(ERR_SETPTRFAIL);
+      return;
+    }
+    fileinfo[handle].mappos = newoffset;
+    fileinfo[handle].eofstatus = OKAY;
+    return;
+  }
+#ifdef TARGET_UNIX
+  if (fileinfo[handle].async!=NIL) {            /* Move where the background thread reads or writes */
+    asyncblock *ap = fileinfo[handle].async;
+    if (newoffset<0) {
+      error(ERR_SETPTRFAIL);
+      return;
+    }
+    fileinfo[handle].eofstatus = OKAY;
+    if (ap->writing) {
+      if (ap->codec!=NOCODEC) {
+        error(ERR_COMPRESSED);
+        return;
+      }
+      async_handover(ap, TRUE);
+      ap->fileoffset = ap->position = newoffset;
+      return;
+    }
+    if (ap->codec!=NOCODEC) {   /* Compressed file - Decompress up to the new position */
+      if (newoffset>=ap->position) {
+        async_skip(ap, newoffset-ap->position);
+        return;
+      }
+      async_stop(ap);
+      if (async_start(ap, 0)) {
+        async_skip(ap, newoffset);
+        return;
+      }
+      async_free(ap);
+      fileinfo[handle].async = NIL;
+      fseek(fileinfo[handle].stream, 0, SEEK_END);      /* Leave nothing to read */
+      error(ERR_SETPTRFAIL);
+      return;
+    }
+    async_stop(ap);
+    if (async_start(ap, newoffset)) return;
+    async_free(ap);                             /* Cannot restart thread - Carry on without it */
+    fileinfo[handle].async = NIL;
+  }
+#endif
   result = fseek(fileinfo[handle].stream, newoffset, SEEK_SET);
   if (result==-1) {                             /* File pointer cannot be set */
     error(ERR_SETPTRFAIL);
@@ -1324,6 +2441,10 @@ int64 fileio_getptr(int32 handle) {
 
   if (handle==0) return 0; /* This is what happens on RISC OS 3.71 */
   handle = map_handle(handle);
+  if (fileinfo[handle].mapbase!=NIL) return fileinfo[handle].mappos;
+#ifdef TARGET_UNIX
+  if (fileinfo[handle].async!=NIL) return fileinfo[handle].async->position;
+#endif
   result = ftell(fileinfo[handle].stream);
   if (result==-1) error(ERR_GETPTRFAIL);        /* File pointer cannot be read */
   return result;
@@ -1341,6 +2462,23 @@ int64 fileio_getext(int32 handle) {
     return 0;
   }
   handle = map_handle(handle);
+  refresh_map(handle);
+  if (fileinfo[handle].mapbase!=NIL) return fileinfo[handle].mapsize;
+#ifdef TARGET_UNIX
+  if (fileinfo[handle].async!=NIL) {            /* Size is that of the file once everything has been written */
+    struct stat filestat;
+    if (fileinfo[handle].async->codec!=NOCODEC) {       /* Uncompressed size is not known */
+      error(ERR_COMPRESSED);
+      return 0;
+    }
+    if (fileinfo[handle].async->writing) async_handover(fileinfo[handle].async, TRUE);
+    if (fstat(fileinfo[handle].async->fd, &filestat)==-1) {
+      error(ERR_GETEXTFAIL);
+      return 0;
+    }
+    return filestat.st_size;
+  }
+#endif
   stream = fileinfo[handle].stream;
   position = ftell(stream);
   if (position==-1) {
@@ -1360,6 +2498,9 @@ void fileio_setext(int32 handle, int64 newsize) {
   int32 type;
   
   handle=map_handle(handle);
+#ifdef TARGET_UNIX
+  if (fileinfo[handle].async!=NIL) async_off(handle);
+#endif
   type=fileinfo[handle].filetype;
   if((type==OPENOUT) || (type==OPENUP)) {
     int32 fh = fileno(fileinfo[handle].stream);
@@ -1392,6 +2533,16 @@ int32 fileio_eof(int32 handle) {
   if (fileinfo[handle].filetype == NETWORK) {
     return net_eof(fileinfo[handle].nethandle);
   } else {
+#endif
+  if (fileinfo[handle].mapbase!=NIL && fileinfo[handle].mappos>=fileinfo[handle].mapsize) refresh_map(handle);
+  if (fileinfo[handle].mapbase!=NIL) return fileinfo[handle].mappos>=fileinfo[handle].mapsize;
+#ifdef TARGET_UNIX
+  if (fileinfo[handle].async!=NIL) {
+    asyncblock *ap = fileinfo[handle].async;
+    if (ap->writing && ap->codec!=NOCODEC) return TRUE;  /* Always writing at the end of a compressed file */
+    if (ap->writing) return ap->position>=fileio_getext(make_handle(handle));
+    return ap->curpos>=ap->curlen && !async_nextblock(ap);
+  }
 #endif
   stream = fileinfo[handle].stream;
   position = ftell(stream);
@@ -1412,7 +2563,7 @@ int32 fileio_eof(int32 handle) {
 void fileio_shutdown(void) {
   int32 n, count;
   count = 0;
-  for (n=0; n<MAXFILES; n++) {
+  for (n=0; n<maxfiles; n++) {
     if (fileinfo[n].filetype!=CLOSED) {
       close_file(n);
       count++;
@@ -1458,13 +2609,389 @@ static void find_floatformat(void) {
 ** 'init_fileio' is called to initialise the file handling
 */
 void init_fileio(void) {
-  int32 n;
-  for (n=0; n<MAXFILES; n++) {
-    fileinfo[n].stream = NIL;
-    fileinfo[n].filetype = CLOSED;
-    fileinfo[n].eofstatus = ATEOF;
-  }
+  fileinfo = initialfiles;
+  freeheap = initialfree;
+  maxfiles = INITFILES;
+  init_entries(0, INITFILES);
   find_floatformat();
 }
 
 #endif
+
+/*
+** The functions below deal with whole arrays in PRINT# and INPUT#. They
+** build or take apart the values in a buffer which is written or read
+** with 'fileio_putblock' and 'fileio_getblock', rather than handling a
+** byte at a time, and so work with all versions of the file functions.
+** The values are in the same format as those written one at a time.
+** Values are read from the file in chunks that are never larger than
+** the smallest amount the rest of the array could occupy, so that
+** nothing after the array is read
+*/
+
+#define ARRAYCHUNK 65536        /* Size of buffer used for arrays */
+#define MINVALUESIZE 2          /* Size of the smallest value in a file, an 8-bit integer or a null string */
+
+typedef struct {
+  int32 handle;                 /* Handle of file */
+  size_t pos, len;              /* Position of next byte in buffer and number of bytes in it */
+  size_t remaining;             /* Values still to be read */
+} arrayreader;
+
+static byte *arraybuffer;       /* Buffer used when writing or reading arrays */
+
+/*
+** 'get_arraybuffer' returns the buffer used for arrays, allocating it
+** the first time it is needed. It is kept so that it is not lost if
+** an error occurs part way through an array
+*/
+static byte *get_arraybuffer(void) {
+  if (arraybuffer==NIL) arraybuffer = malloc(ARRAYCHUNK);
+  if (arraybuffer==NIL) error(ERR_NOROOM);
+  return arraybuffer;
+}
+
+/*
+** 'order_float' converts an eight-byte floating point value between
+** the way it is held in memory and the byte order used in files. The
+** reordering is done with shifts and masks on the whole value rather
+** than byte by byte so that the loops calling it can be vectorised
+*/
+static uint64 order_float(uint64 value) {
+  switch (double_type) {
+  case XLITTLE_ENDIAN:          /* Swap the two halves */
+    return value<<32 | value>>32;
+  case XBIG_ENDIAN:             /* Reverse the bytes in each half */
+    value = (value & 0x00FF00FF00FF00FFull)<<8 | ((value>>8) & 0x00FF00FF00FF00FFull);
+    return (value & 0x0000FFFF0000FFFFull)<<16 | ((value>>16) & 0x0000FFFF0000FFFFull);
+  case XBIG_MIXED_ENDIAN:       /* Reverse all eight bytes */
+    value = (value & 0x00FF00FF00FF00FFull)<<8 | ((value>>8) & 0x00FF00FF00FF00FFull);
+    value = (value & 0x0000FFFF0000FFFFull)<<16 | ((value>>16) & 0x0000FFFF0000FFFFull);
+    return value<<32 | value>>32;
+  default:                      /* Same as memory */
+    return value;
+  }
+}
+
+/*
+** 'put_bigendian' stores the 'size' byte integer 'value' at 'p' in big
+** endian order
+*/
+static void put_bigendian(byte *p, int64 value, int32 size) {
+  int32 n;
+  for (n=size-1; n>=0; n--) {
+    p[n] = value;
+    value = value>>BYTESHIFT;
+  }
+}
+
+static int64 get_bigendian(byte *p, int32 size) {
+  int64 value = 0;
+  int32 n;
+  for (n=0; n<size; n++) value = value<<BYTESHIFT | p[n];
+  return value;
+}
+
+/*
+** 'write_strings' writes the 'count' strings at 'strings' to file 'handle'
+*/
+static void write_strings(int32 handle, basicstring *strings, int32 count) {
+  byte *buffer = get_arraybuffer();
+  size_t used = 0;
+  int32 n, k, length;
+
+  for (n=0; n<count; n++) {
+    length = strings[n].stringlen;
+    if (used+1+sizeof(int32)+length>ARRAYCHUNK) {       /* Not enough room - Write out buffer */
+      fileio_putblock(handle, buffer, used);
+      used = 0;
+    }
+    if (length<SHORT_STRING) {  /* Acorn format, in reverse order */
+      buffer[used++] = PRINT_SHORTSTR;
+      buffer[used++] = length;
+      for (k=length-1; k>=0; k--) buffer[used++] = strings[n].stringaddr[k];
+    }
+    else {      /* Interpreter's format, with a four byte little endian length */
+      buffer[used++] = PRINT_LONGSTR;
+      for (k=0; k<sizeof(int32); k++) buffer[used++] = length>>(k*BYTESHIFT);
+      if (used+length>ARRAYCHUNK) {     /* Too long for buffer - Write it directly */
+        fileio_putblock(handle, buffer, used);
+        fileio_putblock(handle, strings[n].stringaddr, length);
+        used = 0;
+      }
+      else {
+        memcpy(buffer+used, strings[n].stringaddr, length);
+        used+=length;
+      }
+    }
+  }
+  if (used>0) fileio_putblock(handle, buffer, used);
+}
+
+/*
+** 'fileio_printarray' writes the 'count' elements of type 'type' at
+** 'base' to file 'handle' in the format used by PRINT# for single values
+*/
+void fileio_printarray(int32 handle, int32 type, void *base, int32 count) {
+  byte *buffer, *p;
+  int32 n, batch, valuesize;
+  uint64 value;
+
+  if (type==VAR_STRINGDOL) {
+    write_strings(handle, base, count);
+    return;
+  }
+  buffer = get_arraybuffer();
+  switch (type) {
+  case VAR_INTWORD: valuesize = 1+sizeof(int32); break;
+  case VAR_UINT8: valuesize = 1+sizeof(uint8); break;
+  default: valuesize = 1+sizeof(int64);
+  }
+  while (count>0) {
+    batch = ARRAYCHUNK/valuesize;
+    if (batch>count) batch = count;
+    p = buffer;
+    switch (type) {
+    case VAR_INTWORD:
+      for (n=0; n<batch; n++, p+=valuesize) {
+        p[0] = PRINT_INT;
+        put_bigendian(p+1, CAST(base, int32 *)[n], sizeof(int32));
+      }
+      break;
+    case VAR_UINT8:
+      for (n=0; n<batch; n++, p+=valuesize) {
+        p[0] = PRINT_UINT8;
+        p[1] = CAST(base, uint8 *)[n];
+      }
+      break;
+    case VAR_INTLONG:
+      for (n=0; n<batch; n++, p+=valuesize) {
+        p[0] = PRINT_INT64;
+        put_bigendian(p+1, CAST(base, int64 *)[n], sizeof(int64));
+      }
+      break;
+    case VAR_FLOAT:
+      for (n=0; n<batch; n++, p+=valuesize) {
+        p[0] = PRINT_FLOAT;
+        memcpy(&value, CAST(base, float64 *)+n, sizeof(float64));
+        value = order_float(value);
+        memcpy(p+1, &value, sizeof(float64));
+      }
+    }
+    fileio_putblock(handle, buffer, batch*valuesize);
+    base = CAST(base, byte *)+batch*(valuesize-1);
+    count-=batch;
+  }
+}
+
+/*
+** 'reader_fill' refills the buffer used to read an array when it is
+** empty. It reads no more than the smallest amount of data the rest of
+** the array could occupy, allowing for part of the current value having
+** been read already, up to the size of the buffer
+*/
+static void reader_fill(arrayreader *rp) {
+  size_t want = rp->remaining*MINVALUESIZE-1;
+  if (want>ARRAYCHUNK) want = ARRAYCHUNK;
+  rp->len = fileio_getblock(rp->handle, arraybuffer, want);
+  rp->pos = 0;
+  if (rp->len==0) error(ERR_HITEOF);
+}
+
+static int32 reader_byte(arrayreader *rp) {
+  if (rp->pos==rp->len) reader_fill(rp);
+  return arraybuffer[rp->pos++];
+}
+
+/*
+** 'reader_copy' copies the next 'count' bytes from the file to 'p'
+*/
+static void reader_copy(arrayreader *rp, byte *p, size_t count) {
+  size_t chunk;
+  while (count>0) {
+    if (rp->pos==rp->len) reader_fill(rp);
+    chunk = rp->len-rp->pos;
+    if (chunk>count) chunk = count;
+    memcpy(p, arraybuffer+rp->pos, chunk);
+    rp->pos+=chunk;
+    p+=chunk;
+    count-=chunk;
+  }
+}
+
+/*
+** 'reader_number' reads any type of number written by PRINT#, in the
+** same way as 'fileio_getnumber'
+*/
+static void reader_number(arrayreader *rp, boolean *isint, int64 *ip, float64 *fp) {
+  byte temp[sizeof(int64)];
+  uint64 value;
+
+  switch (reader_byte(rp)) {
+  case PRINT_INT:
+    reader_copy(rp, temp, sizeof(int32));
+    *ip = (int32)get_bigendian(temp, sizeof(int32));
+    *isint = TRUE;
+    break;
+  case PRINT_UINT8:
+    *ip = reader_byte(rp);
+    *isint = TRUE;
+    break;
+  case PRINT_INT64:
+    reader_copy(rp, temp, sizeof(int64));
+    *ip = get_bigendian(temp, sizeof(int64));
+    *isint = TRUE;
+    break;
+  case PRINT_FLOAT:
+    reader_copy(rp, temp, sizeof(float64));
+    memcpy(&value, temp, sizeof(float64));
+    value = order_float(value);
+    memcpy(fp, &value, sizeof(float64));
+    *isint = FALSE;
+    break;
+  case PRINT_FLOAT5: {  /* Acorn's five byte format */
+    int32 exponent, mantissa;
+    reader_copy(rp, temp, 4);
+    mantissa = temp[0] | temp[1]<<8 | temp[2]<<16 | temp[3]<<24;
+    exponent = reader_byte(rp);
+    if (exponent || mantissa) {
+      *fp = ((mantissa & 0x7FFFFFFF) / 4294967296.0 + 0.5)
+            * pow (2, exponent - 0x80)
+            * (mantissa < 0 ? -1 : 1);
+    } else {
+      *fp = 0;
+    }
+    *isint = FALSE;
+    break;
+  }
+  default:
+    error(ERR_TYPENUM);
+  }
+}
+
+/*
+** 'reader_string' reads a string written by PRINT# into 'sp', in the
+** same way as 'fileio_getstring'
+*/
+static void reader_string(arrayreader *rp, basicstring *sp) {
+  byte temp[sizeof(int32)];
+  int32 length, n;
+  char *cp, ch;
+
+  switch (reader_byte(rp)) {
+  case PRINT_SHORTSTR:  /* Acorn format, in reverse order */
+    length = reader_byte(rp);
+    break;
+  case PRINT_LONGSTR:   /* Interpreter's format, four byte little endian length first */
+    reader_copy(rp, temp, sizeof(int32));
+    length = temp[0] | temp[1]<<8 | temp[2]<<16 | temp[3]<<24;
+    if (length<0 || length>MAXSTRING) error(ERR_STRINGLEN);
+    break;
+  default:
+    error(ERR_TYPESTR);
+    return;
+  }
+  cp = alloc_string(length);
+  reader_copy(rp, CAST(cp, byte *), length);
+  if (length<SHORT_STRING) {
+    for (n=0; n<length/2; n++) {
+      ch = cp[n];
+      cp[n] = cp[length-1-n];
+      cp[length-1-n] = ch;
+    }
+  }
+  free_string(*sp);
+  sp->stringlen = length;
+  sp->stringaddr = cp;
+}
+
+/*
+** 'fileio_getarray' reads 'count' values written by PRINT# from file
+** 'handle' into the array of type 'type' at 'base'. Values of a different
+** numeric type to the array are converted. The values are expected to be
+** of the array's type and are taken straight from the buffer when they
+** are, falling back to reading them one at a time when not
+*/
+void fileio_getarray(int32 handle, int32 type, void *base, int32 count) {
+  arrayreader reader;
+  boolean isint;
+  int64 intvalue;
+  float64 floatvalue;
+  uint64 value;
+  byte *p;
+  int32 n;
+
+  get_arraybuffer();
+  reader.handle = handle;
+  reader.pos = reader.len = 0;
+  reader.remaining = count;
+  for (n=0; n<count; n++, reader.remaining--) {
+    p = arraybuffer+reader.pos;
+    switch (type) {
+    case VAR_INTWORD:
+      if (reader.len-reader.pos>sizeof(int32) && *p==PRINT_INT) {
+        CAST(base, int32 *)[n] = get_bigendian(p+1, sizeof(int32));
+        reader.pos+=1+sizeof(int32);
+        continue;
+      }
+      reader_number(&reader, &isint, &intvalue, &floatvalue);
+      CAST(base, int32 *)[n] = isint ? intvalue : TOINT(floatvalue);
+      break;
+    case VAR_UINT8:
+      if (reader.len-reader.pos>sizeof(uint8) && *p==PRINT_UINT8) {
+        CAST(base, uint8 *)[n] = p[1];
+        reader.pos+=1+sizeof(uint8);
+        continue;
+      }
+      reader_number(&reader, &isint, &intvalue, &floatvalue);
+      CAST(base, uint8 *)[n] = isint ? intvalue : TOINT(floatvalue);
+      break;
+    case VAR_INTLONG:
+      if (reader.len-reader.pos>sizeof(int64) && *p==PRINT_INT64) {
+        CAST(base, int64 *)[n] = get_bigendian(p+1, sizeof(int64));
+        reader.pos+=1+sizeof(int64);
+        continue;
+      }
+      reader_number(&reader, &isint, &intvalue, &floatvalue);
+      CAST(base, int64 *)[n] = isint ? intvalue : TOINT64(floatvalue);
+      break;
+    case VAR_FLOAT:
+      if (reader.len-reader.pos>sizeof(float64) && *p==PRINT_FLOAT) {
+        memcpy(&value, p+1, sizeof(float64));
+        value = order_float(value);
+        memcpy(CAST(base, float64 *)+n, &value, sizeof(float64));
+        reader.pos+=1+sizeof(float64);
+        continue;
+      }
+      reader_number(&reader, &isint, &intvalue, &floatvalue);
+      CAST(base, float64 *)[n] = isint ? TOFLOAT(intvalue) : floatvalue;
+      break;
+    case VAR_STRINGDOL:
+      reader_string(&reader, CAST(base, basicstring *)+n);
+    }
+  }
+}
+
+/*
+** 'fileio_putarraydata' and 'fileio_getarraydata' write and read the
+** elements of the numeric array of type 'type' at 'base' as they are
+** held in memory, that is, in the native byte order and without any
+** type markers
+*/
+static size_t array_datasize(int32 type, int32 count) {
+  switch (type) {
+  case VAR_INTWORD: return count*sizeof(int32);
+  case VAR_UINT8: return count*sizeof(uint8);
+  case VAR_INTLONG: return count*sizeof(int64);
+  default: return count*sizeof(float64);
+  }
+}
+
+void fileio_putarraydata(int32 handle, int32 type, void *base, int32 count) {
+  fileio_putblock(handle, base, array_datasize(type, count));
+}
+
+void fileio_getarraydata(int32 handle, int32 type, void *base, int32 count) {
+  size_t size = array_datasize(type, count);
+  if (fileio_getblock(handle, base, size)<size) error(ERR_HITEOF);
+}
@@ -33,11 +33,18 @@ extern int32 fileio_openout(char *, int32);
 extern int32 fileio_openup(char *, int32);
 extern void fileio_close(int32);
 extern int32 fileio_bget(int32);
-extern int32 fileio_getdol(int32, char *);
+extern int32 fileio_getdol(int32, char *, char **);
 extern void fileio_getnumber(int32, boolean *, int64 *, float64 *);
 extern int32 fileio_getstring(int32, char *);
 extern void fileio_bput(int32, int32);
 extern void fileio_bputstr(int32, char *, int32);
+extern void fileio_putblock(int32, void *, size_t);
+extern size_t fileio_getblock(int32, void *, size_t);
+extern boolean fileio_async(int32, boolean);
+extern void fileio_printarray(int32, int32, void *, int32);
+extern void fileio_getarray(int32, int32, void *, int32);
+extern void fileio_putarraydata(int32, int32, void *, int32);
+extern void fileio_getarraydata(int32, int32, void *, int32);
 extern void fileio_printint(int32, int32);
 extern void fileio_printuint8(int32, uint8);
 extern void fileio_printint64(int32, int64);
@@ -48,6 +55,7 @@ extern int64 fileio_getptr(int32);
 extern void fileio_setptr(int32, int64);
 extern int64 fileio_getext(int32);
 extern void fileio_setext(int32, int64);
+extern void fileio_checkmaps(void);
 extern void fileio_shutdown(void);
 
 #endif
@@ -79,10 +79,38 @@
 /* RISC OS BASIC V uses &B0A, BASIC VI uses &110A. RTR BASICs use &90A */
 #define STRFORMAT 0x110A                /* Default format used by function STR$ */
 
+#define EVALCACHESIZE 512               /* Number of tokenised expressions kept by EVAL */
+#define EVALHASHSIZE 1024               /* Size of EVAL cache hash table. Must be a power of 2 */
+
 static int32 lastrandom;                /* 32-bit pseudo-random number generator value */
 static int32 randomoverflow;            /* 1-bit overflow from pseudo-random number generator */
 static float64 floatvalue;              /* Temporary for holding floating point values */
 
+/*
+** The EVAL cache holds the tokenised versions of the expressions most
+** recently evaluated by EVAL, keyed on the text of the expression. As
+** the tokens are kept, references to variables and functions in them are
+** filled in the first time the expression is evaluated just as they are
+** in the program. The entries are in a hash table and on a list in order
+** of use so that the least recently used one can be replaced when the
+** cache is full
+*/
+typedef struct evalentry {
+  char *text;                           /* Text of expression */
+  int32 textlen;                        /* Length of text */
+  uint32 hash;                          /* Hash of text */
+  int32 mode;                           /* Tokeniser options it was tokenised with */
+  byte *tokens;                         /* Tokenised expression */
+  struct evalentry *hashflink;          /* Next entry on same hash chain */
+  struct evalentry *newer;              /* Next most recently used entry */
+  struct evalentry *older;              /* Next least recently used entry */
+} evalentry;
+
+static evalentry *evalhash[EVALHASHSIZE];       /* EVAL cache hash table */
+static evalentry *evalnewest;           /* Most recently used EVAL cache entry */
+static evalentry *evaloldest;           /* Least recently used EVAL cache entry */
+static int32 evalcount;                 /* Number of entries in EVAL cache */
+
 /*
 ** 'bad_token' is called to report a bad token value. This could mean
 ** two things: either the program has been corrupted or there is a bug
@@ -884,6 +912,134 @@ static void fn_err(void) {
   DEBUGFUNCMSGOUT;
 }
 
+/*
+** 'clear_evalcache' is called whenever the references to variables and
+** procedures in the program are reset. It does the same to the
+** expressions in the EVAL cache. The tokens are kept as they do not
+** depend on the program, but they are no longer safe to use until they
+** have been through this.
+*/
+void clear_evalcache(void) {
+  evalentry *ep;
+
+  DEBUGFUNCMSGIN;
+  for (ep = evalnewest; ep != NIL; ep = ep->older) clear_linerefs(ep->tokens);
+  DEBUGFUNCMSGOUT;
+}
+
+/*
+** 'eval_mode' returns the options that change the way in which an
+** expression is tokenised. Expressions in the EVAL cache are only used
+** if they were tokenised with the same options
+*/
+static int32 eval_mode(void) {
+  return (matrixflags.hex64 ? 1 : 0) | (matrixflags.lowercasekeywords ? 2 : 0);
+}
+
+/*
+** 'eval_hash' returns the hash of the expression 'text'
+*/
+static uint32 eval_hash(char *text, int32 length) {
+  uint32 hash = 2166136261u;
+  int32 n;
+
+  for (n = 0; n < length; n++) hash = (hash ^ CAST(text[n], byte)) * 16777619u;
+  return hash;
+}
+
+/*
+** 'unlink_evalentry' removes entry 'ep' from the list of EVAL cache
+** entries in order of use
+*/
+static void unlink_evalentry(evalentry *ep) {
+  if (ep->newer == NIL)
+    evalnewest = ep->older;
+  else {
+    ep->newer->older = ep->older;
+  }
+  if (ep->older == NIL)
+    evaloldest = ep->newer;
+  else {
+    ep->older->newer = ep->newer;
+  }
+}
+
+/*
+** 'link_evalentry' makes entry 'ep' the most recently used one in the
+** EVAL cache
+*/
+static void link_evalentry(evalentry *ep) {
+  ep->newer = NIL;
+  ep->older = evalnewest;
+  if (evalnewest == NIL)
+    evaloldest = ep;
+  else {
+    evalnewest->newer = ep;
+  }
+  evalnewest = ep;
+}
+
+/*
+** 'find_evalentry' looks for expression 'text' tokenised with the
+** current options in the EVAL cache, returning a pointer to its entry
+** or NIL if it is not there
+*/
+static evalentry *find_evalentry(char *text, int32 length, uint32 hash) {
+  evalentry *ep;
+  int32 mode = eval_mode();
+
+  for (ep = evalhash[hash & (EVALHASHSIZE-1)]; ep != NIL; ep = ep->hashflink) {
+    if (ep->hash == hash && ep->mode == mode && ep->textlen == length && memcmp(ep->text, text, length) == 0) break;
+  }
+  return ep;
+}
+
+/*
+** 'add_evalentry' adds the tokenised version of expression 'text' to the
+** EVAL cache. If the cache is full the least recently used expression is
+** replaced, but only if no other EVAL is in progress as its tokens might
+** be the ones being evaluated. It returns a pointer to the new entry or
+** NIL if the expression could not be added
+*/
+static evalentry *add_evalentry(char *text, int32 length, uint32 hash, byte *tokens) {
+  evalentry *ep, **epp;
+  int32 toklen = GET_LINELEN(tokens);
+
+  if (evalcount < EVALCACHESIZE) {
+    ep = malloc(sizeof(evalentry));
+    if (ep == NIL) return NIL;
+    ep->text = NIL;
+    ep->tokens = NIL;
+    evalcount++;
+  } else if (basicvars.curcount == 0) {
+    ep = evaloldest;
+    unlink_evalentry(ep);
+    epp = &evalhash[ep->hash & (EVALHASHSIZE-1)];
+    while (*epp != ep) epp = &(*epp)->hashflink;
+    *epp = ep->hashflink;
+  } else {
+    return NIL;
+  }
+  ep->text = realloc(ep->text, length+1);
+  ep->tokens = realloc(ep->tokens, toklen);
+  if (ep->text == NIL || ep->tokens == NIL) {
+    free(ep->text);
+    free(ep->tokens);
+    free(ep);
+    evalcount--;
+    return NIL;
+  }
+  memmove(ep->text, text, length);
+  ep->textlen = length;
+  ep->hash = hash;
+  ep->mode = eval_mode();
+  memmove(ep->tokens, tokens, toklen);
+  ep->hashflink = evalhash[hash & (EVALHASHSIZE-1)];
+  evalhash[hash & (EVALHASHSIZE-1)] = ep;
+  link_evalentry(ep);
+  return ep;
+}
+
 /*
 ** 'fn_eval' deals with the function 'eval'
 ** The argument of the function is tokenized and stored in
@@ -892,11 +1048,17 @@ static void fn_err(void) {
 ** error occurs in the expression being evaluated as the
 ** current will not be pointing into the Basic program. I
 ** think the value should be saved on the Basic stack.
+** The tokenised expression is then kept in the EVAL cache
+** so that evaluating the same expression again does not
+** have to tokenize it or look up its variables again.
 */
 static void fn_eval(void) {
   stackitem stringtype;
   basicstring descriptor;
   byte evalexpr[MAXSTATELEN];
+  byte *tokens;
+  evalentry *ep;
+  uint32 hash;
 
   DEBUGFUNCMSGIN;
   (*factor_table[*basicvars.current])();
@@ -907,12 +1069,22 @@ static void fn_eval(void) {
     return;
   }
   descriptor = pop_string();
-  memmove(basicvars.stringwork, descriptor.stringaddr, descriptor.stringlen);
-  basicvars.stringwork[descriptor.stringlen] = asc_NUL; /* Now have a null-terminated version of string */
+  hash = eval_hash(descriptor.stringaddr, descriptor.stringlen);
+  ep = find_evalentry(descriptor.stringaddr, descriptor.stringlen, hash);
+  if (ep != NIL) {      /* Seen this one before */
+    unlink_evalentry(ep);
+    link_evalentry(ep);
+    tokens = ep->tokens;
+  } else {
+    memmove(basicvars.stringwork, descriptor.stringaddr, descriptor.stringlen);
+    basicvars.stringwork[descriptor.stringlen] = asc_NUL; /* Now have a null-terminated version of string */
+    tokenize(basicvars.stringwork, evalexpr, NOLINE, FALSE);    /* 'tokenise' leaves its results in 'thisline' */
+    ep = add_evalentry(descriptor.stringaddr, descriptor.stringlen, hash, evalexpr);
+    tokens = ep != NIL ? ep->tokens : evalexpr;
+  }
   if (stringtype == STACK_STRTEMP) free_string(descriptor);
-  tokenize(basicvars.stringwork, evalexpr, NOLINE, FALSE);      /* 'tokenise' leaves its results in 'thisline' */
   save_current();               /* Save pointer to current position in expression */
-  basicvars.current = FIND_EXEC(evalexpr);
+  basicvars.current = FIND_EXEC(tokens);
   expression();
   if (basicvars.runflags.flag_cosmetic && (*basicvars.current != asc_NUL)) {
     DEBUGFUNCMSGOUT;
@@ -982,7 +1154,7 @@ static void fn_get(void) {
 ** from the keyboard or a string from a file
 */
 static void fn_getdol(void) {
-  char *cp;
+  char *cp, *text;
   int ch;
   int32 handle, count;
 
@@ -1010,9 +1182,22 @@ static void fn_getdol(void) {
   } else if (*basicvars.current == '#') {       /* Have encountered the 'GET$#' version */
     basicvars.current++;
     handle = eval_intfactor();
-    count = fileio_getdol(handle, basicvars.stringwork);
+    text = basicvars.stringwork;
+    if (*basicvars.current == BASTOKEN_BY) {    /* 'GET$#<handle> BY <count>' - Read a block of bytes */
+      basicvars.current++;
+      count = eval_intfactor();
+      if (count<0 || count>MAXSTRING) {
+        DEBUGFUNCMSGOUT;
+        error(ERR_STRINGLEN);
+        return;
+      }
+      count = fileio_getblock(handle, basicvars.stringwork, count);
+    }
+    else {
+      count = fileio_getdol(handle, basicvars.stringwork, &text);
+    }
     cp = alloc_string(count);
-    memcpy(cp, basicvars.stringwork, count);
+    memcpy(cp, text, count);
     push_strtemp(count, cp);
   }
   else {        /* Normal 'GET$' - Return character read as a string */
@@ -2338,7 +2338,7 @@ static void vdu_movetext(void) {
 }
 
 static void printer_char(void) {
-  if (matrixflags.printer) fputc(vduqueue[0], matrixflags.printer);
+  if (matrixflags.printer) printout_byte(vduqueue[0]);
 }
 
 /*
@@ -2350,7 +2350,7 @@ static void printer_char(void) {
 */
 void emulate_vdu(int32 charvalue) {
   charvalue = charvalue & BYTEMASK;     /* Deal with any signed char type problems */
-  if (matrixflags.dospool) fputc(charvalue, matrixflags.dospool);
+  if (matrixflags.dospool) spool_character(charvalue);
   if (matrixflags.printer) printout_character(charvalue);
   if (vduneeded == 0) {                 /* VDU queue is empty */
     if (vduflag(VDU_FLAG_DISABLE)) {
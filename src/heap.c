@@ -38,12 +38,16 @@
 #include "basicdefs.h"
 #include "errors.h"
 #include "miscprocs.h"
+#include "strings.h"
+#include "tokens.h"
+#include "stack.h"
 
 #ifdef TARGET_LINUX
 #ifndef __USE_LARGEFILE64
 #define __USE_LARGEFILE64
 #endif
 #include <sys/mman.h>
+#include <unistd.h>
 #endif
 
 #ifdef TARGET_RISCOS
@@ -51,6 +55,11 @@
 #include "swis.h"
 #endif
 
+typedef struct {
+  byte *blockstart;                     /* Address of free block */
+  size_t blocksize;                     /* Size of free block */
+} freeblock;
+
 #if defined(TARGET_LINUX) && defined(__LP64__)
 static void *mymap (size_t size)
 {
@@ -100,66 +109,156 @@ boolean init_heap(void) {
   return basicvars.stringwork!=NIL;
 }
 
+#if defined(TARGET_LINUX) && defined(__LP64__)
+#define ALIGNHUGE(x) (((x)+HUGEPAGESIZE-1) & -(size_t)HUGEPAGESIZE)     /* Round up to whole huge pages */
+
 /*
-** 'init_workspace' is called to obtain the memory used to hold the Basic
-** program. 'heapsize' gives the size of block. If zero, the size of the
-** area used is the implementation-defined default. If returns 'true' if
-** if the heap space could be allocated or 'false' if it failed
+** 'map_pages' maps 'size' bytes of anonymous memory at or near 'base',
+** applying the huge page and prefault options. If explicit huge pages
+** cannot be had, normal pages are used instead. Huge pages are never
+** mapped with MAP_NORESERVE as touching one that the pool cannot supply
+** kills the process. 'size' must be a multiple of HUGEPAGESIZE if
+** explicit huge pages are wanted
 */
-boolean init_workspace(size_t heapsize) {
-  byte *wp = NULL;
-#if defined(TARGET_LINUX) && defined(__LP64__)
-  void *base = NULL;
-  uint32 heaporig;
-#endif
+static byte *map_pages(void *base, size_t size, int flags) {
+  byte *wp;
 
-  DEBUGFUNCMSGIN;
-  basicvars.misc_flags.usedmmap = 0;
-  if (heapsize==0)
-    heapsize = DEFAULTSIZE;
-  else if (heapsize<MINSIZE)
-    heapsize = MINSIZE;
-  else if (heapsize>0xFFFFFC00ull)
-    heapsize = 0xFFFFFC00ull;
-  else {
-    heapsize = ALIGN(heapsize);
+  if (matrixflags.prefault) flags |= MAP_POPULATE;
+  if (matrixflags.hugepages == HUGEPAGES_TLB) {
+    wp = mmap64(base, size, PROT_READ | PROT_WRITE, (flags & ~MAP_NORESERVE) | MAP_HUGETLB, -1, 0);
+    if (wp != MAP_FAILED) return wp;
   }
-#if defined(TARGET_LINUX) && defined(__LP64__)
-  heaporig = heapsize;
+  wp = mmap64(base, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (wp != MAP_FAILED && matrixflags.hugepages == HUGEPAGES_THP) madvise(wp, size, MADV_HUGEPAGE);
+  return wp;
+}
+
+/*
+** 'map_workspace' maps the workspace at as low an address as possible.
+** If 'reserve' is set the size was given as 'max', so reserve as much
+** address space below 4GB as can be found instead of a fixed block. The
+** mapping is made with MAP_NORESERVE so pages are only committed as the
+** heap and stack grow into them, and 'clear_heap' gives them back again
+*/
+static byte *map_workspace(size_t *heapsize, boolean reserve) {
+  byte *wp;
+  void *base = NULL;
+  uint32 heaporig = *heapsize;
+
   basicvars.misc_flags.usedmmap = 1;
 #ifdef DEBUG
 #  ifdef MATRIX64BIT
-  fprintf(stderr, "heap.c:init_workspace: Requested heapsize is %ld (&%lX)\n", heapsize, heapsize);
+  fprintf(stderr, "heap.c:init_workspace: Requested heapsize is %ld (&%lX)\n", *heapsize, *heapsize);
 #  else
-  fprintf(stderr, "heap.c:init_workspace: Requested heapsize is %d (&%X)\n", heapsize, heapsize);
+  fprintf(stderr, "heap.c:init_workspace: Requested heapsize is %d (&%X)\n", *heapsize, *heapsize);
 #  endif
 #endif
-  base = mymap(heapsize);
-  if (base != NULL) {
+  if (reserve) {
+    for (*heapsize = RESERVESIZE; *heapsize>heaporig; *heapsize = ALIGN(*heapsize-*heapsize/8)) {
+      base = mymap(*heapsize);
+      if (base != NULL && (size_t)base+*heapsize <= 0x100000000ull) break;
+      base = NULL;
+    }
+    if (base == NULL) *heapsize = heaporig;
+  }
+  if (matrixflags.hugepages == HUGEPAGES_TLB) {
+/* Explicit huge pages must be mapped in whole, aligned, huge pages */
+    *heapsize = *heapsize<HUGEPAGESIZE ? HUGEPAGESIZE : *heapsize & -HUGEPAGESIZE;
+    base = mymap(*heapsize+HUGEPAGESIZE);
+    if (base != NULL) base = CAST((CAST(base, size_t)+HUGEPAGESIZE-1) & -HUGEPAGESIZE, void *);
+  }
+  if (base == NULL) base = mymap(*heapsize);
+  if (base == NULL) {
+    /* Trying to allocate via mmap didn't work, let's try malloc instead */
+    basicvars.misc_flags.usedmmap = 0;
+    return malloc(*heapsize);
+  }
 #ifdef DEBUG
 #  ifdef MATRIX64BIT
-    fprintf(stderr, "heap.c:init_workspace: Allocating at %p, size &%lX\n", base, heapsize);
+  fprintf(stderr, "heap.c:init_workspace: Allocating at %p, size &%lX\n", base, *heapsize);
 #  else
-    fprintf(stderr, "heap.c:init_workspace: Allocating at %p, size &%X\n", base, heapsize);
+  fprintf(stderr, "heap.c:init_workspace: Allocating at %p, size &%X\n", base, *heapsize);
 #  endif
 #endif
-    wp = mmap64(base, heapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) ;
+  wp = map_pages(base, *heapsize, MAP_PRIVATE | MAP_ANONYMOUS | (*heapsize>heaporig ? MAP_NORESERVE : 0));
 #ifdef DEBUG
-    fprintf(stderr, "heap.c:init_workspace: mmap returns %p\n", wp);
+  fprintf(stderr, "heap.c:init_workspace: mmap returns %p\n", wp);
 #endif
-    if ((size_t)wp == -1) {
-      heapsize=heaporig;
-      wp=malloc(heapsize);
+  if ((size_t)wp == -1) {
+    *heapsize=heaporig;
+    wp=malloc(*heapsize);
 #ifdef DEBUG
-      fprintf(stderr, "heap.c:init_workspace: Fallback, malloc returns %p\n", wp);
+    fprintf(stderr, "heap.c:init_workspace: Fallback, malloc returns %p\n", wp);
 #endif
-      basicvars.misc_flags.usedmmap = 0;
-    }
-  } else {
-    /* Trying to allocate via mmap didn't work, let's try malloc instead */
-    wp=malloc(heapsize);
     basicvars.misc_flags.usedmmap = 0;
   }
+  else {
+    basicvars.misc_flags.reserved = *heapsize>heaporig;
+  }
+  return wp;
+}
+
+/*
+** 'map_bigworkspace' maps a workspace that can be larger than 4GB, for
+** 'bigmem' mode. It asks for it to start at the first free low address
+** so that PAGE is below 4GB, and fails (giving a workspace of up to 4GB
+** instead) if the OS puts it anywhere else. Everything above the first
+** BIGNEARSIZE bytes is only used for large arrays and blocks (see
+** 'allocbig')
+*/
+static byte *map_bigworkspace(size_t *heapsize, boolean reserve) {
+  byte *wp;
+
+  if (reserve) *heapsize = BIGMEMSIZE;
+  if (matrixflags.hugepages == HUGEPAGES_TLB) *heapsize &= -HUGEPAGESIZE;
+  wp = map_pages(mymap(MINSIZE), *heapsize, MAP_PRIVATE | MAP_ANONYMOUS | (reserve ? MAP_NORESERVE : 0));
+  if ((size_t)wp != -1 && (size_t)wp >= 0x100000000ull) {
+    munmap(wp, *heapsize);            /* Keep PAGE below 4GB */
+    wp = CAST(-1, byte *);
+  }
+  if ((size_t)wp == -1) {
+    *heapsize = reserve ? DEFAULTSIZE : 0xFFFFFC00ull;
+    return NULL;
+  }
+  basicvars.misc_flags.usedmmap = 1;
+  basicvars.misc_flags.reserved = reserve && !matrixflags.prefault;
+  return wp;
+}
+#endif
+
+/*
+** 'init_workspace' is called to obtain the memory used to hold the Basic
+** program. 'heapsize' gives the size of block. If zero, the size of the
+** area used is the implementation-defined default. If MAXWORKSPACE, as
+** much as can be found is reserved on 64-bit Linux. If returns 'true' if
+** if the heap space could be allocated or 'false' if it failed
+*/
+boolean init_workspace(size_t heapsize) {
+  byte *wp = NULL;
+#if defined(TARGET_LINUX) && defined(__LP64__)
+/*
+** Only reserve address space if the pages are to be committed on demand.
+** Prefaulting all of it or taking it from the limited pool of explicit
+** huge pages needs a fixed size instead
+*/
+  boolean reserve = heapsize==MAXWORKSPACE && !matrixflags.prefault && matrixflags.hugepages!=HUGEPAGES_TLB;
+#endif
+
+  DEBUGFUNCMSGIN;
+  basicvars.misc_flags.usedmmap = 0;
+  basicvars.misc_flags.reserved = 0;
+  if (heapsize==0 || heapsize==MAXWORKSPACE)
+    heapsize = DEFAULTSIZE;
+  else if (heapsize<MINSIZE)
+    heapsize = MINSIZE;
+  else if (heapsize>0xFFFFFC00ull && !matrixflags.bigmem)
+    heapsize = 0xFFFFFC00ull;
+  else {
+    heapsize = ALIGN(heapsize);
+  }
+#if defined(TARGET_LINUX) && defined(__LP64__)
+  if (matrixflags.bigmem && (reserve || heapsize>0xFFFFFC00ull)) wp = map_bigworkspace(&heapsize, reserve);
+  if (wp == NULL) wp = map_workspace(&heapsize, reserve);
 #else
   wp = malloc(heapsize);
 #endif
@@ -171,6 +270,8 @@ boolean init_workspace(size_t heapsize) {
   basicvars.worksize = heapsize;
   basicvars.workspace = wp;
   basicvars.slotend = basicvars.end = basicvars.himem = wp+basicvars.worksize;
+  if (basicvars.worksize>BIGNEARSIZE) basicvars.end = basicvars.himem = wp+BIGNEARSIZE;
+  basicvars.bigstart = basicvars.bigtop = basicvars.himem;
   basicvars.memory = 0;                         /* Use as a byte array to access arbitrary points of memory */
   basicvars.page = wp;
   basicvars.memdump_lastaddr = (size_t)wp;
@@ -225,9 +326,160 @@ void release_heap(void) {
   release_workspace();
   free(basicvars.stringwork);
   if (basicvars.loadpath!=NIL) free(basicvars.loadpath);
+  if (basicvars.cachedir!=NIL) free(basicvars.cachedir);
   DEBUGFUNCMSGOUT;
 }
 
+/*
+** The Basic heap runs from 'lomem' to 'vartop' and grows upwards towards
+** the Basic stack. Memory is normally taken from the top of the heap but
+** blocks returned via 'freemem' are kept on a set of free lists, one per
+** size class, so that they can be reused. Blocks of up to HEAPSMALL bytes
+** have a list per possible (aligned) size and so do not need to record
+** their own length. Larger blocks are kept on lists that each cover a
+** power of two range of sizes, with the length of each block stored in
+** the block itself. A block freed at the top of the heap is simply given
+** back by lowering 'vartop'.
+** When the heap is exhausted the free blocks are sorted by address and any
+** adjacent ones merged ('coalesce_heap'). The string memory manager in
+** strings.c keeps its own bins and only returns memory via 'freemem'.
+*/
+
+#define HEAPSMALL 256                         /* Largest block size with its own list */
+#define HEAPGRAIN ALIGN(1)                    /* Size difference between small lists */
+#define SMALLCLASSES (HEAPSMALL/HEAPGRAIN+1)  /* Number of small block lists */
+#define HEAPCLASSES (SMALLCLASSES+64)         /* Total number of free lists */
+
+typedef struct heapfree {
+  struct heapfree *nextfree;            /* Next block in this free list */
+  size_t freesize;                      /* Size of block (large blocks only) */
+} heapfree;
+
+static heapfree *freelists[HEAPCLASSES];        /* Free block lists by size class */
+static size_t heapfreebytes;                    /* Total size of blocks on the free lists */
+static size_t heapfreecount;                    /* Number of blocks on the free lists */
+
+/*
+** 'find_class' returns the number of the free list that holds blocks
+** of 'size' bytes. 'size' has to be a multiple of HEAPGRAIN
+*/
+static int find_class(size_t size) {
+  int class;
+
+  if (size<=HEAPSMALL) return size/HEAPGRAIN;
+  class = SMALLCLASSES;
+  size = size/HEAPSMALL;
+  while (size>1) {
+    size = size>>1;
+    class++;
+  }
+  return class;
+}
+
+/*
+** 'add_freeblock' puts the block of 'size' bytes at 'where' on to the
+** right free list
+*/
+static void add_freeblock(byte *where, size_t size) {
+  heapfree *fp = CAST(where, heapfree *);
+  int class = find_class(size);
+
+  fp->nextfree = freelists[class];
+  if (size>HEAPSMALL) fp->freesize = size;
+  freelists[class] = fp;
+  heapfreebytes+=size;
+  heapfreecount++;
+}
+
+/*
+** 'take_freeblock' looks for a block of at least 'size' bytes on the
+** free lists. If it finds one it is removed from its list and any
+** part of it that is not needed returned to the lists. It returns
+** a pointer to the block or NIL if there is nothing big enough
+*/
+static byte *take_freeblock(size_t size) {
+  heapfree *fp, *last;
+  size_t blocksize;
+  int class;
+
+  if (heapfreebytes<size) return NIL;
+  for (class = find_class(size); class<HEAPCLASSES; class++) {
+    last = NIL;
+    fp = freelists[class];
+    while (fp!=NIL) {
+      blocksize = class<SMALLCLASSES ? class*HEAPGRAIN : fp->freesize;
+      if (blocksize>=size) {
+        if (last==NIL)
+          freelists[class] = fp->nextfree;
+        else {
+          last->nextfree = fp->nextfree;
+        }
+        heapfreebytes-=blocksize;
+        heapfreecount--;
+        if (blocksize>size) add_freeblock(CAST(fp, byte *)+size, blocksize-size);
+        return CAST(fp, byte *);
+      }
+      last = fp;
+      fp = fp->nextfree;
+    }
+  }
+  return NIL;
+}
+
+static int compare_blocks(const void *first, const void *second) {
+  const freeblock *a = first, *b = second;
+
+  if (a->blockstart<b->blockstart) return -1;
+  return a->blockstart>b->blockstart;
+}
+
+/*
+** 'coalesce_heap' is called when the heap is exhausted. It sorts the free
+** blocks by address, merges adjacent ones and puts them back on the free
+** lists. If the last block ends at 'vartop' it is returned to the heap.
+** It returns 'true' if it managed to do anything useful
+*/
+static boolean coalesce_heap(void) {
+  freeblock *base;
+  heapfree *fp;
+  size_t count, here, next, oldfree;
+  int class;
+
+  if (heapfreecount==0) return FALSE;
+  base = malloc(heapfreecount*sizeof(freeblock));
+  if (base==NIL) return FALSE;
+  count = 0;
+  for (class = 0; class<HEAPCLASSES; class++) {
+    for (fp = freelists[class]; fp!=NIL; fp = fp->nextfree) {
+      base[count].blockstart = CAST(fp, byte *);
+      base[count].blocksize = class<SMALLCLASSES ? class*HEAPGRAIN : fp->freesize;
+      count++;
+    }
+    freelists[class] = NIL;
+  }
+  qsort(base, count, sizeof(freeblock), compare_blocks);
+  here = 0;
+  for (next = 1; next<count; next++) {
+    if (base[here].blockstart+base[here].blocksize==base[next].blockstart)
+      base[here].blocksize+=base[next].blocksize;
+    else {
+      here++;
+      base[here] = base[next];
+    }
+  }
+  count = here+1;
+  oldfree = heapfreecount;
+  heapfreebytes = heapfreecount = 0;
+  if (base[count-1].blockstart+base[count-1].blocksize==basicvars.vartop) {
+    count--;
+    basicvars.vartop-=base[count].blocksize;
+    basicvars.stacklimit.bytesp-=base[count].blocksize;
+  }
+  for (here = 0; here<count; here++) add_freeblock(base[here].blockstart, base[here].blocksize);
+  free(base);
+  return heapfreecount<oldfree;
+}
+
 /*
 ** 'allocmem' is called to allocate space for variables, arrays, strings
 ** and so forth. The memory between 'lomem' and 'stacklimit' is available
@@ -241,6 +493,19 @@ void *allocmem(size_t size, boolean reporterror) {
 
   DEBUGFUNCMSGIN;
   size = ALIGN(size);
+  if (size==0) size = HEAPGRAIN;
+  newlimit = take_freeblock(size);
+  if (newlimit!=NIL) {
+    DEBUGFUNCMSGOUT;
+    return newlimit;
+  }
+  if (basicvars.stacklimit.bytesp+size>=basicvars.stacktop.bytesp && coalesce_heap()) {
+    newlimit = take_freeblock(size);
+    if (newlimit!=NIL) {
+      DEBUGFUNCMSGOUT;
+      return newlimit;
+    }
+  }
   newlimit = basicvars.stacklimit.bytesp+size;
   if (newlimit>=basicvars.stacktop.bytesp) {    /* Have run out of memory */
     if (reporterror) {
@@ -260,19 +525,141 @@ void *allocmem(size_t size, boolean reporterror) {
 }
 
 /*
-** 'freemem' is called to return memory to the heap.
-** Note that this version of the code can only reclaim the memory if it
-** was the last item allocated. It does not deal with returning memory
-** to the middle of the heap. 'returnable' should be called to ensure
-** that the memory can be returned
+** 'freemem' is called to return memory to the heap. If the block
+** is the last item allocated the top of the heap is moved down,
+** otherwise the block is added to the free lists. Blocks that lie
+** outside of the heap are ignored. This happens if a block is
+** freed after the heap has been cleared
 */
-void freemem(void *where, int32 size) {
+void freemem(void *where, size_t size) {
+  byte *bp = CAST(where, byte *);
+
   DEBUGFUNCMSGIN;
-  basicvars.vartop-=size;
-  basicvars.stacklimit.bytesp-=size;
+  size = ALIGN(size);
+  if (size==0) size = HEAPGRAIN;
+  if (bp<basicvars.lomem || bp+size>basicvars.vartop) {
+    DEBUGFUNCMSGOUT;
+    return;
+  }
+  if (bp+size==basicvars.vartop) {
+    basicvars.vartop-=size;
+    basicvars.stacklimit.bytesp-=size;
+  }
+  else {
+    add_freeblock(bp, size);
+  }
   DEBUGFUNCMSGOUT;
 }
 
+/*
+** 'allocbig' is used for array bodies and blocks created by DIM. In
+** 'bigmem' mode blocks of BIGBLOCK bytes or more are taken from the area
+** between HIMEM and the end of the workspace, which can be far more than
+** 4GB. This keeps the Basic heap, which holds the variables the program's
+** tokens point at, within reach of the 32-bit offsets used to refer to
+** them. Everything else is allocated on the heap as normal
+*/
+void *allocbig(size_t size, boolean reporterror) {
+  byte *bp;
+
+  size = ALIGN(size);
+  if (size<BIGBLOCK || basicvars.bigtop+size>basicvars.workspace+basicvars.worksize)
+    return allocmem(size, reporterror);
+  bp = basicvars.bigtop;
+  basicvars.bigtop+=size;
+  return bp;
+}
+
+/*
+** 'freebig' returns a block obtained via 'allocbig'. Memory in the area
+** above HIMEM can only be reclaimed if it was the last block allocated
+*/
+void freebig(void *where, size_t size) {
+  byte *bp = CAST(where, byte *);
+
+  size = ALIGN(size);
+  if (bp<basicvars.bigstart || bp>=basicvars.workspace+basicvars.worksize)
+    freemem(where, size);
+  else if (bp+size==basicvars.bigtop) {
+    basicvars.bigtop = bp;
+  }
+}
+
+/*
+** 'heap_stats' fills in 'stats' with details of how much of the Basic
+** heap is in use and how fragmented the free space is
+*/
+void heap_stats(heapinfo *stats) {
+  heapfree *fp;
+  size_t blocksize;
+  int class;
+
+  stats->heapsize = basicvars.vartop-basicvars.lomem;
+  stats->freebytes = heapfreebytes;
+  stats->freeblocks = heapfreecount;
+  stats->largest = 0;
+  stats->bigsize = basicvars.workspace+basicvars.worksize-basicvars.bigstart;
+  stats->bigused = basicvars.bigtop-basicvars.bigstart;
+  for (class = HEAPCLASSES-1; class>=0 && stats->largest==0; class--) {
+    for (fp = freelists[class]; fp!=NIL; fp = fp->nextfree) {
+      blocksize = class<SMALLCLASSES ? class*HEAPGRAIN : fp->freesize;
+      if (blocksize>stats->largest) stats->largest = blocksize;
+    }
+  }
+}
+
+/*
+** 'map_offheap' is called to obtain the memory for an off-heap array of
+** 'size' bytes when huge pages or prefaulting have been asked for. Large
+** arrays are mapped directly so that the options can be applied. The
+** function returns NIL if the array should be allocated with malloc()
+** as normal. Memory obtained this way must be released with
+** 'unmap_offheap'
+*/
+void *map_offheap(size_t size) {
+#if defined(TARGET_LINUX) && defined(__LP64__)
+  byte *base;
+
+  if (size<HUGEPAGESIZE || (matrixflags.hugepages == HUGEPAGES_NONE && !matrixflags.prefault)) return NIL;
+  base = map_pages(NULL, ALIGNHUGE(size), MAP_PRIVATE | MAP_ANONYMOUS);
+  return base == MAP_FAILED ? NIL : base;
+#else
+  return NIL;
+#endif
+}
+
+/*
+** 'unmap_offheap' releases an off-heap array of 'size' bytes that was
+** mapped by 'map_offheap'
+*/
+void unmap_offheap(void *base, size_t size) {
+#if defined(TARGET_LINUX) && defined(__LP64__)
+  munmap(base, ALIGNHUGE(size));
+#endif
+}
+
+/*
+** 'release_pages' hands the memory pages between 'low' and 'high' back to
+** the operating system. This is only done if the workspace is a reserved
+** mapping. The pages are committed again (filled with zeros) if they are
+** touched later
+*/
+static void release_pages(byte *low, byte *high) {
+#if defined(TARGET_LINUX) && defined(__LP64__)
+  size_t pagesize = sysconf(_SC_PAGESIZE);
+
+  if (!basicvars.misc_flags.reserved) return;
+  low = CAST((CAST(low, size_t)+pagesize-1) & -pagesize, byte *);
+  high = CAST(CAST(high, size_t) & -pagesize, byte *);
+  if (high<=low) return;
+  if (basicvars.misc_flags.filemapped)  /* Replace pages mapped from a snapshot with zero-filled ones */
+    mmap64(low, high-low, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+  else {
+    madvise(low, high-low, MADV_DONTNEED);
+  }
+#endif
+}
+
 /*
 ** 'clear_heap' is used to clear the variable and free string lists
 ** when a 'clear' command is used, a program is edited or 'new' or
@@ -282,6 +669,380 @@ void clear_heap(void) {
   DEBUGFUNCMSGIN;
   basicvars.vartop = basicvars.lomem;
   basicvars.stacklimit.bytesp = basicvars.lomem+STACKBUFFER;
+  memset(freelists, 0, sizeof(freelists));
+  heapfreebytes = heapfreecount = 0;
+  release_pages(basicvars.vartop, basicvars.stacktop.bytesp);
+  if (basicvars.bigtop>basicvars.bigstart) {
+    release_pages(basicvars.bigstart, basicvars.bigtop);
+    basicvars.bigtop = basicvars.bigstart;
+  }
   DEBUGFUNCMSGOUT;
 }
 
+/*
+** '*SNAPSHOT' saves the state of the Basic program in a file so that
+** it can be restored when the interpreter is next started with the
+** option '-restore' instead of the program having to be loaded and
+** its initialisation run again. The snapshot holds the workspace up
+** to the top of the Basic heap (the program, variables, arrays and
+** strings), the free lists for the heap and strings, and any installed
+** libraries, and can name a procedure to call once it is restored.
+** The workspace is saved as it is, so all the pointers in it only
+** remain valid if it is restored at the same address. As it is put at
+** the lowest free address this is normally the case, but the snapshot
+** cannot be used if not. Where possible the image of the workspace is
+** mapped from the file rather than read, so that pages are only read
+** in as they are used. Installed libraries are held outside the
+** workspace and can end up anywhere when they are read back in, so
+** pointers to them are adjusted. So are pointers into 'basicvars' and
+** to the empty string, both of which are in the interpreter itself.
+** All the references filled in in the program and libraries are reset.
+** The Basic stack is not saved, so a snapshot should be taken at the
+** top level of the program rather than inside a procedure or function.
+*/
+#define SNAPMAGIC "BRSNAP1"
+#define SNAPVERSIONLEN 256
+#define SNAPALIGN 0x10000       /* Alignment of workspace image in file so that it can be mapped */
+
+#define ALIGNSNAP(x) (((x)+SNAPALIGN-1) & -(size_t)SNAPALIGN)
+
+typedef struct {
+  char magic[8];                        /* SNAPMAGIC */
+  char version[SNAPVERSIONLEN];         /* Version of interpreter that wrote the file */
+  byte *workspace;                      /* Address of workspace */
+  byte *basicvarsaddr;                  /* Address of 'basicvars' */
+  byte *page, *start, *top, *lomem, *vartop, *himem;
+  byte *bigstart, *bigtop;              /* Large block area in 'bigmem' mode */
+  library *liblist;                     /* Libraries loaded via 'LIBRARY' (on the heap) */
+  variable *varlists[VARLISTS];
+  variable staticvars[STDVARS];
+  heapfree *freelists[HEAPCLASSES];
+  size_t heapfreebytes, heapfreecount;
+  size_t stringstatesize;               /* Size of string memory state that follows header */
+  int32 libcount;                       /* Number of installed libraries that follow it */
+  size_t imageoffset;                   /* Offset of workspace image in file */
+  char entry[MAXNAMELEN];               /* Procedure to call when restored or empty */
+  char program[FNAMESIZE];              /* Name of program */
+} snapshot;
+
+typedef struct {
+  library *oldlib;                      /* Address of library's entry when snapshot was taken */
+  library libentry;                     /* Copy of library's entry */
+  int32 namelen;                        /* Length of library name that follows */
+} snaplib;
+
+/*
+** 'check_snaparrays' checks that there are no off-heap arrays in the
+** variable lists 'varlists', as these are not part of the workspace
+*/
+static void check_snaparrays(variable *varlists[]) {
+  variable *vp;
+  int n;
+
+  for (n=0; n<VARLISTS; n++) {
+    for (vp = varlists[n]; vp!=NIL; vp = vp->varflink) {
+      if ((vp->varflags & VAR_ARRAY) && !(vp->varflags & (VAR_PROC | VAR_FUNCTION | VAR_MARKER))
+       && vp->varentry.vararray!=NIL && vp->varentry.vararray->offheap) error(ERR_SNAPOFFHEAP);
+    }
+  }
+}
+
+/*
+** 'save_snapshot' writes the snapshot file 'name'. 'entry' is the name
+** of the procedure to call when it is restored, or an empty string
+*/
+void save_snapshot(char *name, char *entry) {
+  FILE *snapfile;
+  snapshot header;
+  snaplib libheader;
+  library *lp;
+  void *stringstate;
+  size_t size, offset;
+
+  DEBUGFUNCMSGIN;
+  check_snaparrays(basicvars.varlists);
+  for (lp = basicvars.liblist; lp!=NIL; lp = lp->libflink) check_snaparrays(lp->varlists);
+  for (lp = basicvars.installist; lp!=NIL; lp = lp->libflink) check_snaparrays(lp->varlists);
+  memset(&header, 0, sizeof(snapshot));
+  STRLCPY(header.magic, SNAPMAGIC, sizeof(header.magic));
+#ifdef BRANDY_GITCOMMIT
+  snprintf(header.version, SNAPVERSIONLEN, "%s %s", IDSTRING, BRANDY_GITCOMMIT);
+#else
+  STRLCPY(header.version, IDSTRING, SNAPVERSIONLEN);
+#endif
+  header.workspace = basicvars.workspace;
+  header.basicvarsaddr = CAST(&basicvars, byte *);
+  header.page = basicvars.page;
+  header.start = basicvars.start;
+  header.top = basicvars.top;
+  header.lomem = basicvars.lomem;
+  header.vartop = basicvars.vartop;
+  header.himem = basicvars.himem;
+  header.bigstart = basicvars.bigstart;
+  header.bigtop = basicvars.bigtop;
+  header.liblist = basicvars.liblist;
+  memcpy(header.varlists, basicvars.varlists, sizeof(header.varlists));
+  memcpy(header.staticvars, basicvars.staticvars, sizeof(header.staticvars));
+  memcpy(header.freelists, freelists, sizeof(freelists));
+  header.heapfreebytes = heapfreebytes;
+  header.heapfreecount = heapfreecount;
+  header.stringstatesize = get_stringstate(NIL);
+  STRLCPY(header.entry, entry, MAXNAMELEN);
+  STRLCPY(header.program, basicvars.program, FNAMESIZE);
+  offset = sizeof(snapshot)+header.stringstatesize;
+  for (lp = basicvars.installist; lp!=NIL; lp = lp->libflink) {
+    header.libcount++;
+    offset+=sizeof(snaplib)+strlen(lp->libname)+lp->libsize+lp->libindexsize*sizeof(fnprocindex);
+  }
+  header.imageoffset = ALIGNSNAP(offset);
+  stringstate = malloc(header.stringstatesize);
+  snapfile = fopen(name, "wb");
+  if (stringstate==NIL || snapfile==NIL) {
+    free(stringstate);
+    if (snapfile!=NIL) fclose(snapfile);
+    error(ERR_NOTCREATED, name);
+    return;
+  }
+  get_stringstate(stringstate);
+  if (fwrite(&header, sizeof(snapshot), 1, snapfile)!=1
+   || fwrite(stringstate, header.stringstatesize, 1, snapfile)!=1) goto writefail;
+  for (lp = basicvars.installist; lp!=NIL; lp = lp->libflink) {
+    libheader.oldlib = lp;
+    libheader.libentry = *lp;
+    libheader.namelen = strlen(lp->libname);
+    if (fwrite(&libheader, sizeof(snaplib), 1, snapfile)!=1
+     || fwrite(lp->libname, 1, libheader.namelen, snapfile)!=libheader.namelen
+     || fwrite(lp->libstart, 1, lp->libsize, snapfile)!=lp->libsize
+     || fwrite(lp->libindex, sizeof(fnprocindex), lp->libindexsize, snapfile)!=lp->libindexsize) goto writefail;
+  }
+/* The workspace image is padded to a whole number of pages so that it can be mapped */
+  size = basicvars.vartop-basicvars.workspace;
+  if (fseek(snapfile, header.imageoffset, SEEK_SET)!=0
+   || fwrite(basicvars.workspace, 1, size, snapfile)!=size
+   || fseek(snapfile, header.imageoffset+ALIGNSNAP(size)-1, SEEK_SET)!=0
+   || fputc(0, snapfile)==EOF) goto writefail;
+  size = basicvars.bigtop-basicvars.bigstart;
+  if (size>0 && fwrite(basicvars.bigstart, 1, size, snapfile)!=size) goto writefail;
+  free(stringstate);
+  if (fclose(snapfile)!=0) error(ERR_WRITEFAIL, name);
+  DEBUGFUNCMSGOUT;
+  return;
+
+writefail:
+  free(stringstate);
+  fclose(snapfile);
+  error(ERR_WRITEFAIL, name);
+}
+
+/*
+** 'relocate_pointer' returns the new address of a pointer 'p' taken from
+** the snapshot described by 'hp'. Only pointers into 'basicvars' and the
+** installed libraries, whose entries are in 'libs', have to be moved
+*/
+static void *relocate_pointer(void *p, snapshot *hp, snaplib *libs) {
+  byte *bp = CAST(p, byte *);
+  int32 n;
+
+  if (bp>=hp->basicvarsaddr && bp<hp->basicvarsaddr+sizeof(workspace))
+    return CAST(&basicvars, byte *)+(bp-hp->basicvarsaddr);
+  for (n=0; n<hp->libcount; n++) {
+    if (bp>=libs[n].libentry.libstart && bp<libs[n].libentry.libstart+libs[n].libentry.libsize)
+      return libs[n].oldlib->libstart+(bp-libs[n].libentry.libstart);
+  }
+  return p;
+}
+
+/*
+** 'relocate_varlists' fixes up the pointers in the variable lists
+** 'varlists' after a snapshot has been restored. 'oldlib' in each of
+** the entries in 'libs' has been changed to point at the library's new
+** entry by this point. 'stringstate' is the state of the string memory
+** manager saved in the snapshot
+*/
+static void relocate_varlists(variable *varlists[], snapshot *hp, snaplib *libs, void *stringstate) {
+  variable *vp;
+  formparm *fp;
+  basicarray *ap;
+  int32 n, lib;
+
+  for (n=0; n<VARLISTS; n++) {
+    for (vp = varlists[n]; vp!=NIL; vp = vp->varflink) {
+      for (lib=0; lib<hp->libcount; lib++) {
+        if (vp->varowner==libs[lib].libentry.libflink) vp->varowner = libs[lib].oldlib;
+      }
+      if (vp->varflags & VAR_MARKER)
+        vp->varentry.varmarker = relocate_pointer(vp->varentry.varmarker, hp, libs);
+      else if (vp->varflags & (VAR_PROC | VAR_FUNCTION)) {
+        vp->varentry.varfnproc->fnprocaddr = relocate_pointer(vp->varentry.varfnproc->fnprocaddr, hp, libs);
+        for (fp = vp->varentry.varfnproc->parmlist; fp!=NIL; fp = fp->nextparm)
+          fp->parameter.address.charaddr = relocate_pointer(fp->parameter.address.charaddr, hp, libs);
+      }
+      else if ((vp->varflags & PARMTYPEMASK)==VAR_STRINGDOL)
+        relocate_strings(stringstate, &vp->varentry.varstring, 1);
+      else if ((vp->varflags & PARMTYPEMASK)==VAR_STRARRAY && vp->varentry.vararray!=NIL) {
+        ap = vp->varentry.vararray;
+        relocate_strings(stringstate, ap->arraystart.stringbase, ap->arrsize);
+      }
+    }
+  }
+}
+
+/*
+** 'reset_snaprefs' resets all the references filled in in the program
+** or library starting at 'bp' when the snapshot was taken
+*/
+static void reset_snaprefs(byte *start) {
+  byte *bp;
+
+  for (bp = start; !AT_PROGEND(bp); bp+=GET_LINELEN(bp)) clear_linerefs(bp);
+  if (matrixflags.linklines) link_linenums(start);
+}
+
+/*
+** 'restore_snapshot' restores the state of the program saved in the
+** snapshot file 'name'. It is called when the interpreter starts. The
+** name of the procedure to call is returned in 'entry', which will be
+** empty if the snapshot does not name one
+*/
+void restore_snapshot(char *name, char *entry) {
+  FILE *snapfile;
+  snapshot header;
+  snaplib *libs;
+  library *lp, *lastlib;
+  void *stringstate;
+  byte *libbase;
+  size_t size;
+  char version[SNAPVERSIONLEN];
+  int32 n;
+
+  DEBUGFUNCMSGIN;
+  snapfile = fopen(name, "rb");
+  if (snapfile==NIL) {
+    error(ERR_NOTFOUND, name);
+    return;
+  }
+  memset(version, 0, SNAPVERSIONLEN);
+#ifdef BRANDY_GITCOMMIT
+  snprintf(version, SNAPVERSIONLEN, "%s %s", IDSTRING, BRANDY_GITCOMMIT);
+#else
+  STRLCPY(version, IDSTRING, SNAPVERSIONLEN);
+#endif
+  if (fread(&header, sizeof(snapshot), 1, snapfile)!=1
+   || memcmp(header.magic, SNAPMAGIC, sizeof(header.magic))!=0
+   || memcmp(header.version, version, SNAPVERSIONLEN)!=0
+   || header.stringstatesize!=get_stringstate(NIL)
+   || header.workspace!=basicvars.workspace
+   || header.vartop+STACKBUFFER>=basicvars.end
+   || header.bigtop>basicvars.workspace+basicvars.worksize) {
+    fclose(snapfile);
+    error(ERR_BADSNAPSHOT, name);
+    return;
+  }
+  stringstate = malloc(header.stringstatesize);
+  libs = malloc(header.libcount*sizeof(snaplib)+1);
+  if (stringstate==NIL || libs==NIL) {
+    free(stringstate);
+    free(libs);
+    fclose(snapfile);
+    error(ERR_NOMEMORY);
+    return;
+  }
+  if (fread(stringstate, header.stringstatesize, 1, snapfile)!=1) goto readfail;
+/* Read the installed libraries, keeping them in the same order */
+  lastlib = NIL;
+  for (n=0; n<header.libcount; n++) {
+    if (fread(&libs[n], sizeof(snaplib), 1, snapfile)!=1 || libs[n].namelen>=FNAMESIZE) goto readfail;
+    lp = malloc(sizeof(library));
+    libbase = malloc(libs[n].libentry.libsize);
+    if (lp!=NIL) lp->libname = malloc(libs[n].namelen+1);
+    if (lp==NIL || libbase==NIL || lp->libname==NIL) goto readfail;
+    if (fread(lp->libname, 1, libs[n].namelen, snapfile)!=libs[n].namelen
+     || fread(libbase, 1, libs[n].libentry.libsize, snapfile)!=libs[n].libentry.libsize) goto readfail;
+    lp->libindex = NIL;
+    lp->libindexsize = libs[n].libentry.libindexsize;
+    if (lp->libindexsize>0) {
+      lp->libindex = malloc(lp->libindexsize*sizeof(fnprocindex));
+      if (lp->libindex==NIL
+       || fread(lp->libindex, sizeof(fnprocindex), lp->libindexsize, snapfile)!=lp->libindexsize) goto readfail;
+    }
+    lp->libname[libs[n].namelen] = asc_NUL;
+    lp->libstart = libbase;
+    lp->libsize = libs[n].libentry.libsize;
+    lp->libfplist = libs[n].libentry.libfplist;
+    lp->libfphash = libs[n].libentry.libfphash;
+    lp->libfphashmask = libs[n].libentry.libfphashmask;
+    lp->libscanned = libs[n].libentry.libscanned;
+    memcpy(lp->varlists, libs[n].libentry.varlists, sizeof(lp->varlists));
+    lp->libflink = NIL;
+    if (lastlib==NIL)
+      basicvars.installist = lp;
+    else {
+      lastlib->libflink = lp;
+    }
+    lastlib = lp;
+/* From here on 'libflink' holds the old address of the entry and 'oldlib' the new one */
+    libs[n].libentry.libflink = libs[n].oldlib;
+    libs[n].oldlib = lp;
+  }
+  size = header.vartop-basicvars.workspace;
+#if defined(TARGET_LINUX) && defined(__LP64__)
+  if (basicvars.misc_flags.usedmmap && matrixflags.hugepages!=HUGEPAGES_TLB
+   && mmap64(basicvars.workspace, ALIGNSNAP(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+    fileno(snapfile), header.imageoffset)==basicvars.workspace) {
+    basicvars.misc_flags.filemapped = 1;
+  }
+  else
+#endif
+  if (fseek(snapfile, header.imageoffset, SEEK_SET)!=0
+   || fread(basicvars.workspace, 1, size, snapfile)!=size) goto readfail;
+  size = header.bigtop-header.bigstart;
+  if (size>0 && (fseek(snapfile, header.imageoffset+ALIGNSNAP(header.vartop-basicvars.workspace), SEEK_SET)!=0
+   || fread(header.bigstart, 1, size, snapfile)!=size)) goto readfail;
+  fclose(snapfile);
+  basicvars.page = header.page;
+  basicvars.start = header.start;
+  basicvars.top = header.top;
+  basicvars.lomem = header.lomem;
+  basicvars.vartop = header.vartop;
+  basicvars.stacklimit.bytesp = basicvars.vartop+STACKBUFFER;
+  if (header.himem>basicvars.vartop+STACKBUFFER && header.himem<=basicvars.end) basicvars.himem = header.himem;
+  basicvars.bigstart = header.bigstart;
+  basicvars.bigtop = header.bigtop;
+  basicvars.liblist = header.liblist;
+  memcpy(basicvars.varlists, header.varlists, sizeof(header.varlists));
+  for (n=0; n<STDVARS; n++) basicvars.staticvars[n].varentry = header.staticvars[n].varentry;
+  memcpy(freelists, header.freelists, sizeof(freelists));
+  heapfreebytes = header.heapfreebytes;
+  heapfreecount = header.heapfreecount;
+  set_stringstate(stringstate);
+  relocate_varlists(basicvars.varlists, &header, libs, stringstate);
+  for (lp = basicvars.liblist; lp!=NIL; lp = lp->libflink) relocate_varlists(lp->varlists, &header, libs, stringstate);
+  for (lp = basicvars.installist; lp!=NIL; lp = lp->libflink) {
+    libfnproc *fpp;
+    relocate_varlists(lp->varlists, &header, libs, stringstate);
+    for (fpp = lp->libfplist; fpp!=NIL; fpp = fpp->fpflink) {
+      fpp->fpline = relocate_pointer(fpp->fpline, &header, libs);
+      fpp->fpname = relocate_pointer(fpp->fpname, &header, libs);
+      fpp->fpmarker = relocate_pointer(fpp->fpmarker, &header, libs);
+    }
+  }
+  free(libs);
+  free(stringstate);
+  basicvars.runflags.has_offsets = FALSE;
+  basicvars.runflags.linked = FALSE;
+  reset_snaprefs(basicvars.start);
+  for (lp = basicvars.installist; lp!=NIL; lp = lp->libflink) reset_snaprefs(lp->libstart);
+  basicvars.runflags.has_variables = TRUE;
+  basicvars.lastsearch = basicvars.start;
+  init_stack();
+  STRLCPY(basicvars.program, header.program, FNAMESIZE);
+  STRLCPY(entry, header.entry, MAXNAMELEN);
+  DEBUGFUNCMSGOUT;
+  return;
+
+readfail:
+  free(libs);
+  free(stringstate);
+  fclose(snapfile);
+  error(ERR_BADSNAPSHOT, name);
+}
@@ -29,14 +29,37 @@
 #include "common.h"
 
 #define STACKBUFFER 256         /* Minimum space allowed between Basic's stack and variables */
+#define BIGBLOCK 65536          /* Smallest block put above HIMEM in 'bigmem' mode */
+#define HUGEPAGESIZE 0x200000   /* Size of a huge page, also the smallest off-heap array mapped by 'map_offheap' */
+
+/* Values for matrixflags.hugepages */
+#define HUGEPAGES_NONE 0        /* Use normal pages */
+#define HUGEPAGES_THP 1         /* Ask for transparent huge pages */
+#define HUGEPAGES_TLB 2         /* Map explicit huge pages from the hugetlbfs pool */
+
+typedef struct {
+  size_t heapsize;              /* Size of heap ('vartop'-'lomem') */
+  size_t freebytes;             /* Bytes held on the free lists */
+  size_t freeblocks;            /* Number of blocks on the free lists */
+  size_t largest;               /* Size of largest free block */
+  size_t bigsize;               /* Size of large block area above HIMEM */
+  size_t bigused;               /* Bytes used in large block area */
+} heapinfo;
 
 extern boolean init_heap(void);
 extern void release_heap(void);
 extern boolean init_workspace(size_t);
 extern void release_workspace(void);
 extern void *allocmem(size_t, boolean);
-extern void freemem(void *, int32);
+extern void freemem(void *, size_t);
+extern void *allocbig(size_t, boolean);
+extern void freebig(void *, size_t);
+extern void heap_stats(heapinfo *);
+extern void *map_offheap(size_t);
+extern void unmap_offheap(void *, size_t);
 extern void clear_heap(void);
+extern void save_snapshot(char *, char *);
+extern void restore_snapshot(char *, char *);
 
 /*
 ** 'returnable' is called to check if the block at 'where' is the
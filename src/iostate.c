@@ -25,10 +25,14 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include "common.h"
 #include "target.h"
+#ifdef TARGET_UNIX
+#include <pthread.h>
+#endif
 #include "basicdefs.h"
 #include "tokens.h"
 #include "stack.h"
@@ -938,6 +942,336 @@ void exec_gcol(void) {
   DEBUGFUNCMSGOUT;
 }
 
+/*
+** The following functions deal with 'INPUT# ... LINE' and 'READ LINE',
+** which split lines of delimited text such as comma or tab separated
+** values into fields and store them straight into arrays. Numbers are
+** converted from the text of the line and only the strings stored in
+** string arrays are allocated.
+**
+** Delimiters are found by checking eight bytes of the line at a time
+** using the usual trick for finding a zero byte in a word: a byte of
+** 'word' XOR a word with the delimiter in every byte is zero only where
+** the delimiter is. Only words that contain a delimiter are looked at
+** byte by byte
+*/
+
+#define MAXDELIMS 8             /* Most delimiter characters that can be given */
+#define MAXSPLIT 64             /* Most arrays that can be given */
+#define MAXNUMLEN 128           /* Longest numeric field that will be converted */
+#define LOWBITS 0x0101010101010101ull
+#define HIGHBITS 0x8080808080808080ull
+
+typedef struct {
+  boolean isdelim[256];         /* TRUE for each character that is a delimiter */
+  uint64 patterns[MAXDELIMS];   /* Each delimiter repeated in every byte of a word */
+  int32 delimcount;             /* Number of delimiters */
+  int32 quote;                  /* Quote character or -1 if fields are not quoted */
+} splitinfo;
+
+typedef struct {
+  char *start;                  /* Start of field's text */
+  int32 length;                 /* Length of field's text */
+  int32 quotes;                 /* Number of pairs of quotes in the field that stand for one */
+} fieldinfo;
+
+typedef struct {
+  int32 type;                   /* Type of array's elements */
+  basicarray *array;            /* The array itself */
+} splittarget;
+
+/*
+** 'get_splitchars' evaluates the string expression that gives the
+** delimiters or the quote character and copies it to 'chars'. It
+** returns the number of characters
+*/
+static int32 get_splitchars(char *chars, int32 maxchars) {
+  stackitem stringtype;
+  basicstring descriptor;
+  int32 length;
+
+  expression();
+  stringtype = GET_TOPITEM;
+  if (stringtype != STACK_STRING && stringtype != STACK_STRTEMP) error(ERR_TYPESTR);
+  descriptor = pop_string();
+  length = descriptor.stringlen;
+  if (length > maxchars) length = maxchars;
+  memmove(chars, descriptor.stringaddr, length);
+  if (stringtype == STACK_STRTEMP) free_string(descriptor);
+  return length;
+}
+
+/*
+** 'get_splitinfo' deals with the optional 'BY <delimiters> [, <quote>]'
+** part of the statement. The default delimiter is a comma and fields
+** can be enclosed in double quotes. A null string as <quote> means that
+** quotes are not treated specially and a null string as <delimiters>
+** means that the whole line is one field
+*/
+static void get_splitinfo(splitinfo *sp) {
+  char delims[MAXDELIMS], quote;
+  int32 n;
+
+  delims[0] = ',';
+  sp->delimcount = 1;
+  sp->quote = '"';
+  if (*basicvars.current == BASTOKEN_BY) {
+    basicvars.current++;
+    sp->delimcount = get_splitchars(delims, MAXDELIMS);
+    if (*basicvars.current == ',') {
+      basicvars.current++;
+      sp->quote = get_splitchars(&quote, 1) == 0 ? -1 : CAST(quote, byte);
+    }
+  }
+  memset(sp->isdelim, FALSE, sizeof(sp->isdelim));
+  for (n=0; n < sp->delimcount; n++) {
+    sp->isdelim[CAST(delims[n], byte)] = TRUE;
+    sp->patterns[n] = LOWBITS*CAST(delims[n], byte);
+  }
+}
+
+/*
+** 'get_splittargets' parses the list of arrays after 'TO' and the
+** optional variable that is set to the number of elements filled. It
+** returns the number of arrays
+*/
+static int32 get_splittargets(splittarget *targets, lvalue *countvar) {
+  lvalue destination;
+  int32 count = 0;
+
+  if (*basicvars.current != BASTOKEN_TO) error(ERR_SYNTAX);
+  countvar->typeinfo = 0;
+  do {
+    basicvars.current++;        /* Skip 'TO' or ',' */
+    get_lvalue(&destination);
+    switch (destination.typeinfo) {
+    case VAR_INTARRAY: case VAR_UINT8ARRAY: case VAR_INT64ARRAY: case VAR_FLOATARRAY: case VAR_STRARRAY:
+      if (count == MAXSPLIT) error(ERR_SYNTAX);
+      targets[count].type = destination.typeinfo & ~VAR_ARRAY;
+      targets[count].array = *destination.address.arrayaddr;
+      if (targets[count].array == NIL) error(ERR_NODIMS, "(");
+      count++;
+      break;
+    default:    /* Variable for count of elements filled - Must be last */
+      if (count == 0) error(ERR_VARARRAY);
+      *countvar = destination;
+      check_ateol();
+      return count;
+    }
+  } while (*basicvars.current == ',');
+  check_ateol();
+  return count;
+}
+
+/*
+** 'find_delimiter' returns a pointer to the first delimiter in the text
+** from 'p' to 'end' or 'end' if there is not one
+*/
+static char *find_delimiter(splitinfo *sp, char *p, char *end) {
+  uint64 word, diff, found;
+  int32 n;
+
+  while (end-p >= sizeof(uint64)) {
+    memcpy(&word, p, sizeof(uint64));
+    found = 0;
+    for (n=0; n < sp->delimcount; n++) {
+      diff = word ^ sp->patterns[n];
+      found |= (diff-LOWBITS) & ~diff & HIGHBITS;
+    }
+    if (found != 0) break;      /* There is a delimiter in this word */
+    p+=sizeof(uint64);
+  }
+  while (p < end && !sp->isdelim[CAST(*p, byte)]) p++;
+  return p;
+}
+
+/*
+** 'next_field' finds the field starting at 'p' and fills in 'fp'. It
+** returns a pointer to the start of the next field or NIL if this was
+** the last field on the line. A quoted field runs to the matching quote
+** and two quotes together in it stand for one. Anything between the
+** closing quote and the next delimiter is ignored
+*/
+static char *next_field(splitinfo *sp, char *p, char *end, fieldinfo *fp) {
+  fp->quotes = 0;
+  if (sp->quote >= 0 && p < end && *p == sp->quote) {
+    p++;
+    fp->start = p;
+    while ((p = memchr(p, sp->quote, end-p)) != NIL && p+1 < end && p[1] == sp->quote) {
+      fp->quotes++;
+      p+=2;
+    }
+    if (p == NIL) p = end;      /* No closing quote - Field runs to the end of the line */
+    fp->length = p-fp->start;
+    if (p < end) p = find_delimiter(sp, p+1, end);
+  }
+  else {
+    fp->start = p;
+    p = find_delimiter(sp, p, end);
+    fp->length = p-fp->start;
+  }
+  return p == end ? NIL : p+1;
+}
+
+/*
+** 'store_field' converts field 'fp' to the type of array 'tp' and
+** stores it in element 'element'. Numbers are converted in the same
+** way as by 'VAL'. An empty field is stored as zero or a null string
+*/
+static void store_field(splittarget *tp, int32 element, fieldinfo *fp, int32 quote) {
+  char number[MAXNUMLEN], *cp;
+  boolean isint;
+  int32 intvalue, length, n;
+  int64 int64value;
+  float64 fpvalue;
+  basicstring *sp;
+
+  if (tp->type == VAR_STRINGDOL) {
+    sp = &tp->array->arraystart.stringbase[element];
+    free_string(*sp);
+    sp->stringlen = fp->length-fp->quotes;
+    sp->stringaddr = alloc_string(sp->stringlen);
+    if (fp->quotes == 0)
+      memmove(sp->stringaddr, fp->start, fp->length);
+    else {      /* Copy text, dropping one of each pair of quotes */
+      cp = sp->stringaddr;
+      for (n=0; n < fp->length; n++) {
+        *cp++ = fp->start[n];
+        if (fp->start[n] == quote) n++;
+      }
+    }
+    return;
+  }
+  length = fp->length < MAXNUMLEN-1 ? fp->length : MAXNUMLEN-1;
+  memmove(number, fp->start, length);
+  number[length] = asc_NUL;
+  if (todecimal(number, &isint, &intvalue, &int64value, &fpvalue) == NIL) error(intvalue);
+  switch (tp->type) {
+  case VAR_INTWORD:
+    tp->array->arraystart.intbase[element] = isint ? INT64TO32(int64value) : TOINT(fpvalue);
+    break;
+  case VAR_UINT8:
+    tp->array->arraystart.uint8base[element] = isint ? int64value : TOINT(fpvalue);
+    break;
+  case VAR_INTLONG:
+    tp->array->arraystart.int64base[element] = isint ? int64value : TOINT64(fpvalue);
+    break;
+  default:
+    tp->array->arraystart.floatbase[element] = isint ? TOFLOAT(int64value) : fpvalue;
+  }
+}
+
+/*
+** 'split_line' splits the line 'text' of length 'length' into fields.
+** If there is only one array the fields are stored in it one after the
+** other starting at element 'element'. Otherwise field 'n' is stored in
+** element 'element' of array 'n', fields without an array are ignored
+** and arrays without a field are set to zero or a null string. It
+** returns the number of the next element to fill
+*/
+static int32 split_line(splitinfo *sp, char *text, int32 length, splittarget *targets, int32 count, int32 element) {
+  char *p, *end;
+  fieldinfo field;
+  int32 n;
+
+  p = text;
+  end = text+length;
+  if (count == 1) {
+    while (p != NIL && element < targets[0].array->arrsize) {
+      p = next_field(sp, p, end, &field);
+      store_field(&targets[0], element, &field, sp->quote);
+      element++;
+    }
+    return element;
+  }
+  for (n=0; n < count; n++) {
+    if (p != NIL)
+      p = next_field(sp, p, end, &field);
+    else {
+      field.length = 0;
+      field.quotes = 0;
+      field.start = end;
+    }
+    if (element < targets[n].array->arrsize) store_field(&targets[n], element, &field, sp->quote);
+  }
+  return element+1;
+}
+
+/*
+** 'split_full' returns TRUE if there is no room for another line's
+** fields in the arrays
+*/
+static boolean split_full(splittarget *targets, int32 count, int32 element) {
+  int32 n;
+  for (n=0; n < count; n++) {
+    if (element < targets[n].array->arrsize) return FALSE;
+  }
+  return TRUE;
+}
+
+/*
+** 'input_fileline' deals with 'INPUT# <handle> LINE'. It reads lines
+** from the file until the end of the file is reached or the arrays are
+** full. Empty lines are skipped. On entry 'basicvars.current' points at
+** the 'LINE' token
+*/
+static void input_fileline(int32 handle) {
+  splitinfo split;
+  splittarget targets[MAXSPLIT];
+  lvalue countvar;
+  int32 count, element, length;
+  char *text;
+
+  DEBUGFUNCMSGIN;
+  basicvars.current++;          /* Skip 'LINE' */
+  get_splitinfo(&split);
+  count = get_splittargets(targets, &countvar);
+  element = 0;
+  while (!split_full(targets, count, element) && !fileio_eof(handle)) {
+    length = fileio_getdol(handle, basicvars.stringwork, &text);
+    if (length > 0) element = split_line(&split, text, length, targets, count, element);
+  }
+  if (countvar.typeinfo != 0) store_value(countvar, element, NOSTRING);
+  DEBUGFUNCMSGOUT;
+}
+
+/*
+** 'exec_readline' deals with 'READ LINE <string>', which splits the
+** string into fields in the same way as 'INPUT# <handle> LINE'. On
+** entry 'basicvars.current' points at the 'LINE' token
+*/
+void exec_readline(void) {
+  splitinfo split;
+  splittarget targets[MAXSPLIT];
+  lvalue countvar;
+  stackitem stringtype;
+  basicstring descriptor;
+  int32 count, element;
+
+  DEBUGFUNCMSGIN;
+  basicvars.current++;          /* Skip 'LINE' */
+  expression();
+  stringtype = GET_TOPITEM;
+  if (stringtype != STACK_STRING && stringtype != STACK_STRTEMP) {
+    DEBUGFUNCMSGOUT;
+    error(ERR_TYPESTR);
+    return;
+  }
+  descriptor = pop_string();
+/*
+** Split a copy of the string. A temporary string would be lost if there
+** is an error and a variable could be one of the elements being filled
+*/
+  memmove(basicvars.stringwork, descriptor.stringaddr, descriptor.stringlen);
+  if (stringtype == STACK_STRTEMP) free_string(descriptor);
+  descriptor.stringaddr = basicvars.stringwork;
+  get_splitinfo(&split);
+  count = get_splittargets(targets, &countvar);
+  element = split_line(&split, descriptor.stringaddr, descriptor.stringlen, targets, count, 0);
+  if (countvar.typeinfo != 0) store_value(countvar, element, NOSTRING);
+  DEBUGFUNCMSGOUT;
+}
+
 /*
 ** 'input_file' is called to deal with an 'INPUT#' statement which is
 ** used to read binary values from a file. On entry, 'basicvars.current'
@@ -945,18 +1279,52 @@ void exec_gcol(void) {
 **
 ** This function needs to be revised as the type checking is carried
 ** out in the 'fileio' module. It should be done here.
+**
+** Whole arrays are read in one go. 'INPUT#<handle> BY' reads numeric
+** arrays written by 'PRINT#<handle> BY', that is, as they are held in
+** memory rather than as tagged values. 'INPUT#<handle> LINE' reads
+** lines of text instead
 */
 static void input_file(void) {
   int32 handle, length;
   int64 intvalue;
   float64 floatvalue;
   char *cp;
-  boolean isint;
+  boolean isint, raw;
   lvalue destination;
+  basicarray *ap;
 
   DEBUGFUNCMSGIN;
   basicvars.current++;  /* Skip '#' token */
   handle = eval_intfactor();    /* Find handle of file */
+  if (*basicvars.current == BASTOKEN_LINE) {    /* Split lines of text into arrays */
+    input_fileline(handle);
+    DEBUGFUNCMSGOUT;
+    return;
+  }
+  raw = *basicvars.current == BASTOKEN_BY;
+  if (raw) {    /* Native format - Only whole numeric arrays can follow */
+    do {
+      basicvars.current++;      /* Skip the 'BY' or ',' token */
+      get_lvalue(&destination);
+      if (destination.typeinfo != VAR_INTARRAY && destination.typeinfo != VAR_UINT8ARRAY
+       && destination.typeinfo != VAR_INT64ARRAY && destination.typeinfo != VAR_FLOATARRAY) {
+        DEBUGFUNCMSGOUT;
+        error(ERR_NUMARRAY);
+        return;
+      }
+      ap = *destination.address.arrayaddr;
+      if (ap == NIL) {
+        DEBUGFUNCMSGOUT;
+        error(ERR_NODIMS, "(");
+        return;
+      }
+      fileio_getarraydata(handle, destination.typeinfo & ~VAR_ARRAY, ap->arraystart.arraybase, ap->arrsize);
+    } while (*basicvars.current == ',');
+    check_ateol();
+    DEBUGFUNCMSGOUT;
+    return;
+  }
   if (ateol[*basicvars.current]) {   /* Nothing to do */
     DEBUGFUNCMSGOUT;
     return;
@@ -970,6 +1338,15 @@ static void input_file(void) {
     basicvars.current++;        /* Skip the ',' token */
     get_lvalue(&destination);
     switch (destination.typeinfo & PARMTYPEMASK) {
+    case VAR_INTARRAY: case VAR_UINT8ARRAY: case VAR_INT64ARRAY: case VAR_FLOATARRAY: case VAR_STRARRAY:
+      ap = *destination.address.arrayaddr;
+      if (ap == NIL) {
+        DEBUGFUNCMSGOUT;
+        error(ERR_NODIMS, "(");
+        return;
+      }
+      fileio_getarray(handle, destination.typeinfo & ~VAR_ARRAY, ap->arraystart.arraybase, ap->arrsize);
+      break;
     case VAR_INTWORD:
       fileio_getnumber(handle, &isint, &intvalue, &floatvalue);
       *destination.address.intaddr = isint ? intvalue : TOINT(floatvalue);
@@ -1865,16 +2242,59 @@ static void print_screen(void) {
 }
 
 /*
-** 'print_file' is called to deal with the Basic 'PRINT#' statement
+** 'array_type' returns the type of the elements of an array given the
+** type of the stack entry for it
+*/
+static int32 array_type(stackitem item) {
+  switch (item) {
+  case STACK_INTARRAY: case STACK_IATEMP: return VAR_INTWORD;
+  case STACK_UINT8ARRAY: case STACK_U8ATEMP: return VAR_UINT8;
+  case STACK_INT64ARRAY: case STACK_I64ATEMP: return VAR_INTLONG;
+  case STACK_FLOATARRAY: case STACK_FATEMP: return VAR_FLOAT;
+  default: return VAR_STRINGDOL;
+  }
+}
+
+/*
+** 'print_file' is called to deal with the Basic 'PRINT#' statement.
+** Whole arrays are written in one go. 'PRINT#<handle> BY' writes
+** numeric arrays as they are held in memory rather than as tagged
+** values
 */
 static void print_file(void) {
   basicstring descriptor;
-  int32 handle;
+  basicarray *ap, temp;
+  int32 handle, n;
+  stackitem item;
   boolean more;
 
   DEBUGFUNCMSGIN;
   basicvars.current++;  /* Skip '#' token */
   handle = eval_intfactor();    /* Find handle of file */
+  if (*basicvars.current == BASTOKEN_BY) {      /* Native format - Only whole numeric arrays can follow */
+    do {
+      basicvars.current++;      /* Skip the 'BY' or ',' token */
+      expression();
+      item = GET_TOPITEM;
+      if (TOPITEMISNUMARRAY) {
+        ap = pop_array();
+        fileio_putarraydata(handle, array_type(item), ap->arraystart.arraybase, ap->arrsize);
+      }
+      else if (TOPITEMISNUMARRTEMP) {
+        temp = pop_arraytemp();
+        fileio_putarraydata(handle, array_type(item), temp.arraystart.arraybase, temp.arrsize);
+        free_stackmem();
+      }
+      else {
+        DEBUGFUNCMSGOUT;
+        error(ERR_NUMARRAY);
+        return;
+      }
+    } while (*basicvars.current == ',');
+    check_ateol();
+    DEBUGFUNCMSGOUT;
+    return;
+  }
   more = !ateol[*basicvars.current];
   while (more) {
     if (*basicvars.current != ',') {
@@ -1906,6 +2326,20 @@ static void print_file(void) {
       fileio_printstring(handle, descriptor.stringaddr, descriptor.stringlen);
       free_string(descriptor);
       break;
+    case STACK_INTARRAY: case STACK_UINT8ARRAY: case STACK_INT64ARRAY: case STACK_FLOATARRAY: case STACK_STRARRAY:
+      item = GET_TOPITEM;
+      ap = pop_array();
+      fileio_printarray(handle, array_type(item), ap->arraystart.arraybase, ap->arrsize);
+      break;
+    case STACK_IATEMP: case STACK_U8ATEMP: case STACK_I64ATEMP: case STACK_FATEMP: case STACK_SATEMP:
+      item = GET_TOPITEM;
+      temp = pop_arraytemp();
+      fileio_printarray(handle, array_type(item), temp.arraystart.arraybase, temp.arrsize);
+      if (item == STACK_SATEMP) {
+        for (n=0; n<temp.arrsize; n++) free_string(temp.arraystart.stringbase[n]);
+      }
+      free_stackmem();
+      break;
     default:
       DEBUGFUNCMSGOUT;
       error(ERR_VARNUMSTR);
@@ -2183,6 +2617,273 @@ void exec_width(void) {
 
 
 #ifndef TARGET_RISCOS
+/*
+** Text sent to a *SPOOL file or to the printer is collected in a
+** buffer and written out in large blocks instead of a character at a
+** time. The buffers are emptied when they fill up, when the file or
+** printer is closed, before a command is passed to the OS (which might
+** want to read the spool file) and when the interpreter finishes.
+** On Unix-like systems SYS "Brandy_AsyncSpool" makes a background
+** thread write out each full buffer and flush the stream while the
+** program goes on filling the other one.
+*/
+#define SPOOLBUFSIZE 65536      /* Size of each spool and printer buffer */
+
+typedef struct {
+  FILE *stream;                 /* Stream the text goes to or NIL */
+  char *fill;                   /* Buffer the program is filling */
+  int32 used;                   /* Number of bytes in 'fill' */
+#ifdef TARGET_UNIX
+  char *spare;                  /* Buffer being written by the background thread */
+  int32 pending;                /* Number of bytes in 'spare' still to be written */
+  boolean threaded;             /* TRUE if the background thread is running */
+  boolean stop;                 /* TRUE when the background thread has to finish */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;       /* Signalled when 'pending' or 'stop' changes */
+#endif
+} spoolbuffer;
+
+static spoolbuffer spoolfile, printfile;
+static boolean asyncspool;      /* TRUE if spool output is written by background threads */
+
+#ifdef TARGET_UNIX
+/*
+** 'spool_thread' is the background thread that writes out the buffers
+** of 'arg'
+*/
+static void *spool_thread(void *arg) {
+  spoolbuffer *sp = arg;
+  int32 length;
+
+  pthread_mutex_lock(&sp->lock);
+  while (sp->pending>0 || !sp->stop) {
+    if (sp->pending==0) {
+      pthread_cond_wait(&sp->changed, &sp->lock);
+      continue;
+    }
+    length = sp->pending;
+    pthread_mutex_unlock(&sp->lock);
+    fwrite(sp->spare, 1, length, sp->stream);
+    fflush(sp->stream);
+    pthread_mutex_lock(&sp->lock);
+    sp->pending = 0;
+    pthread_cond_broadcast(&sp->changed);
+  }
+  pthread_mutex_unlock(&sp->lock);
+  return NIL;
+}
+
+/*
+** 'spool_wait' waits until the background thread of 'sp' has written
+** everything handed to it. The lock must be held on entry
+*/
+static void spool_wait(spoolbuffer *sp) {
+  while (sp->pending>0) pthread_cond_wait(&sp->changed, &sp->lock);
+}
+
+/*
+** 'spool_startthread' starts the background thread for 'sp'. If the
+** thread cannot be started the output is written synchronously
+*/
+static void spool_startthread(spoolbuffer *sp) {
+  sp->spare = malloc(SPOOLBUFSIZE);
+  if (sp->spare==NIL) return;
+  sp->pending = 0;
+  sp->stop = FALSE;
+  pthread_mutex_init(&sp->lock, NIL);
+  pthread_cond_init(&sp->changed, NIL);
+  if (pthread_create(&sp->thread, NIL, spool_thread, sp)!=0) {
+    pthread_mutex_destroy(&sp->lock);
+    pthread_cond_destroy(&sp->changed);
+    free(sp->spare);
+    return;
+  }
+  sp->threaded = TRUE;
+}
+#endif
+
+/*
+** 'spool_empty' writes out the text in the buffer of 'sp'. With the
+** background thread running, the buffer is swapped with the one the
+** thread has finished with and the thread writes it instead
+*/
+static void spool_empty(spoolbuffer *sp) {
+  if (sp->used==0) return;
+#ifdef TARGET_UNIX
+  if (sp->threaded) {
+    char *p;
+    pthread_mutex_lock(&sp->lock);
+    spool_wait(sp);
+    p = sp->spare;
+    sp->spare = sp->fill;
+    sp->fill = p;
+    sp->pending = sp->used;
+    pthread_cond_broadcast(&sp->changed);
+    pthread_mutex_unlock(&sp->lock);
+    sp->used = 0;
+    return;
+  }
+#endif
+  fwrite(sp->fill, 1, sp->used, sp->stream);
+  sp->used = 0;
+}
+
+#ifdef TARGET_UNIX
+/*
+** 'spool_stopthread' writes out everything still buffered for 'sp'
+** and stops its background thread
+*/
+static void spool_stopthread(spoolbuffer *sp) {
+  spool_empty(sp);
+  pthread_mutex_lock(&sp->lock);
+  sp->stop = TRUE;
+  pthread_cond_broadcast(&sp->changed);
+  pthread_mutex_unlock(&sp->lock);
+  pthread_join(sp->thread, NIL);
+  pthread_mutex_destroy(&sp->lock);
+  pthread_cond_destroy(&sp->changed);
+  free(sp->spare);
+  sp->spare = NIL;
+  sp->threaded = FALSE;
+}
+#endif
+
+/*
+** 'spool_attach' starts buffering text for 'stream' in 'sp'. It
+** returns FALSE if there is no memory for the buffer
+*/
+static boolean spool_attach(spoolbuffer *sp, FILE *stream) {
+  if (sp->fill==NIL) {
+    sp->fill = malloc(SPOOLBUFSIZE);
+    if (sp->fill==NIL) return FALSE;
+  }
+  sp->stream = stream;
+  sp->used = 0;
+#ifdef TARGET_UNIX
+  if (asyncspool) spool_startthread(sp);
+#endif
+  return TRUE;
+}
+
+/*
+** 'spool_detach' writes out everything buffered in 'sp' and returns
+** the stream it was going to, ready to be closed
+*/
+static FILE *spool_detach(spoolbuffer *sp) {
+  FILE *stream = sp->stream;
+#ifdef TARGET_UNIX
+  if (sp->threaded) spool_stopthread(sp);
+#endif
+  spool_empty(sp);
+  sp->stream = NIL;
+  return stream;
+}
+
+/*
+** 'spool_add' adds 'length' bytes of text at 'text' to the buffer of 'sp'
+*/
+static void spool_add(spoolbuffer *sp, char *text, int32 length) {
+  int32 count;
+  while (length>0) {
+    if (sp->used==SPOOLBUFSIZE) spool_empty(sp);
+    count = SPOOLBUFSIZE-sp->used;
+    if (count>length) count = length;
+    memcpy(sp->fill+sp->used, text, count);
+    sp->used+=count;
+    text+=count;
+    length-=count;
+  }
+}
+
+/*
+** 'spool_flush' pushes everything buffered in 'sp' out to its stream
+*/
+static void spool_flush(spoolbuffer *sp) {
+  if (sp->stream==NIL) return;
+  spool_empty(sp);
+#ifdef TARGET_UNIX
+  if (sp->threaded) {
+    pthread_mutex_lock(&sp->lock);
+    spool_wait(sp);
+    pthread_mutex_unlock(&sp->lock);
+    return;
+  }
+#endif
+  fflush(sp->stream);
+}
+
+/*
+** 'start_spool' starts sending text output to the *SPOOL file 'stream'
+*/
+void start_spool(FILE *stream) {
+  DEBUGFUNCMSGIN;
+  if (!spool_attach(&spoolfile, stream)) {
+    fclose(stream);
+    error(ERR_NOROOM);
+  }
+  matrixflags.dospool = stream;
+  DEBUGFUNCMSGOUT;
+}
+
+/*
+** 'end_spool' writes out anything buffered for the *SPOOL file and
+** closes it
+*/
+void end_spool(void) {
+  DEBUGFUNCMSGIN;
+  if (matrixflags.dospool) fclose(spool_detach(&spoolfile));
+  matrixflags.dospool = NULL;
+  DEBUGFUNCMSGOUT;
+}
+
+/*
+** 'spool_character' adds character 'ch' to the *SPOOL file output.
+** Only called when a *SPOOL file is open
+*/
+void spool_character(int32 ch) {
+  if (spoolfile.used==SPOOLBUFSIZE) spool_empty(&spoolfile);
+  spoolfile.fill[spoolfile.used++] = ch;
+}
+
+/*
+** 'spool_text' adds 'length' characters at 'text' to the *SPOOL file
+** output. Only called when a *SPOOL file is open
+*/
+void spool_text(char *text, int32 length) {
+  spool_add(&spoolfile, text, length);
+}
+
+/*
+** 'flush_spool' writes out everything buffered for the *SPOOL file and
+** the printer
+*/
+void flush_spool(void) {
+  spool_flush(&spoolfile);
+  spool_flush(&printfile);
+}
+
+/*
+** 'async_spool' turns the background writing of *SPOOL and printer
+** output on or off. It returns TRUE if background writing is on
+*/
+boolean async_spool(boolean on) {
+#ifdef TARGET_UNIX
+  spoolbuffer *sp;
+  int n;
+  asyncspool = on;
+  for (n=0; n<2; n++) {
+    sp = n==0 ? &spoolfile : &printfile;
+    if (sp->stream==NIL) continue;
+    if (on && !sp->threaded) spool_startthread(sp);
+    else if (!on && sp->threaded) spool_stopthread(sp);
+  }
+  return asyncspool;
+#else
+  return FALSE;
+#endif
+}
+
 /* little routines for opening a connection to the printer.
 ** Not used on RISC OS, this will only work on Linux/UNIX
 ** with CUPS installed, and are a no-op on other platforms.
@@ -2190,8 +2891,13 @@ void exec_width(void) {
 void open_printer(void) {
   DEBUGFUNCMSGIN;
 #ifdef TARGET_UNIX
-  matrixflags.printer = popen("lpr -o document-format='text/plain'","w");
-  if (!matrixflags.printer) error(ERR_PRINTER);
+  FILE *printer = popen("lpr -o document-format='text/plain'","w");
+  if (!printer) error(ERR_PRINTER);
+  if (!spool_attach(&printfile, printer)) {
+    pclose(printer);
+    error(ERR_NOROOM);
+  }
+  matrixflags.printer = printer;
 #endif
   DEBUGFUNCMSGOUT;
 }
@@ -2199,21 +2905,39 @@ void open_printer(void) {
 void close_printer(void) {
   DEBUGFUNCMSGIN;
 #ifdef TARGET_UNIX
-  if (matrixflags.printer) pclose(matrixflags.printer);
+  if (matrixflags.printer) pclose(spool_detach(&printfile));
   matrixflags.printer = NULL;
 #endif
   DEBUGFUNCMSGOUT;
 }
 
+/* Send the character to the printer as it is (VDU 1). */
+void printout_byte(int32 ch) {
+  if (printfile.used==SPOOLBUFSIZE) spool_empty(&printfile);
+  printfile.fill[printfile.used++] = ch;
+}
+
 /* Only called when we have the handle.
 ** Send the character to the stream if not the ignored character.
  */
 void printout_character(int32 ch) {
-  DEBUGFUNCMSGIN;
-#ifdef TARGET_UNIX
-  if (ch == matrixflags.printer_ignore) return;
-  fputc(ch, matrixflags.printer);
-#endif
-  DEBUGFUNCMSGOUT;
+  if (ch != matrixflags.printer_ignore) printout_byte(ch);
+}
+
+/* As printout_character, but for 'length' characters at 'text'. */
+void printout_text(char *text, int32 length) {
+  int32 n, start = 0;
+  for (n=0; n<length; n++) {
+    if (CAST(text[n], byte) == matrixflags.printer_ignore) {
+      spool_add(&printfile, text+start, n-start);
+      start = n+1;
+    }
+  }
+  spool_add(&printfile, text+start, length-start);
+}
+#else
+/* *SPOOL and the printer are handled by RISC OS itself */
+boolean async_spool(boolean on) {
+  return FALSE;
 }
 #endif /* ! TARGET_RISCOS */
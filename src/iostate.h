@@ -49,6 +49,7 @@ extern void exec_origin(void);
 extern void exec_plot(void);
 extern void exec_point(void);
 extern void exec_print(void);
+extern void exec_readline(void);
 extern void exec_rectangle(void);
 extern void exec_sound(void);
 extern void exec_stereo(void);
@@ -61,5 +62,13 @@ extern void exec_width(void);
 extern void open_printer(void);
 extern void close_printer(void);
 extern void printout_character(int32);
+extern void printout_text(char *, int32);
+extern void printout_byte(int32);
+extern void start_spool(FILE *);
+extern void end_spool(void);
+extern void spool_character(int32);
+extern void spool_text(char *, int32);
+extern void flush_spool(void);
+extern boolean async_spool(boolean);
 
 #endif
@@ -506,6 +506,7 @@ static int32 holdstack[8];      /* Hold stack - Characters waiting to be passed
 
 #define INKEYMAX 0x7FFF         /* Maximum wait time for INKEY                          */
 #define WAITTIME 10             /* Time to wait in centiseconds when dealing with ANSI key sequences */
+#define INBUFSIZE 65536        /* Size of stdin buffer used in batch mode              */
 
 /* fn_string and fn_string_count are used when expanding a function key string.
 ** Effectively input switches to the string after a function key with a string
@@ -622,6 +623,12 @@ boolean kbd_init() {
 
 /* Set up keyboard for unbuffered I/O */
   keyboard = fileno(stdin);
+  if (basicvars.runflags.batch) {       /* Batch mode - stdin is only ever read as a file */
+    nokeyboard=1;
+    basicvars.runflags.inredir = TRUE;
+    setvbuf(stdin, NIL, _IOFBF, INBUFSIZE);
+    return TRUE;
+  }
   if (tcgetattr(keyboard, &tty) < 0) {          /* Could not obtain keyboard parameters */
     nokeyboard=1;
 /* tcgetattr() returned an error. If the error is ENOTTY then stdin does not point at
@@ -672,7 +679,7 @@ void kbd_quit() {
 #ifdef TARGET_UNIX
   // Unix target - restore console settings
   // --------------------------------------
-  (void) tcsetattr(keyboard, TCSADRAIN, &origtty);
+  if (!nokeyboard) (void) tcsetattr(keyboard, TCSADRAIN, &origtty);
 #endif /* UNIX */
 
 #ifdef TARGET_AMIGA
@@ -954,6 +961,7 @@ int32 kbd_inkey(int32 arg) {
       || matrixflags.doexec                     /*  or *EXEC file active                */
       || fn_string_count) return kbd_get();     /*  or function key active              */
     if (holdcount > 0) return pop_key() & 0xFF; /* Character waiting so return it       */
+    fflush(stdout);                             /* Output may be waiting in the buffer  */
     if (waitkey(arg))  return kbd_get() & 0xFF; /* Wait for keypress and return it      */
     else               return -1;               /* Otherwise return -1 for nothing      */
 
@@ -1138,6 +1146,7 @@ int32 kbd_get(void) {
   }
 
   if (basicvars.runflags.inredir) {             /* Input redirected at command line     */
+    fflush(stdout);                             /* Output may be waiting in the buffer  */
 #if defined(TARGET_UNIX) || defined(CYGWINBUILD)
     if ((ch=getchar()) != EOF) return ch;
 #else
@@ -1979,6 +1988,7 @@ readstate emulate_readline(char buffer[], int32 length, int32 echochar) {
 
   if (basicvars.runflags.inredir) {     /* There is no keyboard to read - Read from file stdin */
     char *p;
+    fflush(stdout);                     /* Output may be waiting in the buffer */
     p = fgets(buffer, length, stdin);   /* Get all in one go */
     if (p == NIL) {                     /* Call failed */
       if (ferror(stdin)) {
@@ -48,6 +48,7 @@
 #include "screen.h"
 #include "lvalue.h"
 #include "fileio.h"
+#include "iostate.h"
 #include "mainstate.h"
 #include "keyboard.h"
 #include "mos_sys.h"
@@ -329,6 +330,8 @@ void exec_xcase(void) {
   }
 /* Create 'CASE' table */
   cp = allocmem(sizeof(casetable)+whencount*sizeof(whenvalue), 1);      /* Hacksville, Tennessee */
+  cp->caseflink = basicvars.caselist;
+  basicvars.caselist = cp;
   cp->whencount = whencount;
   cp->defaultaddr = defaultaddr;
   for (n=0; n<whencount; n++) cp->whentable[n] = whentable[n];
@@ -534,18 +537,26 @@ static void define_byte_array(variable *vp, boolean offheap) {
 #endif
       } else {
 #ifdef MATRIX64BIT
-        if ((vp->varflags == VAR_INTWORD) && ((int64)(basicvars.stacklimit.bytesp+highindex+1) > 0xFFFFFFFFll)) {
+        if ((vp->varflags == VAR_INTWORD) && highindex+1 < BIGBLOCK && ((int64)(basicvars.stacklimit.bytesp+highindex+1) > 0xFFFFFFFFll)) {
           DEBUGFUNCMSGOUT;
           error(ERR_ADDRESS);
           return;
         }
 #endif
-        ep = allocmem(highindex+1, 0);
+        ep = allocbig(highindex+1, 0);
         if (ep == NIL) {      /* Not enough memory left */
           DEBUGFUNCMSGOUT;
           error(ERR_BADBYTEDIM, vp->varname);
           return;
         }
+#ifdef MATRIX64BIT
+        if ((vp->varflags == VAR_INTWORD) && ((int64)(ep+highindex+1) > 0xFFFFFFFFll)) {
+          freebig(ep, highindex+1);   /* Can't store the address in the variable type given */
+          DEBUGFUNCMSGOUT;
+          error(ERR_ADDRESS);
+          return;
+        }
+#endif
       }
     }
   }
@@ -567,7 +578,7 @@ static void define_byte_array(variable *vp, boolean offheap) {
 void exec_dim(void) {
   byte *base, *ep;
   variable *vp;
-  boolean offheap = 0;          /* TRUE if allocating a block of memory off the heap */
+  int32 offheap = OFFHEAP_NONE; /* OFFHEAP_MALLOC if allocating memory off the heap */
   boolean blockdef;             /* TRUE if we are allocating a block of memory and not creating an array */
 
   DEBUGFUNCMSGIN;
@@ -576,7 +587,7 @@ void exec_dim(void) {
     basicvars.current++;        /* Skip 'DIM' token or ',' */
     /* Is the next token HIMEM? If so we're doing an off-heap memory block */
     if ((*basicvars.current == 0xFF) && (*(basicvars.current+1) == BASTOKEN_HIMEM)) {
-      offheap = TRUE;
+      offheap = OFFHEAP_MALLOC;
       basicvars.current+=2;
     }
 /* Must always have a variable name next */
@@ -2537,6 +2548,11 @@ void exec_read(void) {
 
   DEBUGFUNCMSGIN;
   basicvars.current++;                      /* Skip READ */
+  if (*basicvars.current == BASTOKEN_LINE) {  /* 'READ LINE' splits a string into arrays */
+    exec_readline();
+    DEBUGFUNCMSGOUT;
+    return;
+  }
   if (ateol[*basicvars.current]) {          /* Return if there is nothing to do */
     DEBUGFUNCMSGOUT;
     return;
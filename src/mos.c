@@ -82,6 +82,8 @@
 #include "screen.h"
 #include "keyboard.h"
 #include "miscprocs.h"
+#include "heap.h"
+#include "iostate.h"
 
 #ifdef TARGET_RISCOS
 #include "kernel.h"
@@ -168,11 +170,20 @@ char mos_patchdate[]=__DATE__;
 #endif
 
 static void show_meminfo() {
+  heapinfo heap;
+
   emulate_printf("\r\nMemory allocation information:\r\n");
   emulate_printf("  Workspace is at &" FMT_SZX ", size is &" FMT_SZX "\r\n  PAGE = &" FMT_SZX ", HIMEM = &" FMT_SZX "\r\n",
   basicvars.workspace, basicvars.worksize, basicvars.page, basicvars.himem);
   emulate_printf("  stacktop = &" FMT_SZX ", stacklimit = &" FMT_SZX "\r\n", basicvars.stacktop.bytesp, basicvars.stacklimit.bytesp);
   emulate_printf("  Internal recursion limit = %d, current = %d\r\n", basicvars.maxrecdepth, basicvars.recdepth);
+  heap_stats(&heap);
+  emulate_printf("  Heap is " FMT_SZD " bytes, " FMT_SZD " bytes in use, " FMT_SZD " bytes free in " FMT_SZD " blocks\r\n",
+  heap.heapsize, heap.heapsize-heap.freebytes, heap.freebytes, heap.freeblocks);
+  if (heap.freebytes>0) emulate_printf("  Largest free block is " FMT_SZD " bytes, fragmentation %d%%\r\n",
+  heap.largest, (int)(100-heap.largest*100/heap.freebytes));
+  if (heap.bigsize>0) emulate_printf("  Large block area at &" FMT_SZX ", " FMT_SZD " of " FMT_SZD " bytes in use\r\n",
+  basicvars.bigstart, heap.bigused, heap.bigsize);
 #ifdef USE_SDL
   emulate_printf("  Video frame buffer is at &" FMT_SZX ", size &%X\r\n", matrixflags.modescreen_ptr, matrixflags.modescreen_sz);
   emulate_printf("  MODE 7 Teletext frame buffer is at &" FMT_SZX "\r\n", MODE7FB);
@@ -1315,6 +1326,8 @@ static unsigned int cmd_parse_num(char** text) {
 #define CMD_VOICES          31
 #define CMD_POINTER         32
 #define CMD_BRANDYINFO      33
+#define CMD_DELETE          34
+#define CMD_SNAPSHOT        35
 #define HELP_BASIC        1024
 #define HELP_HOST         1025
 #define HELP_MOS          1026
@@ -1406,6 +1419,8 @@ void make_cmdtab(){
   add_cmd( "load",         CMD_LOAD         );
   add_cmd( "save",         CMD_SAVE         );
   add_cmd( "brandyinfo",   CMD_BRANDYINFO   );
+  add_cmd( "delete",       CMD_DELETE       );
+  add_cmd( "snapshot",     CMD_SNAPSHOT     );
 #ifdef USE_SDL
   add_cmd( "volume",       CMD_VOLUME       );
   add_cmd( "channelvoice", CMD_CHANNELVOICE );
@@ -1723,6 +1738,7 @@ static void cmd_help(char *command)
     case HELP_HOST:
     case HELP_MOS:
       emulate_printf("  CD      <dir>\r\n");
+      emulate_printf("  DELETE  <filename>\r\n");
       emulate_printf("  EXEC    (<filename>)\r\n");
       emulate_printf("  FX      <num>(,<num>(,<num>))\r\n");
       emulate_printf("  HELP    (<text>)\r\n");
@@ -1744,6 +1760,7 @@ static void cmd_help(char *command)
       emulate_printf("  ScreenLoad <filename.bmp>\r\n");
       emulate_printf("  ScreenSave <filename.bmp>\r\n");
 #endif /* USE_SDL */
+      emulate_printf("  Snapshot   <filename> (<PROCname>)\r\n");
       emulate_printf("  WinTitle   <window title>\r\n");
       break;
     case HELP_MEMINFO:
@@ -1761,6 +1778,12 @@ static void cmd_help(char *command)
       emulate_printf("Syntax: *WinTitle <window title>\r\n");
       emulate_printf("  This command sets the text on the SDL or xterm window title bar.\r\n");
       break;
+    case CMD_SNAPSHOT:
+      emulate_printf("Syntax: *Snapshot <filename> (<PROCname>)\r\n");
+      emulate_printf("  This saves the program, its variables and installed libraries in a file\r\n");
+      emulate_printf("  that can be restored with the -restore option. If a procedure is named\r\n");
+      emulate_printf("  it is called when the snapshot is restored.\r\n");
+      break;
 #ifdef USE_SDL
     case CMD_FULLSCREEN:
       emulate_printf("Syntax: *FullScreen (<On|Off|1|0>)\r\n");
@@ -1913,22 +1936,38 @@ static void cmd_exec(char *command) {
 }
 
 static void cmd_spool(char *command, int append) {
+  FILE *spoolfile;
   while (*command == ' ') command++;            // Skip spaces
   if (*command == 0) {
-    if (matrixflags.dospool) fclose(matrixflags.dospool);
-    matrixflags.dospool=NULL;
+    end_spool();
   } else {
     if ((command[0] == '"') && (command[strlen(command)-1] == '"')) {
       command[strlen(command)-1] = '\0';
       command++;
     }
+    end_spool();
     if (append) {
-      matrixflags.dospool=fopen(command, "a");
+      spoolfile=fopen(command, "a");
     } else {
-      matrixflags.dospool=fopen(command, "w");
+      spoolfile=fopen(command, "w");
     }
-    if (!matrixflags.dospool) error(ERR_CANTWRITE, command);
+    if (!spoolfile) error(ERR_CANTWRITE, command);
+    start_spool(spoolfile);
+  }
+}
+
+/*
+ * *DELETE <filename>
+ * Delete a file
+ */
+static void cmd_delete(char *command) {
+  while (*command == ' ') command++;            // Skip spaces
+  if ((command[0] == '"') && (command[strlen(command)-1] == '"')) {
+    command[strlen(command)-1] = '\0';
+    command++;
   }
+  if (*command == 0) error(ERR_BADSYNTAX, "DELETE <filename>");
+  else if (remove(command)) error(ERR_NOTFOUND, command);
 }
 
 /*
@@ -2060,6 +2099,31 @@ static void cmd_save(char *command){
   fclose(filep);
 }
 
+/*
+** '*Snapshot' saves the state of the Basic program so that it can
+** be restored with the '-restore' option. It is followed by the name
+** of the file and, optionally, the procedure to call on restoring it
+*/
+static void cmd_snapshot(char *command){
+  int len;
+  char chbuff[256], entry[MAXNAMELEN], *ptr;
+
+  while(*command == ' ' || *command == '\t') command++;
+  for (len=0; len<255 && command[len] > ' '; len++) chbuff[len] = command[len];
+  chbuff[len] = '\0';
+  strip_quotes(chbuff);
+  if (len == 0) {
+    emulate_printf("Syntax: Snapshot <filename> (<PROCname>)\r\n");
+    return;
+  }
+  ptr = &command[len];
+  while(*ptr == ' ' || *ptr == '\t') ptr++;
+  if (!strncmp(ptr, "PROC", 4)) ptr+=4;
+  for (len=0; len<MAXNAMELEN-1 && ptr[len] > ' '; len++) entry[len] = ptr[len];
+  entry[len] = '\0';
+  save_snapshot(chbuff, entry);
+}
+
 static void cmd_volume(char *command){
 #ifdef USE_SDL
   int ch,v;
@@ -2164,6 +2228,8 @@ void mos_oscli(char *command, char *respfile, FILE *respfh) {
       case CMD_NEWMODE:      cmd_newmode(command+7); return;
       case CMD_REFRESH:      cmd_refresh(command+7); return;
       case CMD_BRANDYINFO:   cmd_brandyinfo(); return;
+      case CMD_DELETE:       cmd_delete(command+6); return;
+      case CMD_SNAPSHOT:     cmd_snapshot(command+8); return;
 
       case CMD_LOAD:         cmd_load(command+4); return;
       case CMD_SAVE:         cmd_save(command+4); return;
@@ -2284,6 +2350,7 @@ static void native_oscli(char *command, char *respfile, FILE *respfh) {
   cmdbufbase=malloc(clen);
   cmdbuf=cmdbufbase;
   memcpy(cmdbuf, command, strlen(command)+1);
+  flush_spool();                        /* The command might read the spool file */
 
 #if defined(TARGET_DJGPP) | defined(TARGET_WIN32)
 /* Command is to be sent to underlying DOS-style OS */
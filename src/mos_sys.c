@@ -43,6 +43,8 @@
 #include "screen.h"
 #include "keyboard.h"
 #include "miscprocs.h"
+#include "fileio.h"
+#include "iostate.h"
 #ifdef USE_SDL
 #include "SDL.h"
 #include "SDL_syswm.h"
@@ -420,6 +422,35 @@ void mos_sys_ext(size_t swino, sysparm inregs[], size_t outregs[], int32 xflag,
           return;
       }
       break;
+    case SWI_OS_GBPB:
+// R0=reason: 1/2 = write, 3/4 = read, 1/3 at the file pointer in R4, 2/4 at the current one
+// R1=file handle
+// R2=address of the block (for the data of an array, ](PTR(array())+8))
+// R3=number of bytes to transfer
+// R4=file pointer (reasons 1 and 3)
+// On exit, R2 = address after the block, R3 = bytes not transferred, R4 = file pointer
+// The block has to be in the Basic workspace
+      outregs[0]=inregs[0].i;outregs[1]=inregs[1].i;
+      if (inregs[0].i < 1 || inregs[0].i > 4 || (int64)inregs[3].i < 0 || (int32)inregs[3].i != (int64)inregs[3].i) {
+        error(ERR_BAD_OSGBPB);
+        return;
+      }
+      if (inregs[2].i < (size_t)basicvars.workspace || inregs[2].i-(size_t)basicvars.workspace > basicvars.worksize
+       || inregs[3].i > basicvars.worksize-(inregs[2].i-(size_t)basicvars.workspace)) {
+        error(ERR_ADDREXCEPT);
+        return;
+      }
+      if (inregs[0].i == 1 || inregs[0].i == 3) fileio_setptr(inregs[1].i, inregs[4].i);
+      if (inregs[0].i <= 2) {
+        fileio_putblock(inregs[1].i, (void *)(size_t)inregs[2].i, inregs[3].i);
+        b = inregs[3].i;
+      } else {
+        b = fileio_getblock(inregs[1].i, (void *)(size_t)inregs[2].i, inregs[3].i);
+      }
+      outregs[2]=inregs[2].i+b;
+      outregs[3]=inregs[3].i-b;
+      outregs[4]=fileio_getptr(inregs[1].i);
+      break;
     case SWI_OS_ReadLine:
 // RISC OS method is to tweek entry parameters then drop into ReadLine32
 // R0=b31-b28=flags, b27-b0=address
@@ -826,6 +857,16 @@ void mos_sys_ext(size_t swino, sysparm inregs[], size_t outregs[], int32 xflag,
     case SWI_Brandy_AllowLowercase:
       matrixflags.lowercasekeywords = inregs[0].i;
       break;
+    case SWI_Brandy_AsyncFile:
+      outregs[0]=fileio_async(inregs[0].i, inregs[1].i != 0);
+      break;
+    case SWI_Brandy_AsyncSpool:
+      outregs[0]=async_spool(inregs[0].i != 0);
+      break;
+    case SWI_Brandy_CompressedFiles:
+      outregs[0]=matrixflags.compressedfiles;
+      matrixflags.compressedfiles = inregs[0].i != 0;
+      break;
 // Raspberry Pi GPIO stuff below
     case SWI_RaspberryPi_GPIOInfo:
       outregs[0]=matrixflags.gpio; outregs[1]=(size_t)matrixflags.gpiomem;
@@ -45,6 +45,7 @@ typedef struct {
 #define SWI_OS_Byte                           0x06
 #define SWI_OS_Word                           0x07
 #define SWI_OS_File                           0x08
+#define SWI_OS_GBPB                           0x0C
 #define SWI_OS_ReadLine                       0x0E
 #define SWI_OS_GetEnv                         0x10
 #define SWI_OS_UpdateMEMC                     0x1A
@@ -133,6 +134,9 @@ typedef struct {
 #define SWI_Brandy_TranslateFNames            0x140017
 #define SWI_Brandy_MemSet                     0x140018
 #define SWI_Brandy_AllowLowercase             0x140019
+#define SWI_Brandy_AsyncFile                  0x14001A
+#define SWI_Brandy_AsyncSpool                 0x14001B
+#define SWI_Brandy_CompressedFiles            0x14001C
 
 #define SWI_RaspberryPi_GPIOInfo                  0x140100
 #define SWI_RaspberryPi_GetGPIOPortMode           0x140101
@@ -151,6 +155,7 @@ static switable swilist[] = {
   {SWI_OS_Byte,                               "OS_Byte"},
   {SWI_OS_Word,                               "OS_Word"},
   {SWI_OS_File,                               "OS_File"},
+  {SWI_OS_GBPB,                               "OS_GBPB"},
   {SWI_OS_ReadLine,                           "OS_ReadLine"},
   {SWI_OS_GetEnv,                             "OS_GetEnv"},
   {SWI_OS_UpdateMEMC,                         "OS_UpdateMEMC"}, /* Recognised, does nothing */
@@ -236,6 +241,9 @@ static switable swilist[] = {
   {SWI_Brandy_TranslateFNames,                "Brandy_TranslateFNames"},
   {SWI_Brandy_MemSet,                         "Brandy_MemSet"},
   {SWI_Brandy_AllowLowercase,                 "Brandy_AllowLowercase"},
+  {SWI_Brandy_AsyncFile,                      "Brandy_AsyncFile"},
+  {SWI_Brandy_AsyncSpool,                     "Brandy_AsyncSpool"},
+  {SWI_Brandy_CompressedFiles,                "Brandy_CompressedFiles"},
 
   {SWI_RaspberryPi_GPIOInfo,                  "RaspberryPi_GPIOInfo"},
   {SWI_RaspberryPi_GetGPIOPortMode,           "RaspberryPi_GetGPIOPortMode"},
@@ -41,6 +41,10 @@
 #include "screen.h"
 #include "iostate.h"
 
+#ifdef TARGET_UNIX
+#include <unistd.h>
+#endif
+
 /*
 ** Notes
 ** -----
@@ -58,8 +62,18 @@
 **  The most important function is 'emulate_vdu'. All text output
 **  and any VDU commands go via this function. It corresponds to the
 **  SWI OS_WriteC.
+**
+**  When output is going to a file or a pipe rather than the screen,
+**  stdout is given a large buffer and is only flushed before the
+**  interpreter waits for keyboard input, when a command is run and at
+**  the end of the run. Strings are sent straight to stdout in one go
+**  as far as the next control character.
 */
 
+#define OUTBUFSIZE 65536        /* Size of stdout buffer when output is redirected */
+
+static boolean bufferedout;     /* TRUE if stdout is not the screen and so is fully buffered */
+
 static unsigned int vduflag(unsigned int flags) {
   return (vduflags & flags) ? 1 : 0;
 }
@@ -68,6 +82,14 @@ static void write_vduflag(unsigned int flags, int yesno) {
   vduflags = yesno ? vduflags | flags : vduflags & ~flags;
 }
 
+/*
+** 'flush_screen' flushes the output written so far if it is going
+** to the screen. Redirected output is left in the buffer
+*/
+static void flush_screen(void) {
+  if (!bufferedout) fflush(stdout);
+}
+
 /*
 ** 'find_cursor' ensures that the position of the text cursor
 ** is known and valid as far as the interpreter is concerned  
@@ -86,7 +108,7 @@ void set_cursor(boolean underline) {
 */
 void echo_on(void) {
   write_vduflag(VDU_FLAG_ECHO,1);
-  fflush(stdout);
+  flush_screen();
 }
 
 /*
@@ -97,7 +119,7 @@ void echo_off(void) {
 }
 
 static void printer_char(void) {
-  if (matrixflags.printer) fputc(vduqueue[0], matrixflags.printer);
+  if (matrixflags.printer) printout_byte(vduqueue[0]);
 }
 
 /*
@@ -117,18 +139,18 @@ static void nogo(void) {
 */
 void emulate_vdu(int32 charvalue) {
   charvalue = charvalue & BYTEMASK;     /* Deal with any signed char type problems */
-  if (matrixflags.dospool) fputc(charvalue, matrixflags.dospool);
+  if (matrixflags.dospool) spool_character(charvalue);
   if (matrixflags.printer) printout_character(charvalue);
   if (vduneeded==0) {                   /* VDU queue is empty */
     if (charvalue == 127) charvalue=8;  /* DEL maps to BACKSPACE */
     if (charvalue>=' ') {               /* Most common case - print something */
       if (charvalue==DEL) charvalue = ' ';
       putchar(charvalue);
-      if (vduflag(VDU_FLAG_ECHO)) fflush(stdout);
+      if (vduflag(VDU_FLAG_ECHO)) flush_screen();
       return;
     }
     else {      /* Control character - Found start of new VDU command */
-      if (!vduflag(VDU_FLAG_ECHO)) fflush(stdout);
+      if (!vduflag(VDU_FLAG_ECHO)) flush_screen();
       vducmd = charvalue;
       vduneeded = vdubytes[charvalue];
       vdunext = 0;
@@ -193,14 +215,40 @@ void emulate_vdu(int32 charvalue) {
   }
 }
 
+/*
+** 'send_text' sends 'length' characters at 'text' to the VDU driver.
+** Runs of printable characters met when no VDU command is in progress
+** are written directly, which has the same effect as passing them to
+** 'emulate_vdu' one at a time
+*/
+static void send_text(char *text, int32 length) {
+  int32 n, run;
+
+  n = 0;
+  while (n<length) {
+    run = 0;
+    if (vduneeded==0) {
+      while (n+run<length && CAST(text[n+run], byte)>=' ' && CAST(text[n+run], byte)!=DEL) run++;
+    }
+    if (run==0) {       /* Control character or part of a VDU command */
+      emulate_vdu(text[n]);
+      n++;
+      continue;
+    }
+    if (matrixflags.dospool) spool_text(text+n, run);
+    if (matrixflags.printer) printout_text(text+n, run);
+    fwrite(text+n, 1, run, stdout);
+    n+=run;
+  }
+}
+
 /*
 ** 'emulate_vdustr' is called to print a string via the 'VDU driver'
 */
 void emulate_vdustr(char string[], int32 length) {
-  int32 n;
   if (length==0) length = strlen(string);
   echo_off();
-  for (n=0; n<length; n++) emulate_vdu(string[n]);      /* Send the string to the VDU driver */
+  send_text(string, length);    /* Send the string to the VDU driver */
   echo_on();
 }
 
@@ -214,12 +262,12 @@ void emulate_printf(char *format, ...) {
   int32 length;
   va_list parms;
   char text [MAXSTRING];
-  int n;
   va_start(parms, format);
   length = vsnprintf(text, MAXSTRING, format, parms);
   va_end(parms);
+  if (length>=MAXSTRING) length = MAXSTRING-1;  /* Output was truncated */
   echo_off();
-  for (n = 0; n < length; n++) emulate_vdu(text[n]);
+  send_text(text, length);
   echo_on();
 }
 
@@ -471,6 +519,12 @@ void emulate_origin(int32 x, int32 y) {
 ** interpreter to run)
 */
 boolean init_screen(void) {
+#ifdef TARGET_UNIX
+  bufferedout = basicvars.runflags.batch || !isatty(fileno(stdout));
+#else
+  bufferedout = basicvars.runflags.batch;
+#endif
+  if (bufferedout) setvbuf(stdout, NIL, _IOFBF, OUTBUFSIZE);
   screenmode = USERMODE;
   vdunext = 0;
   vduneeded = 0;
@@ -482,6 +536,7 @@ boolean init_screen(void) {
 ** of the run
 */
 void end_screen(void) {
+  fflush(stdout);
 }
 
 int32 get_character_at_pos(int32 cx, int32 cy) {
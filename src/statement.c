@@ -456,6 +456,29 @@ void exec_fnstatements(byte *lp) {
   DEBUGFUNCMSGOUT;
 }
 
+/*
+** 'exec_batchstatements' is the statement execution loop used in
+** batch mode. There is no keyboard to press Escape on so the check
+** for it is left out, and the number of statements run is counted
+** for the report given when the interpreter finishes. Statement
+** separators and line ends are not counted, nor are statements in
+** functions, which are run by 'exec_fnstatements'
+*/
+static void exec_batchstatements(void) {
+  byte token;
+
+  do {
+#ifdef USE_SDL
+    if (tmsg.bailout != -1) {
+      while(TRUE) sleep(10); /* Stop processing while threads are stopped */
+    }
+#endif
+    token = *basicvars.current;
+    if (token!=':' && token!=' ' && token!=asc_NUL) basicvars.statements++;
+    (*statements[token])();     /* Dispatch a statement */
+  } while (TRUE);
+}
+
 /*
 ** 'exec_statements' deals with the statements in either a procedure
 ** or the main program
@@ -464,6 +487,7 @@ static void exec_statements(byte *lp) {
   basicvars.current = lp;
 
   DEBUGFUNCMSGIN;
+  if (basicvars.runflags.batch) exec_batchstatements();
   do {  /* This is the main statement execution loop */
 #ifdef USE_SDL
     if (tmsg.bailout != -1) {
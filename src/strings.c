@@ -384,6 +384,51 @@ void clear_strings(void) {
 #endif
 }
 
+/*
+** 'get_stringstate' and 'set_stringstate' are used when a snapshot of
+** the workspace is saved and restored (see heap.c). The free string
+** lists are kept with the workspace image, along with the address of
+** 'emptystring' so that strings that point at it can be fixed up by
+** 'relocate_strings' if the interpreter is loaded at another address.
+** 'get_stringstate' returns the size of the state, copying it to 'state'
+** if this is not NIL
+*/
+typedef struct {
+  int32 freestrings;                    /* Number of free strings in bins */
+  heapblock *binlists[BINCOUNT];        /* Free memory block bins */
+  heapblock *freelist;                  /* List of free blocks not in bins */
+  char *emptyaddr;                      /* Address of 'emptystring' */
+} stringstate;
+
+size_t get_stringstate(void *state) {
+  stringstate *sp = CAST(state, stringstate *);
+
+  if (sp!=NIL) {
+    sp->freestrings = freestrings;
+    memcpy(sp->binlists, binlists, sizeof(binlists));
+    sp->freelist = freelist;
+    sp->emptyaddr = &emptystring;
+  }
+  return sizeof(stringstate);
+}
+
+void set_stringstate(void *state) {
+  stringstate *sp = CAST(state, stringstate *);
+
+  freestrings = sp->freestrings;
+  memcpy(binlists, sp->binlists, sizeof(binlists));
+  freelist = sp->freelist;
+}
+
+void relocate_strings(void *state, basicstring *strings, int32 count) {
+  char *emptyaddr = CAST(state, stringstate *)->emptyaddr;
+  int32 n;
+
+  for (n=0; n<count; n++) {
+    if (strings[n].stringaddr==emptyaddr) strings[n].stringaddr = &emptystring;
+  }
+}
+
 static int compare(const void *first, const void *second) {
   return CAST(CAST(first, freeblock *)->freestart, char *)-CAST(CAST(second, freeblock *)->freestart, char *);
 }
@@ -39,6 +39,9 @@ extern void clear_strings(void);
 extern int32 get_stringlen(size_t);
 extern void show_stringstats(void);
 extern void check_alloc(void);
+extern size_t get_stringstate(void *);
+extern void set_stringstate(void *);
+extern void relocate_strings(void *, basicstring *, int32);
 
 /* Additional string functions needed for RISC OS CLib build */
 #ifdef TARGET_RISCOS
@@ -55,6 +55,28 @@
 #define DEFAULTSIZE (BRANDY_DEFAULT_SIZE * 1024)
 #define MINSIZE 16384
 
+/*
+** RESERVESIZE is the most address space reserved for the Basic workspace
+** on 64-bit Linux when the size is given as 'max' (MAXWORKSPACE). Memory
+** is only committed as it is used so this costs nothing until the program
+** needs it.
+*/
+#define RESERVESIZE 0xFFFFFC00ull
+#define MAXWORKSPACE ((size_t)-1)
+
+/*
+** BIGMEMSIZE is the workspace size used in 'bigmem' mode when the size is
+** given as 'max'. As with RESERVESIZE, memory is only committed when it is used.
+** Only the first BIGNEARSIZE bytes of the workspace hold the program,
+** heap and stack so that the 32-bit offsets in tokenised lines can still
+** reach the variables.
+*/
+#ifndef BRANDY_BIGMEM_SIZE
+#define BRANDY_BIGMEM_SIZE 64
+#endif
+#define BIGMEMSIZE (BRANDY_BIGMEM_SIZE * 0x40000000ull)
+#define BIGNEARSIZE 0xFFFFFC00ull
+
 /* Make the startup mode a compile-time option.
 ** Default mode is 0 - the hardwired value up to now.
 ** add -DBRANDY_STARTUP_MODE=<mode> to your
@@ -469,6 +491,16 @@ typedef unsigned long int nativeuint;   /* 32 or 64-bit depending on architectur
 #define ALIGN(x) ((x+sizeof(size_t)-1) & -(int)sizeof(size_t))
 #endif
 
+/*
+** THREADLOCAL is used for the working storage of the tokeniser so
+** that large programs can be tokenised on several threads at once
+*/
+#ifdef TARGET_UNIX
+#define THREADLOCAL __thread
+#else
+#define THREADLOCAL
+#endif
+
 #if defined(TARGET_MINGW) || defined(__TARGET_SCL__)
 #include <setjmp.h>
 #define sigsetjmp(env, savesigs) __builtin_setjmp(env)
@@ -109,6 +109,7 @@
 ** Linux but this code allows for it to be left unspecified
 */
 #define SCRWIDTH 80             /* Assumed width of normal text screen */
+#define OUTBUFSIZE 65536        /* Size of stdout buffer when output is redirected */
 #define SCRHEIGHT 0             /* Pretend height of normal text screen */
 
 #ifdef USE_ANSI
@@ -206,6 +207,16 @@ static void write_vduflag(unsigned int flags, int yesno) {
   vduflags = yesno ? vduflags | flags : vduflags & ~flags;
 }
 
+/*
+** 'flush_screen' flushes the output written so far if it is going
+** to the screen. When output is redirected it is left in the buffer
+** and is only flushed before the interpreter waits for keyboard input,
+** when a command is run and at the end of the run
+*/
+static void flush_screen(void) {
+  if (!basicvars.runflags.outredir) fflush(stdout);
+}
+
 static void tekvdu(int chr) {
   putchar(chr);
   fflush(stdout);
@@ -279,7 +290,7 @@ static void reset_screen(void) {
 */
 static void putch(int32 ch) {
   putchar(ch);
-  if (vduflag(VDU_FLAG_ECHO)) fflush(stdout);
+  if (vduflag(VDU_FLAG_ECHO)) flush_screen();
 }
 
 /*
@@ -291,7 +302,7 @@ static void putch(int32 ch) {
 */
 static void gotoxy(int32 x, int32 y) {
   printf("\033[%d;%dH", y, x);  /* VTxxx/ANSI sequence to move cursor */
-  fflush(stdout);
+  flush_screen();
 }
 
 /*
@@ -307,7 +318,7 @@ static void scroll_text(updown direction) {
   else {        /* Move screen down */
     printf("\033[L");
   }
-  fflush(stdout);
+  flush_screen();
 }
 
 /*
@@ -336,7 +347,7 @@ static void textbackground(int32 colour) {
 */
 static void clrscr(void) {
   printf("\033[2J\033[H");      /* VTxxx/ANSI sequence for clearing the screen and to 'home' the cursor */
-  fflush(stdout);
+  flush_screen();
 }
 
 /*
@@ -354,7 +365,7 @@ void set_cursor(boolean underline) {
 */
 void echo_on(void) {
   write_vduflag(VDU_FLAG_ECHO,1);
-  fflush(stdout);
+  flush_screen();
 }
 
 /*
@@ -694,10 +705,10 @@ static void vdu_setpalette(void) {
 */
 static void printer_char(void) {
   if (matrixflags.printer) {
-    fputc(vduqueue[0], matrixflags.printer);
+    printout_byte(vduqueue[0]);
   } else {
     putchar(vduqueue[0]);
-    if (vduflag(VDU_FLAG_ECHO)) fflush(stdout);
+    if (vduflag(VDU_FLAG_ECHO)) flush_screen();
   }
 }
 
@@ -720,7 +731,7 @@ static void move_curback(void) {
       printf("\033[%dG", xtext+1);      /* Move cursor to last column */
     }
   }
-  fflush(stdout);
+  flush_screen();
 }
 
 /*
@@ -737,7 +748,7 @@ static void move_curforward(void) {
     ytext++;
     printf("\n\033[%dG", xtext+1);      /* Move cursor down and to first column */
   }
-  fflush(stdout);
+  flush_screen();
 }
 
 /*
@@ -748,7 +759,7 @@ static void move_curforward(void) {
 static void move_curdown(void) {
   ytext++;
   printf("\n\033[%dG", xtext+1);
-  fflush(stdout);
+  flush_screen();
 }
 
 /*
@@ -763,7 +774,7 @@ static void move_curup(void) {
     ytext++;            /* Scroll window down a line */
     scroll_text(SCROLL_DOWN);
   }
-  fflush(stdout);
+  flush_screen();
 }
 
 /*
@@ -777,7 +788,7 @@ static void vdu_cleartext(void) {
     for (row = twintop; row<=twinbottom; row++) {
       printf("\033[%d;%dH\033[%dX", row+1, twinleft+1, twinright-twinleft+1);   /* Clear the line */
     }
-    fflush(stdout);
+    flush_screen();
     move_cursor(twinleft, twintop);     /* Send cursor to home position in window */
   }
   else {    /* No text window has been defined */
@@ -793,7 +804,7 @@ static void vdu_cleartext(void) {
 */
 static void vdu_return(void) {
   printf("\033[%dG", twinleft+1);
-  fflush(stdout);
+  flush_screen();
   xtext = twinleft;
 }
 
@@ -839,7 +850,7 @@ static void vdu_textwind(void) {
 /* ========== conio ========== */
 
 static void printer_char(void) {
-  if (matrixflags.printer) fputc(vduqueue[0], matrixflags.printer);
+  if (matrixflags.printer) printout_byte(vduqueue[0]);
 }
 
 /*
@@ -1144,13 +1155,42 @@ static void print_char(int32 charvalue) {
       ytext++;
       printf("\n\033[%dG", xtext+1);
     }
-    if (vduflag(VDU_FLAG_ECHO)) fflush(stdout);
+    if (vduflag(VDU_FLAG_ECHO)) flush_screen();
   }
   else {        /* Output is going elsewhere, probably a file */
     putchar(charvalue);
   }
 }
 
+/*
+** 'print_text' displays the 'length' printable characters at 'text'.
+** It has the same effect as calling 'print_char' for each of them but
+** writes them a line of the text window at a time
+** -- ANSI --
+*/
+static void print_text(char *text, int32 length) {
+  int32 chunk;
+  if (basicvars.runflags.outredir) {    /* Output is going elsewhere, probably a file */
+    fwrite(text, 1, length, stdout);
+    return;
+  }
+  while (length>0) {
+    chunk = twinright-xtext+1;          /* Room left on this line of the text window */
+    if (chunk<1) chunk = 1;
+    if (chunk>length) chunk = length;
+    fwrite(text, 1, chunk, stdout);
+    text+=chunk;
+    length-=chunk;
+    xtext+=chunk;
+    if (xtext>twinright) {              /* Have reached edge of text window. Skip to next line  */
+      xtext = twinleft;
+      ytext++;
+      printf("\n\033[%dG", xtext+1);
+    }
+  }
+  if (vduflag(VDU_FLAG_ECHO)) flush_screen();
+}
+
 #else
 
 /*
@@ -1181,6 +1221,18 @@ static void print_char(int32 charvalue) {
   }
 }
 
+/*
+** 'print_text' displays the 'length' printable characters at 'text'
+*/
+static void print_text(char *text, int32 length) {
+  int32 n;
+  if (basicvars.runflags.outredir)      /* Output is going elsewhere, probably a file */
+    fwrite(text, 1, length, stdout);
+  else {
+    for (n=0; n<length; n++) print_char(CAST(text[n], byte));
+  }
+}
+
 #endif
 
 static void vdu_plot(void) {
@@ -1201,7 +1253,7 @@ static void vdu_plot(void) {
 */
 void emulate_vdu(int32 charvalue) {
   charvalue = charvalue & BYTEMASK;     /* Deal with any signed char type problems */
-  if (matrixflags.dospool) fputc(charvalue, matrixflags.dospool);
+  if (matrixflags.dospool) spool_character(charvalue);
   if (matrixflags.printer) printout_character(charvalue);
   if (vduneeded==0) {                   /* VDU queue is empty */
     if (charvalue>=' ' && charvalue != DEL) {               /* Most common case - print something */
@@ -1209,7 +1261,7 @@ void emulate_vdu(int32 charvalue) {
       return;
     }
     else {      /* Control character - Found start of new VDU command */
-      if (!vduflag(VDU_FLAG_ECHO)) fflush(stdout);
+      if (!vduflag(VDU_FLAG_ECHO)) flush_screen();
       vducmd = charvalue;
       if (charvalue == DEL) vduneeded=0; else vduneeded = vdubytes[charvalue];
       vdunext = 0;
@@ -1332,6 +1384,33 @@ void emulate_vdu(int32 charvalue) {
   }
 }
 
+/*
+** 'send_text' sends 'length' characters at 'text' to the VDU driver.
+** Runs of printable characters met when no VDU command is in progress
+** are displayed in one go, which has the same effect as passing them
+** to 'emulate_vdu' one at a time
+*/
+static void send_text(char *text, int32 length) {
+  int32 n, run;
+
+  n = 0;
+  while (n<length) {
+    run = 0;
+    if (vduneeded==0) {
+      while (n+run<length && CAST(text[n+run], byte)>=' ' && CAST(text[n+run], byte)!=DEL) run++;
+    }
+    if (run==0) {       /* Control character or part of a VDU command */
+      emulate_vdu(text[n]);
+      n++;
+      continue;
+    }
+    if (matrixflags.dospool) spool_text(text+n, run);
+    if (matrixflags.printer) printout_text(text+n, run);
+    print_text(text+n, run);
+    n+=run;
+  }
+}
+
 /*
 ** 'emulate_vdustr' is called to print a string via the 'VDU driver'
 */
@@ -1339,6 +1418,11 @@ void emulate_vdustr(char string[], int32 length) {
   int32 n;
   if (length==0) length = strlen(string);
   echo_off();
+  if (basicvars.printwidth <= 0) {      /* No line width to check - Send the string in one go */
+    send_text(string, length);
+    echo_on();
+    return;
+  }
   for (n=0; n<length; n++) {
     emulate_vdu(string[n]);      /* Send the string to the VDU driver */
     if (basicvars.printwidth > 0) {
@@ -1359,14 +1443,15 @@ void emulate_vdustr(char string[], int32 length) {
 ** to the screen
 */
 void emulate_printf(char *format, ...) {
-  int32 n, length;
+  int32 length;
   va_list parms;
   char text [MAXSTRING];
   va_start(parms, format);
   length = vsnprintf(text, MAXSTRING, format, parms);
   va_end(parms);
+  if (length>=MAXSTRING) length = MAXSTRING-1;  /* Output was truncated */
   echo_off();
-  for (n = 0; n < length; n++) emulate_vdu(text[n]);
+  send_text(text, length);
   echo_on();
 }
 
@@ -2215,12 +2300,17 @@ void emulate_origin(int32 x, int32 y) {
 ** of stdout. If the call works then output is assumed to be going
 ** to a terminal. If it fails then it is assumed to be directed at
 ** a file or some other device. This controls whether or not the
-** RISC OS VDU commands are supported
+** RISC OS VDU commands are supported. In batch mode output is always
+** treated as redirected without looking at the terminal
 */
 static void check_stdout(void) {
 #ifdef TARGET_UNIX
   struct termios parameters;
   int errcode, screen;
+  if (basicvars.runflags.batch) {
+    basicvars.runflags.outredir = TRUE;
+    return;
+  }
   screen = fileno(stdout);
   errcode = tcgetattr(screen, &parameters);
   basicvars.runflags.outredir = errcode!=0;
@@ -2293,6 +2383,7 @@ static void find_screensize(void) {
 boolean init_screen(void) {
   int mode;
   check_stdout();
+  if (basicvars.runflags.outredir) setvbuf(stdout, NIL, _IOFBF, OUTBUFSIZE);
   find_screensize();
   /* Set initial screen mode according to the screen size */
   if (realwidth>SCRWIDTH || realheight>SCRHEIGHT)       /* Larger screen mode */
@@ -2323,6 +2414,7 @@ boolean init_screen(void) {
 */
 void end_screen(void) {
   if (vduflag(VDU_FLAG_TEXTWIN)) reset_screen();
+  fflush(stdout);
 }
 
 int32 get_character_at_pos(int32 cx, int32 cy) {
@@ -29,13 +29,16 @@
 #include <string.h>
 #include <math.h>
 #include <ctype.h>
+#include <setjmp.h>
 #include "common.h"
 #include "target.h"
 #include "basicdefs.h"
 #include "tokens.h"
+#include "heap.h"
 #include "miscprocs.h"
 #include "convert.h"
 #include "errors.h"
+#include "functions.h"
 
 /*
 ** The format of a tokenised line is as follows:
@@ -99,7 +102,13 @@ byte thisline[MAXSTATELEN + 8];
 ** 'tokenbase' points at the start of the buffer in which
 ** the tokenised version of the line is stored
 */
-static byte *tokenbase;
+static THREADLOCAL byte *tokenbase;
+
+/*
+** 'tokenabort' is set while 'try_tokenize' is tokenising a line. Errors
+** and warnings then abandon the line instead of being reported
+*/
+static THREADLOCAL jmp_buf *tokenabort;
 
 typedef struct {
   char *name;                   /* Name of token */
@@ -323,21 +332,53 @@ static int command_start [] = { /* Starting positions for commands in 'tokens' *
   NOKEYWORD, NOKEYWORD, NOKEYWORD, NOKEYWORD, NOKEYWORD, NOKEYWORD
 };
 
-static char *lp;        /* Pointer to current position in untokenised Basic statement */
+/*
+** Keywords and commands written out in full are found using a trie built
+** from 'tokens' the first time it is needed. Each node has an entry for
+** every character that can appear in a keyword, giving the next node or
+** zero if no keyword continues with that character, and the index in
+** 'tokens' of the keyword that ends at that node, if any. Node 0 is the
+** root for keywords and node 1 the root for commands. Abbreviated
+** keywords are still found by searching the table.
+*/
+#define TRIECHARS 28            /* 'A' to 'Z', '$' and '(' */
+#define TRIESIZE 1024           /* Maximum number of nodes in trie */
+#define KEYWORDROOT 0
+#define COMMANDROOT 1
+
+typedef struct {
+  unsigned short next[TRIECHARS];       /* Next node for each character */
+  byte found;                   /* Index of keyword ending here or NOKEYWORD */
+} trienode;
+
+static trienode kwtrie[TRIESIZE];
+static int trienodes;           /* Number of nodes in use in trie. Zero if not built yet */
 
-static int
+static THREADLOCAL char *lp;    /* Pointer to current position in untokenised Basic statement */
+
+static THREADLOCAL int
   next,                 /* Index of next free byte in tokenised line buffer */
   source,               /* Index of next byte in source (used when compressing source) */
   brackets,             /* Current bracket nesting depth */
-  indentation,          /* Current indentation when listing program */
   lasterror;            /* Number of last error detected when tokenising a line */
 
-static boolean
+static int indentation; /* Current indentation when listing program */
+
+static THREADLOCAL boolean
   linestart,            /* TRUE if at the start of a tokenised line */
   firstitem,            /* TRUE if processing the start of an untokenised Basic statement */
   numbered,             /* TRUE if line starts with a line number */
   immediate;            /* TRUE if tokenising line in immediate mode */
 
+/*
+** 'token_error' reports an error or warning found when tokenising
+** a line or, if 'try_tokenize' is in use, abandons the line
+*/
+static void token_error(int32 errnumber) {
+  if (tokenabort != NIL) longjmp(*tokenabort, 1);
+  error(errnumber);
+}
+
 /*
 ** 'isempty' returns true if the line passed to it has nothing on it
 */
@@ -361,7 +402,7 @@ void save_lineno(byte *where, int32 number) {
 static void store_lineno(int32 number) {
   DEBUGFUNCMSGIN;
   if (next+LINESIZE>=MAXSTATELEN) {
-    error(ERR_STATELEN);
+    token_error(ERR_STATELEN);
     return;
   }
   tokenbase[next] = CAST(number, byte);
@@ -398,7 +439,7 @@ static void store_exec(int32 offset) {
 static void store(byte token) {
   DEBUGFUNCMSGIN;
   if (next+1>=MAXSTATELEN) {
-    error(ERR_STATELEN);
+    token_error(ERR_STATELEN);
     return;
   }
   tokenbase[next] = token;
@@ -413,7 +454,7 @@ static void store(byte token) {
 static void store_size(int32 size) {
   DEBUGFUNCMSGIN;
   if (next+SIZESIZE>=MAXSTATELEN) {
-    error(ERR_STATELEN);
+    token_error(ERR_STATELEN);
     return;
   }
   tokenbase[next] = CAST(size, byte);
@@ -431,7 +472,7 @@ static void store_longoffset(int32 value) {
 
   DEBUGFUNCMSGIN;
   if (next+LOFFSIZE>=MAXSTATELEN) {
-    error(ERR_STATELEN);
+    token_error(ERR_STATELEN);
     return;
   }
   for (n=1; n<=LOFFSIZE; n++) {
@@ -450,7 +491,7 @@ static void store_longoffset(int32 value) {
 static void store_shortoffset(int32 value) {
   DEBUGFUNCMSGIN;
   if (next+OFFSIZE>=MAXSTATELEN) {
-    error(ERR_STATELEN);
+    token_error(ERR_STATELEN);
     return;
   }
   tokenbase[next] = CAST(value, byte);
@@ -468,7 +509,7 @@ static void store_intconst(int32 value) {
 
   DEBUGFUNCMSGIN;
   if (next+INTSIZE>=MAXSTATELEN) {
-    error(ERR_STATELEN);
+    token_error(ERR_STATELEN);
     return;
   }
   for (n=1; n<=INTSIZE; n++) {
@@ -484,7 +525,7 @@ static void store_int64const(int64 value) {
 
   DEBUGFUNCMSGIN;
   if (next+INT64SIZE>=MAXSTATELEN) {
-    error(ERR_STATELEN);
+    token_error(ERR_STATELEN);
     return;
   }
   for (n=1; n<=INT64SIZE; n++) {
@@ -505,7 +546,7 @@ static void store_fpvalue(float64 fpvalue) {
 
   DEBUGFUNCMSGIN;
   if (next+FLOATSIZE>=MAXSTATELEN) {
-    error(ERR_STATELEN);
+    token_error(ERR_STATELEN);
     return;
   }
   memcpy(temp, &fpvalue, sizeof(float64));
@@ -531,7 +572,7 @@ static int32 convert_lineno(void) {
   }
   if (line>MAXLINENO) {
     lasterror = ERR_LINENO;
-    error(WARN_LINENO); /* Line number is too large */
+    token_error(WARN_LINENO); /* Line number is too large */
     line = 0;
     while (*lp>='0' && *lp<='9') lp++;  /* Skip any remaining digits in line number */
   }
@@ -553,6 +594,74 @@ static char *copy_line(char *lp) {
   return lp;
 }
 
+/*
+** 'trie_char' returns the trie child number for character 'ch' or
+** -1 if it cannot appear in a keyword
+*/
+static int trie_char(char ch) {
+  if (ch >= 'A' && ch <= 'Z') return ch-'A';
+  if (ch == '$') return 26;
+  if (ch == '(') return 27;
+  return -1;
+}
+
+/*
+** 'build_kwtrie' builds the keyword trie from the token table. Where two
+** entries have the same name, the first one in the table is used, as
+** that is the one a search of the table would find
+*/
+static void build_kwtrie(void) {
+  int n, k, node, root;
+
+  DEBUGFUNCMSGIN;
+  kwtrie[KEYWORDROOT].found = kwtrie[COMMANDROOT].found = NOKEYWORD;
+  trienodes = 2;
+  for (n=0; n<TOKTABSIZE-1; n++) {      /* The last entry is an end marker */
+    root = n < command_start[0] ? KEYWORDROOT : COMMANDROOT;
+    node = root;
+    for (k=0; k<tokens[n].length; k++) {
+      int ch = trie_char(tokens[n].name[k]);
+      if (ch < 0 || trienodes == TRIESIZE) {
+        trienodes = 0;
+        DEBUGFUNCMSGOUT;
+        error(ERR_BROKEN, __LINE__, "tokens");
+        return;
+      }
+      if (kwtrie[node].next[ch] == 0) {
+        memset(&kwtrie[trienodes], 0, sizeof(trienode));
+        kwtrie[trienodes].found = NOKEYWORD;
+        kwtrie[node].next[ch] = trienodes;
+        trienodes++;
+      }
+      node = kwtrie[node].next[ch];
+    }
+    if (kwtrie[node].found == NOKEYWORD) kwtrie[node].found = n;
+  }
+  DEBUGFUNCMSGOUT;
+}
+
+/*
+** 'trie_search' looks for the keywords or commands (depending on 'root')
+** whose names are a prefix of 'keyword'. If more than one matches, the
+** one nearest the start of the token table is returned, the same one that
+** a search of the table in order would find. It returns 'NOKEYWORD' if
+** there is no match
+*/
+static int trie_search(int root, char *keyword) {
+  int node = root, best = NOKEYWORD;
+
+  if (trienodes == 0) build_kwtrie();
+  while (*keyword != asc_NUL) {
+    int ch = trie_char(*keyword);
+    if (ch < 0) break;
+    node = kwtrie[node].next[ch];
+    if (node == 0) break;
+    if (kwtrie[node].found < best) best = kwtrie[node].found;
+    keyword++;
+  }
+  return best;
+}
+
 /*
 ** "kwsearch" checks to see if the text passed to it is a token, returning
 ** the index of the token entry or 'NOKEYWORD' if there is no match. As a
@@ -569,7 +678,7 @@ static char *copy_line(char *lp) {
 ** not perfect but it should get around most problems.
 */
 static int kwsearch(void) {
-  int n, count, kwlength;
+  int n, count = 0, kwlength;
   char first, *cp;
   boolean nomatch, abbreviated;
   char keyword[MAXKWLEN+1];
@@ -591,12 +700,16 @@ static int kwsearch(void) {
   }
   if (islower(first)) {
     nomatch = TRUE;
+  } else if (!abbreviated) {
+    n = trie_search(KEYWORDROOT, keyword);
+    nomatch = n == NOKEYWORD;
+    if (!nomatch) count = tokens[n].length;
   } else {
     n = start_letter[first-'A'];
     if (n == NOKEYWORD) return NOKEYWORD;       /* No keyword starts with this letter */
     do {
       count = tokens[n].length; /* Decide on number of characters to compare */
-      if (abbreviated && kwlength < count) {
+      if (kwlength < count) {
         count = kwlength;
         if (kwlength < tokens[n].minlength) count = tokens[n].minlength;
       }
@@ -615,7 +728,7 @@ static int kwsearch(void) {
  * that is, the number of characters in the word read and the
  * keyword are the same. Weed out that case here.
  */
-    if (!nomatch && abbreviated) abbreviated = kwlength < tokens[n].length;
+    if (!nomatch) abbreviated = kwlength < tokens[n].length;
   }
   if (nomatch) {        /* Keyword not found. Check if it is a command */
 /*
@@ -628,19 +741,26 @@ static int kwsearch(void) {
     } else {
       if (islower(first)) return NOKEYWORD;
     }
-    n = command_start[first - 'A'];
-    if (n == NOKEYWORD) return NOKEYWORD;       /* Text is not a keyword or a command */
-    do {
-      count = tokens[n].length; /* Decide on number of characters to compare */
-      if (abbreviated && kwlength<count) {
-        count = kwlength;
-        if (kwlength<tokens[n].minlength) count = tokens[n].minlength;
-      }
-      if (strncmp(keyword, tokens[n].name, count) == 0) break;
-      n++;
-    } while (*(tokens[n].name) == first);
-    nomatch = *(tokens[n].name) != first;
-    if (!nomatch && abbreviated) abbreviated = kwlength < tokens[n].length;
+    if (!abbreviated) {
+      n = trie_search(COMMANDROOT, keyword);
+      if (n == NOKEYWORD) return NOKEYWORD;     /* Text is not a keyword or a command */
+      count = tokens[n].length;
+      nomatch = FALSE;
+    } else {
+      n = command_start[first - 'A'];
+      if (n == NOKEYWORD) return NOKEYWORD;     /* Text is not a keyword or a command */
+      do {
+        count = tokens[n].length;       /* Decide on number of characters to compare */
+        if (kwlength<count) {
+          count = kwlength;
+          if (kwlength<tokens[n].minlength) count = tokens[n].minlength;
+        }
+        if (strncmp(keyword, tokens[n].name, count) == 0) break;
+        n++;
+      } while (*(tokens[n].name) == first);
+      nomatch = *(tokens[n].name) != first;
+      if (!nomatch) abbreviated = kwlength < tokens[n].length;
+    }
   }
   if (nomatch || (!abbreviated && tokens[n].alone && ISIDCHAR(keyword[count]))) { /* Not a keyword */
     DEBUGFUNCMSGOUT;
@@ -734,7 +854,7 @@ static void copy_token(void) {
     copy_keyword(n);
   else {        /* Cannot find token value */
     lasterror = ERR_SYNTAX;
-    error(WARN_BADTOKEN);
+    token_error(WARN_BADTOKEN);
   }
   DEBUGFUNCMSGOUT;
 }
@@ -812,7 +932,7 @@ static void copy_number(void) {
     }
     if (digits == 0) {  /* Number contains no digits */
       lasterror = ERR_SYNTAX;
-      error(WARN_BADHEX);
+      token_error(WARN_BADHEX);
     }
     break;
   case '%':             /* Binary number */
@@ -823,7 +943,7 @@ static void copy_number(void) {
     }
     if (digits == 0) {  /* Number contains no digits */
       lasterror = ERR_SYNTAX;
-      error(WARN_BADBIN);
+      token_error(WARN_BADBIN);
     }
     break;
   default:              /* Integer or floating point number */
@@ -886,7 +1006,7 @@ static void copy_string(void) {
     lp++;               /* Skip to character after the '"' */
   else {
     lasterror = ERR_QUOTEMISS;
-    error(WARN_QUOTEMISS);      /* No terminating '"' found */
+    token_error(WARN_QUOTEMISS);  /* No terminating '"' found */
     store('"');
   }
   DEBUGFUNCMSGOUT;
@@ -909,7 +1029,7 @@ static void copy_other(void) {
     brackets--;
     if (brackets < 0) { /* More ')' than '(' */
       lasterror = ERR_LPMISS;
-      error(WARN_PARNEST);
+      token_error(WARN_PARNEST);
     }
     break;
   case 172:         /* This is a hi-bit char and causes a compiler warning if used directly */
@@ -1073,11 +1193,11 @@ static void tokenise_source(char *start, boolean haslineno) {
   next--;                               /* So that the next byte will overwrite the NUL */
   if (brackets<0) {                     /* Too many ')' in line */
     lasterror = ERR_LPMISS;
-    error(WARN_RPAREN);
+    token_error(WARN_RPAREN);
   }
   else if (brackets>0) {                /* Too many '(' in line */
     lasterror = ERR_RPMISS;
-    error(WARN_RPMISS);
+    token_error(WARN_RPMISS);
   }
   DEBUGFUNCMSGOUT;
 }
@@ -1215,7 +1335,7 @@ static void do_linenumber(void) {
 static void do_number(void) {
   int32 value;
   int64 value64;
-  static float64 fpvalue;
+  static THREADLOCAL float64 fpvalue;
   boolean isintvalue;
   boolean isbinhex=FALSE;
   char *p;
@@ -1248,7 +1368,7 @@ static void do_number(void) {
     if (p == NIL) {
       lasterror = ERR_BADEXPR;
       DEBUGFUNCMSGOUT;
-      error(value);     /* Error found in number - flag it */
+      token_error(value);     /* Error found in number - flag it */
       return;
     }
     source = p-CAST(&tokenbase[0], char *);     /* Figure out new value of 'source' */
@@ -1484,6 +1604,35 @@ void tokenize(char *start, byte tokenbuf[], boolean haslineno, boolean immediate
   DEBUGFUNCMSGOUT;
 }
 
+/*
+** 'try_tokenize' tokenises a line in the same way as 'tokenize' except
+** that nothing is reported if the line contains an error or something
+** that would produce a warning. It returns FALSE in that case and the
+** line has to be tokenised again with 'tokenize' to report the problem.
+** It can be called on several threads at once provided that
+** 'prepare_tokenize' has been called first
+*/
+boolean try_tokenize(char *start, byte tokenbuf[], boolean haslineno) {
+  jmp_buf abandon;
+
+  if (setjmp(abandon) != 0) {   /* Line contains an error */
+    tokenabort = NIL;
+    return FALSE;
+  }
+  tokenabort = &abandon;
+  tokenize(start, tokenbuf, haslineno, FALSE);
+  tokenabort = NIL;
+  return TRUE;
+}
+
+/*
+** 'prepare_tokenize' builds the keyword trie so that 'try_tokenize'
+** does not need to build it on a worker thread
+*/
+void prepare_tokenize(void) {
+  if (trienodes == 0) build_kwtrie();
+}
+
 /*
 ** The following table gives the number of characters to skip for each
 ** token in addition to the one character for the token.
@@ -1591,7 +1740,7 @@ byte *skip_name(byte *p) {
 static byte *get_address(byte *p) {
   DEBUGFUNCMSGIN;
   DEBUGFUNCMSGOUT;
-  return basicvars.workspace+(*(p+1) | *(p+2)<<8 | *(p+3)<<16 | *(p+4)<<24);
+  return basicvars.workspace+(ADDROFFSET)(*(p+1) | *(p+2)<<8 | *(p+3)<<16 | *(p+4)<<24);
 }
 
 /*
@@ -1905,6 +2054,76 @@ void reset_indent(void) {
   indentation = 0;
 }
 
+/*
+** 'reflog' records where variable, PROC/FN and CASE addresses have been
+** filled in in the program and in installed libraries, together with the
+** bytes the addresses replaced. 'clear_varptrs' uses it to put back just
+** those tokens instead of going through every line. If the log cannot
+** be extended, 'reflogfull' is set and every line is checked instead.
+** Everything but line number references is logged, so it does not matter
+** whether the caller of 'set_address' changes the token before or after
+** filling in the address: what is reset is decided from the token found
+** there when the log is replayed
+*/
+typedef struct {
+  byte *token;                  /* Token whose address was filled in */
+  byte offset[LOFFSIZE];        /* Offset of name from token before that */
+} refentry;
+
+static refentry *reflog;        /* References filled in since the last clear */
+static size_t refcount;         /* Number of entries in use in 'reflog' */
+static size_t refsize;          /* Number of entries allocated for 'reflog' */
+static boolean reflogfull;      /* TRUE if references were missed out of the log */
+
+/*
+** 'log_reference' adds the token at 'tp' to the reference log if it is
+** in the program or an installed library. References anywhere else, for
+** example in a library loaded with LIBRARY, are not cleared by
+** 'clear_varptrs' and so are not logged
+*/
+static void log_reference(byte *tp) {
+  DEBUGFUNCMSGIN;
+  if (reflogfull) {
+    DEBUGFUNCMSGOUT;
+    return;
+  }
+  if (tp<basicvars.page || tp>=basicvars.top) {     /* Not in program - Check installed libraries */
+    library *lp = basicvars.installist;
+    while (lp!=NIL && (tp<lp->libstart || tp>=lp->libstart+lp->libsize)) lp = lp->libflink;
+    if (lp==NIL) {
+      DEBUGFUNCMSGOUT;
+      return;
+    }
+  }
+  if (refcount==refsize) {      /* Log is full - Try to extend it */
+    size_t newsize = refsize==0 ? 1024 : refsize*2;
+    refentry *newlog = realloc(reflog, newsize*sizeof(refentry));
+    if (newlog==NIL) {
+      reflogfull = TRUE;
+      DEBUGFUNCMSGOUT;
+      return;
+    }
+    reflog = newlog;
+    refsize = newsize;
+  }
+  reflog[refcount].token = tp;
+  memcpy(reflog[refcount].offset, tp+1, LOFFSIZE);
+  refcount++;
+  DEBUGFUNCMSGOUT;
+}
+
+/*
+** 'discard_reflog' empties the reference log. It is called when the
+** references in every line have been cleared or the program has been
+** edited or replaced, as the entries no longer point at the right places
+*/
+void discard_reflog(void) {
+  DEBUGFUNCMSGIN;
+  refcount = 0;
+  reflogfull = FALSE;
+  DEBUGFUNCMSGOUT;
+}
+
 /*
 ** 'set_dest' stores a branch destination in the tokenised code at 'tp'.
 ** The destination is given as the number of bytes to skip from the address
@@ -1936,6 +2155,7 @@ void set_address(byte *tp, void *p) {
 
   DEBUGFUNCMSGIN;
   basicvars.runflags.has_offsets = TRUE;
+  if (*tp!=BASTOKEN_XLINENUM && *tp!=BASTOKEN_LINENUM) log_reference(tp);
   offset = CAST(p, byte *)-basicvars.workspace;
   for (n=0; n<LOFFSIZE; n++) {
     tp++;
@@ -2028,33 +2248,73 @@ void clear_linerefs(byte *bp) {
   DEBUGFUNCMSGOUT;
 }
 
+/*
+** 'free_casetables' returns the tables of all the CASE statements that
+** have been reset to the heap
+*/
+static void free_casetables(void) {
+  casetable *cp;
+
+  while (basicvars.caselist != NIL) {
+    cp = basicvars.caselist;
+    basicvars.caselist = cp->caseflink;
+    freemem(cp, sizeof(casetable)+cp->whencount*sizeof(whenvalue));
+  }
+}
+
 /*
 ** 'clear refs' is called to restore all the 'embedded pointer' tokens
 ** to their 'no address' versions in the program loaded and any
-** permanent libraries loaded via the 'install' command. This is needed
-** when a program is edited or when the 'CLEAR' statement is executed.
+** permanent libraries loaded via the 'install' command, and in the
+** expressions kept by EVAL. This is needed when a program is edited
+** or when the 'CLEAR' statement is executed.
 ** This process is not needed for libraries loaded via the 'library'
-** statement as these libraries will have been discarded at this point
+** statement as these libraries will have been discarded at this point.
+** Only the tokens in the reference log are reset unless the log is
+** incomplete, so the cost depends on how much of the program has run
+** rather than on its size
 */
 void clear_varptrs(void) {
   byte *bp;
   library *libp;
 
   DEBUGFUNCMSGIN;
-  bp = basicvars.start;
-  while (!AT_PROGEND(bp)) {
-    clear_varaddrs(bp);
-    bp = bp+GET_LINELEN(bp);
-  }
-  libp = basicvars.installist;    /* Now clear the pointers in any installed libraries */
-  while (libp != NIL) {
-    bp = libp->libstart;
+  if (reflogfull) {     /* Log is incomplete - Check every line */
+    bp = basicvars.start;
     while (!AT_PROGEND(bp)) {
       clear_varaddrs(bp);
       bp = bp+GET_LINELEN(bp);
     }
-    libp = libp->libflink;
+    libp = basicvars.installist;    /* Now clear the pointers in any installed libraries */
+    while (libp != NIL) {
+      bp = libp->libstart;
+      while (!AT_PROGEND(bp)) {
+        clear_varaddrs(bp);
+        bp = bp+GET_LINELEN(bp);
+      }
+      libp = libp->libflink;
+    }
+  }
+  else {        /* Reset the references in the log, most recent first */
+    while (refcount>0) {
+      refentry *rp = &reflog[--refcount];
+      byte *tp = rp->token;
+      if (*tp==BASTOKEN_XVAR || (*tp>=BASTOKEN_UINT8VAR && *tp<=BASTOKEN_FLOATINDVAR)) {
+        *tp = BASTOKEN_XVAR;
+        memcpy(tp+1, rp->offset, LOFFSIZE);
+      }
+      else if (*tp==BASTOKEN_FNPROCALL || *tp==BASTOKEN_XFNPROCALL) {
+        *tp = BASTOKEN_XFNPROCALL;
+        memcpy(tp+1, rp->offset, LOFFSIZE);
+      }
+      else if (*tp==BASTOKEN_CASE) {      /* The table itself goes in 'free_casetables' */
+        *tp = BASTOKEN_XCASE;
+      }
+    }
   }
+  discard_reflog();
+  free_casetables();
+  clear_evalcache();
   DEBUGFUNCMSGOUT;
 }
 
@@ -2068,9 +2328,9 @@ void clear_varptrs(void) {
 */
 static boolean legalow [] = {   /* Tokens in range 00.1F */
   FALSE, TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,    /* 00..07 */
-  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  FALSE, FALSE,   /* 08..0F */
+  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,    /* 08..0F */
   TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,    /* 10..17 */
-  TRUE,  FALSE, FALSE, FALSE, FALSE, FALSE, TRUE,  TRUE     /* 18..1F */
+  TRUE,  TRUE,  TRUE,  FALSE, FALSE, FALSE, TRUE,  TRUE     /* 18..1F */
 };
 
 /*
@@ -2168,6 +2428,79 @@ void resolve_linenums(byte *bp) {
   DEBUGFUNCMSGOUT;
 }
 
+/*
+** 'link_linenums' fills in the line number references in the program or
+** library starting at 'start' when it is loaded, in the same way as
+** 'set_linedest' in mainstate.c does the first time each one is used.
+** Lines are found with a binary search of a table of line addresses
+** rather than by searching the program for each reference. References
+** to lines that do not exist are left alone so that the error is reported
+** when the statement is executed. Nothing is done if the lines are not
+** in order as searching the program would not always find the same line
+** or if it lies outside the range that can be reached with the four byte
+** offsets from the start of the Basic workspace, as libraries loaded with
+** 'INSTALL' are on the C heap and can be anywhere in memory.
+** 'has_offsets' is left alone so that running the program does not clear
+** variable references it does not have. The 'linked' flag instead says
+** that references have to be cleared if the program is edited
+*/
+void link_linenums(byte *start) {
+  byte **lines, *bp, *tp;
+  int32 count, lastline, low, high, mid, line, n;
+  boolean hadoffsets;
+
+  DEBUGFUNCMSGIN;
+  count = 0;
+  lastline = 0;
+  for (bp=start; !AT_PROGEND(bp); bp+=GET_LINELEN(bp)) {
+    if (GET_LINENO(bp)<lastline) {      /* Lines are out of order */
+      DEBUGFUNCMSGOUT;
+      return;
+    }
+    lastline = GET_LINENO(bp);
+    count++;
+  }
+  if (start<basicvars.workspace || CAST(bp-basicvars.workspace, uint64)>0xFFFFFFFFull) {   /* Offsets would not fit */
+    DEBUGFUNCMSGOUT;
+    return;
+  }
+  lines = count>0 ? malloc(count*sizeof(byte *)) : NIL;
+  if (lines==NIL) {     /* Empty or no memory - Leave references to be filled in when used */
+    DEBUGFUNCMSGOUT;
+    return;
+  }
+  count = 0;
+  for (bp=start; !AT_PROGEND(bp); bp+=GET_LINELEN(bp)) lines[count++] = bp;
+  hadoffsets = basicvars.runflags.has_offsets;
+  for (n=0; n<count; n++) {
+    tp = FIND_EXEC(lines[n]);
+    while (*tp != asc_NUL) {
+      if (*tp == BASTOKEN_XLINENUM) {
+        line = GET_LINENUM(tp);
+        low = 0;
+        high = count;
+        while (low<high) {      /* Find the first line numbered 'line' or higher */
+          mid = (low+high)/2;
+          if (GET_LINENO(lines[mid])<line)
+            low = mid+1;
+          else {
+            high = mid;
+          }
+        }
+        if (low<count && GET_LINENO(lines[low])==line) {
+          set_address(tp, FIND_EXEC(lines[low]));
+          *tp = BASTOKEN_LINENUM;
+          basicvars.runflags.linked = TRUE;
+        }
+      }
+      tp = skip_token(tp);
+    }
+  }
+  basicvars.runflags.has_offsets = hadoffsets;
+  free(lines);
+  DEBUGFUNCMSGOUT;
+}
+
 /*
 ** 'reset_linenums' goes through a line and changes any line numbers
 ** referenced to their new values. As a bonus, it leaves all the
@@ -358,6 +358,8 @@
 extern byte thisline[];                 /* tokenised version of command line */
 
 extern void tokenize(char *, byte [], boolean, boolean);
+extern boolean try_tokenize(char *, byte [], boolean);
+extern void prepare_tokenize(void);
 extern void expand(byte *, char *);
 extern byte *skip_token(byte *);
 extern byte *skip_name(byte *);
@@ -366,17 +368,30 @@ extern void set_address(byte *, void *);
 extern void save_lineno(byte *, int32);
 extern float64 get_fpvalue(byte *);
 extern void clear_varptrs(void);
+extern void discard_reflog(void);
 extern void clear_linerefs(byte *);
 extern boolean isvalid(byte *);
 extern void reset_indent(void);
 extern void resolve_linenums(byte *);
 extern void reset_linenums(byte *);
+extern void link_linenums(byte *);
 extern int32 reformat(byte *, byte *, int32);
 extern boolean isempty(byte []);
 
+/*
+** The offsets of variables from the start of the workspace held in the
+** tokenised program are unsigned on 64-bit builds, where the workspace
+** can be larger than 2GB ('-size max' and 'bigmem')
+*/
+#ifdef MATRIX64BIT
+#define ADDROFFSET uint32
+#else
+#define ADDROFFSET int32
+#endif
+
 #define GET_INTVALUE(p) (*p | (*(p+1)<<8) | (*(p+2)<<16) | (*(p+3)<<24))
 #define GET_INT64VALUE(p) (int64)((int64)*p | ((int64)*(p+1)<<8) | ((int64)*(p+2)<<16) | ((int64)*(p+3)<<24) | ((int64)*(p+4)<<32) | ((int64)*(p+5)<<40) | ((int64)*(p+6)<<48) | ((int64)*(p+7)<<56))
-#define GET_ADDRESS(p, type) (CAST(basicvars.workspace+(*(p+1) | (*(p+2)<<8) | (*(p+3)<<16) | (*(p+4)<<24)), type))
+#define GET_ADDRESS(p, type) (CAST(basicvars.workspace+(ADDROFFSET)(*(p+1) | (*(p+2)<<8) | (*(p+3)<<16) | (*(p+4)<<24)), type))
 #define GET_SIZE(p) (*(p) | (*(p+1)<<BYTESHIFT))
 #define GET_DEST(p) (p+(*p | (*(p+1)<<BYTESHIFT)))
 #define GET_LINELEN(p) (*(p+OFFLENGTH) | (*(p+OFFLENGTH+1)<<BYTESHIFT))
@@ -43,6 +43,15 @@
 #include "lvalue.h"
 #include "statement.h"
 
+#ifdef TARGET_UNIX
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #define FIELDWIDTH 20           /* Width of field used to print each variable's value */
 #define PRINTWIDTH 80           /* Default maximum number of characters printed per line */
 #define MAXSUBSTR 45            /* Maximum characters printed from string */
@@ -89,6 +98,8 @@ void clear_varlists(void) {
   lp = basicvars.installist;
   while (lp!=NIL) {
     lp->libfplist = NIL;
+    lp->libfphash = NIL;
+    lp->libscanned = FALSE;
     for (n=0; n<VARLISTS; n++) lp->varlists[n] = NIL;
     lp = lp->libflink;
   }
@@ -108,25 +119,61 @@ static void remove_variable(variable *vptoremove, variable *newvp) {
       vp=vp->varflink;
     }
   }
-  if(returnable(vptoremove, sizeof(variable))) freemem(vptoremove, sizeof(variable));
+  freemem(vptoremove->varname, strlen(vptoremove->varname)+1);
+  freemem(vptoremove, sizeof(variable));
   DEBUGFUNCMSGOUT;
 }
 
+/*
+** 'array_elemsize' returns the size of one element of an array of
+** type 'varflags'
+*/
+static size_t array_elemsize(int32 varflags) {
+  switch (varflags) {
+  case VAR_INTARRAY:    return sizeof(int32);
+  case VAR_UINT8ARRAY:  return sizeof(uint8);
+  case VAR_INT64ARRAY:  return sizeof(int64);
+  case VAR_FLOATARRAY:  return sizeof(float64);
+  default:              return sizeof(basicstring);
+  }
+}
+
+/*
+** 'release_offheaparray' returns the memory used by the off-heap array
+** belonging to variable 'vp'. Arrays mapped from a file are unmapped,
+** which writes back any changes made to a shared mapping
+*/
+static void release_offheaparray(variable *vp) {
+  basicarray *ap = vp->varentry.vararray;
+
+#ifdef TARGET_UNIX
+  if (ap->offheap == OFFHEAP_MAPPED)
+    munmap(ap->arraystart.arraybase, ap->arrsize*array_elemsize(vp->varflags));
+  else
+#endif
+  if (ap->offheap == OFFHEAP_PAGES)
+    unmap_offheap(ap->arraystart.arraybase, ap->arrsize*array_elemsize(vp->varflags));
+  else {
+    free(ap->arraystart.arraybase);
+  }
+  free(ap);
+  vp->varentry.vararray=NULL;
+}
+
 void clear_offheaparrays() {
-  variable *vp;
+  variable *vp, *nextvp;
   int n;
 
   DEBUGFUNCMSGIN;
   for (n=0; n<VARLISTS; n++) {
     vp = basicvars.varlists[n];
     while (vp!=NIL) {
+      nextvp = vp->varflink;
       switch (vp->varflags) {
         case VAR_INTARRAY: case VAR_UINT8ARRAY: case VAR_INT64ARRAY: case VAR_FLOATARRAY: case VAR_STRARRAY: {
           if (vp->varentry.vararray!=NIL) {     /* Array bounds are undefined */
             if (vp->varentry.vararray->offheap) {
-              free(vp->varentry.vararray->arraystart.arraybase);
-              free(vp->varentry.vararray);
-              vp->varentry.vararray=NULL;
+              release_offheaparray(vp);
               remove_variable(vp, vp->varflink);
             }
           }
@@ -135,16 +182,22 @@ void clear_offheaparrays() {
         default:        /* Bad type of variable flag */
           break; /* do nothing, we ignore anything else */
       }
-      vp = vp->varflink;
+      vp = nextvp;
     }
   }
   DEBUGFUNCMSGOUT;
 }
 
+/*
+** 'exec_clear_himem' handles 'CLEAR HIMEM', which releases one or all
+** of the off-heap arrays. As the variables for the arrays are returned
+** to the heap, any references to them in the program are reset too
+*/
 void exec_clear_himem(void) {
   DEBUGFUNCMSGIN;
   if (isateol(basicvars.current)) {
     clear_offheaparrays();
+    clear_varptrs();
   } else {
     stackitem topitem;
     basicarray *descriptor;
@@ -159,10 +212,9 @@ void exec_clear_himem(void) {
           error(ERR_OFFHEAPARRAY);
           return;
         }
-        free(vp->varentry.vararray->arraystart.arraybase);
-        free(vp->varentry.vararray);
-        vp->varentry.vararray=NULL;
+        release_offheaparray(vp);
         remove_variable(vp, vp->varflink);
+        clear_varptrs();
         break;
       default: error(ERR_OFFHEAPARRAY);
     }
@@ -499,17 +551,94 @@ void list_libraries(char ch) {
   }
 }
 
+#ifdef TARGET_UNIX
+/*
+** 'open_arrayfile' evaluates the name of the file that follows
+** 'OPENIN' or 'OPENUP' in a 'DIM HIMEM' statement and opens it ready
+** to be mapped as the body of an array of 'length' bytes. A file
+** opened read-only must be at least that long. A file opened for update
+** is created if need be and extended if it is too short. The function returns the file
+** descriptor
+*/
+static int open_arrayfile(size_t length, boolean writable) {
+  stackitem stringtype;
+  basicstring descriptor;
+  char filename[FNAMESIZE];
+  struct stat filestat;
+  int fd;
+
+  expression();
+  stringtype = GET_TOPITEM;
+  if (stringtype != STACK_STRING && stringtype != STACK_STRTEMP) {
+    error(ERR_TYPESTR);
+    return -1;
+  }
+  descriptor = pop_string();
+  if (descriptor.stringlen > FNAMESIZE-1) {
+    if (stringtype == STACK_STRTEMP) free_string(descriptor);
+    error(ERR_INVALIDFNAME);
+    return -1;
+  }
+  memmove(filename, descriptor.stringaddr, descriptor.stringlen);
+  filename[descriptor.stringlen] = NUL;
+  if (stringtype == STACK_STRTEMP) free_string(descriptor);
+  if (writable)
+    fd = open(filename, O_RDWR|O_CREAT, 0666);
+  else {
+    fd = open(filename, O_RDONLY);
+  }
+  if (fd == -1) {
+    if (errno == ENOENT)
+      error(ERR_NOTFOUND, filename);
+    else if (writable)
+      error(ERR_OPENWRITE, filename);
+    else {
+      error(ERR_READFAIL, filename);
+    }
+    return -1;
+  }
+  if (fstat(fd, &filestat) == -1 || (size_t)filestat.st_size < length) {
+    if (!writable || ftruncate(fd, length) == -1) {
+      close(fd);
+      error(ERR_READFAIL, filename);
+      return -1;
+    }
+  }
+  return fd;
+}
+
+/*
+** 'map_arrayfile' maps the first 'length' bytes of the file open on
+** 'fd' into memory and closes the file. A read-only mapping is private
+** to this process. An updatable one is shared, so changes are written
+** back to the file and are seen by any other process mapping it. The
+** function returns NIL if the file cannot be mapped
+*/
+static void *map_arrayfile(int fd, size_t length, boolean writable) {
+  void *base;
+
+  base = mmap(NULL, length, writable ? PROT_READ|PROT_WRITE : PROT_READ,
+              writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+  close(fd);
+  return base == MAP_FAILED ? NIL : base;
+}
+#endif
+
 /*
 ** 'define_array' is called to collect the dimensions of an array
 ** and to create the array. 'vp' points at the symbol table entry
 ** of the array. 'islocal' is set to TRUE if the array is a local
 ** array, that is, it is defined in a procedure or function.
 */
-void define_array(variable *vp, boolean islocal, boolean offheap) {
+void define_array(variable *vp, boolean islocal, int32 offheap) {
   int32 bounds[1+MAXDIMS];
   int32 n, dimcount, elemsize = 0;
   size_t size;
   basicarray *ap;
+#ifdef TARGET_UNIX
+  int mapfd = -1;
+  boolean mapwrite = FALSE;
+#endif
 
   DEBUGFUNCMSGIN;
   dimcount = 0;         /* Number of dimemsions */
@@ -568,15 +697,43 @@ void define_array(variable *vp, boolean islocal, boolean offheap) {
     return;
   }
   basicvars.current++;  /* Skip the ')' */
+  if (offheap && *basicvars.current == 0xFF
+   && (*(basicvars.current+1) == BASTOKEN_OPENIN || *(basicvars.current+1) == BASTOKEN_OPENUP)) {
+/* DIM HIMEM array(...) OPENIN|OPENUP <file> - Use the file as the array body */
+#ifdef TARGET_UNIX
+    mapwrite = *(basicvars.current+1) == BASTOKEN_OPENUP;
+    basicvars.current+=2;
+    mapfd = open_arrayfile(size*elemsize, mapwrite);
+    offheap = OFFHEAP_MAPPED;
+#else
+    error(ERR_UNSUPPORTED);
+    return;
+#endif
+  }
 /* Now create the array and initialise it */
   if (islocal) {        /* Acquire memory from stack for a local array */
     if (offheap) {
       ap = malloc(sizeof(basicarray));                  /* Grab memory for array descriptor */
       if (ap==NULL) {
+#ifdef TARGET_UNIX
+        if (offheap == OFFHEAP_MAPPED) close(mapfd);
+#endif
         error(ERR_BADDIM, vp->varname);     /* There is not enough memory available for the descriptor */
         return;
       }
-      ap->arraystart.arraybase = malloc(size*elemsize); /* Grab memory for array proper */
+#ifdef TARGET_UNIX
+      if (offheap == OFFHEAP_MAPPED)
+        ap->arraystart.arraybase = map_arrayfile(mapfd, size*elemsize, mapwrite);
+      else
+#endif
+      {
+        ap->arraystart.arraybase = map_offheap(size*elemsize);  /* Large arrays may be mapped directly */
+        if (ap->arraystart.arraybase != NIL)
+          offheap = OFFHEAP_PAGES;
+        else {
+          ap->arraystart.arraybase = malloc(size*elemsize); /* Grab memory for array proper */
+        }
+      }
     } else {
       ap = alloc_stackmem(sizeof(basicarray));  /* Grab memory for array descriptor */
       if (ap==NIL) {
@@ -594,10 +751,25 @@ void define_array(variable *vp, boolean islocal, boolean offheap) {
     if (offheap) {
       ap = malloc(sizeof(basicarray));                  /* Grab memory for array descriptor */
       if (ap==NULL) {
+#ifdef TARGET_UNIX
+        if (offheap == OFFHEAP_MAPPED) close(mapfd);
+#endif
         error(ERR_BADDIM, vp->varname);     /* There is not enough memory available for the descriptor */
         return;
       }
-      ap->arraystart.arraybase = malloc(size*elemsize); /* Grab memory for array proper */
+#ifdef TARGET_UNIX
+      if (offheap == OFFHEAP_MAPPED)
+        ap->arraystart.arraybase = map_arrayfile(mapfd, size*elemsize, mapwrite);
+      else
+#endif
+      {
+        ap->arraystart.arraybase = map_offheap(size*elemsize);  /* Large arrays may be mapped directly */
+        if (ap->arraystart.arraybase != NIL)
+          offheap = OFFHEAP_PAGES;
+        else {
+          ap->arraystart.arraybase = malloc(size*elemsize); /* Grab memory for array proper */
+        }
+      }
     } else {
       ap = allocmem(sizeof(basicarray), 0);             /* Grab memory for array descriptor */
       if (ap==NIL) {
@@ -608,12 +780,20 @@ void define_array(variable *vp, boolean islocal, boolean offheap) {
         error(ERR_BADDIM, tmpvarname);  /* There is not enough memory available for the descriptor */
         return;
       }
-      ap->arraystart.arraybase = allocmem(size*elemsize, 0);    /* Grab memory for array proper */
+      ap->arraystart.arraybase = allocbig(size*elemsize, 0);    /* Grab memory for array proper */
     }
   }
   if (ap->arraystart.arraybase==NIL) {
+    int tmpvarnameLen = 256;
+    char tmpvarname[tmpvarnameLen];
+    STRLCPY(tmpvarname, vp->varname, tmpvarnameLen);
+    if (offheap)
+      free(ap);
+    else if (!islocal) {
+      freemem(ap, sizeof(basicarray));
+    }
     if (!islocal) remove_variable(vp, vp->varflink);
-    error(ERR_BADDIM, vp->varname);     /* There is not enough memory */
+    error(ERR_BADDIM, tmpvarname);      /* There is not enough memory */
     return;
   }
   ap->dimcount = dimcount;
@@ -622,6 +802,10 @@ void define_array(variable *vp, boolean islocal, boolean offheap) {
   ap->parent = vp;
   for (n=0; n<dimcount; n++) ap->dimsize[n] = bounds[n];
   vp->varentry.vararray = ap;
+  if (offheap == OFFHEAP_MAPPED || offheap == OFFHEAP_PAGES) { /* A file keeps its contents, new pages are zero */
+    DEBUGFUNCMSGOUT;
+    return;
+  }
 /* Now zeroise all the array elememts */
   if (vp->varflags==VAR_INTARRAY)
     for (n=0; n<size; n++) ap->arraystart.intbase[n] = 0;
@@ -655,7 +839,7 @@ variable *create_variable(byte *varname, int namelen, library *lp) {
   int32 hashvalue;
 
   DEBUGFUNCMSGIN;
-  np = allocmem(namelen+2, 1);
+  np = allocmem(namelen+1, 1);          /* +1 for NUL at end of name */
   vp = allocmem(sizeof(variable), 1);
 #ifdef DEBUG
   if (basicvars.debug_flags.variables) fprintf(stderr, "varname=%s, namelen=%d\n", varname, namelen);
@@ -940,6 +1124,8 @@ static void add_libarray(byte *tp, library *lp) {
   DEBUGFUNCMSGOUT;
 }
 
+#define LIBHASHMIN 16           /* Minimum number of hash chains for library PROCs and FNs */
+
 /*
 ** 'add_procfn' creates an entry for a procedure or function
 ** in a library and returns a pointer to its entry. 'tp' points
@@ -964,6 +1150,7 @@ static libfnproc *add_procfn(byte *bp, byte *tp) {
   fpp->fpmarker = tp+1; /* Need pointer to the XFNPROCALL token for scan_parmlist() */
   fpp->fphash = hash(pfname);
   fpp->fpflink = NIL;
+  fpp->fphashflink = NIL;
   DEBUGFUNCMSGOUT;
   return fpp;
 }
@@ -978,20 +1165,29 @@ static libfnproc *add_procfn(byte *bp, byte *tp) {
 ** is called that is not in the Basic program. As each library
 ** is searched for the first time, so this function is invoked.
 ** Variables that will be private to the library are created at
-** this time.
+** this time. If the library was mapped from the cache with an index
+** of its procedures and functions, only the lines before the first
+** 'DEF' are looked at and the list is not built.
+** The entries in the list are also put on hash chains so that
+** searches only have to look at entries whose hash values match.
+** Entries are added to the end of each chain so that the first
+** definition of a name is the one found, as with the list
 */
 static void scan_library(library *lp) {
   byte *bp;
-  libfnproc *fpp, *fpplast;
+  libfnproc *fpp, *fpplast, **chain;
   boolean foundproc;
+  int32 count, size;
 
   DEBUGFUNCMSGIN;
   bp = lp->libstart;
   fpplast = NIL;
   foundproc = FALSE;
+  count = 0;
   while (!AT_PROGEND(bp)) {
     byte *tp = FIND_EXEC(bp);
     if (*tp==BASTOKEN_DEF && *(tp+1)==BASTOKEN_XFNPROCALL) {      /* Found DEF PROC or DEF FN */
+      if (lp->libindex!=NIL) break;     /* Procedures and functions are found via the index */
       foundproc = TRUE;
       fpp = add_procfn(bp, tp);
       if (fpplast==NIL) /* First PROC or FN found in library */
@@ -1000,6 +1196,7 @@ static void scan_library(library *lp) {
         fpplast->fpflink = fpp;
       }
       fpplast = fpp;
+      count++;
     }
     else if (!foundproc && *tp==BASTOKEN_LIBRARY && *(tp+1)==BASTOKEN_LOCAL)      /* LIBRARY LOCAL */
       add_libvars(tp, lp);
@@ -1008,7 +1205,114 @@ static void scan_library(library *lp) {
     }
     bp+=GET_LINELEN(bp);
   }
+  if (count>0) {        /* Build the hash chains, with about one entry per chain */
+    for (size = LIBHASHMIN; size<count; size = size*2);
+    lp->libfphash = allocmem(size*sizeof(libfnproc *), 1);
+    lp->libfphashmask = size-1;
+    memset(lp->libfphash, 0, size*sizeof(libfnproc *));
+    for (fpp = lp->libfplist; fpp!=NIL; fpp = fpp->fpflink) {
+      chain = &lp->libfphash[fpp->fphash & lp->libfphashmask];
+      while (*chain!=NIL) chain = &(*chain)->fphashflink;
+      *chain = fpp;
+    }
+  }
+  lp->libscanned = TRUE;
+  DEBUGFUNCMSGOUT;
+}
+
+/*
+** 'compare_index' is called by qsort to sort the index of procedures
+** and functions in a library by hash value and then by the order in
+** which they appear in the library
+*/
+static int compare_index(const void *first, const void *second) {
+  const fnprocindex *a = CAST(first, const fnprocindex *), *b = CAST(second, const fnprocindex *);
+
+  if (a->fphash!=b->fphash) return a->fphash<b->fphash ? -1 : 1;
+  return a->fpoffset<b->fpoffset ? -1 : a->fpoffset>b->fpoffset;
+}
+
+/*
+** 'index_procfns' builds an index of the procedures and functions in
+** the program or library at 'base' that is saved with its tokenised
+** copy in the cache. The index is sorted by hash value so that it can
+** be searched with a binary search. It returns a pointer to the index,
+** which has to be freed by the caller, and its size in 'count'. It returns NIL if
+** there is no memory for the index or there is nothing in it
+*/
+fnprocindex *index_procfns(byte *base, int32 *count) {
+  fnprocindex *index, *newindex;
+  byte *bp, *tp, *ep;
+  int32 size;
+  int namelen;
+  char pfname[MAXNAMELEN];
+
+  DEBUGFUNCMSGIN;
+  index = NIL;
+  size = *count = 0;
+  for (bp = base; !AT_PROGEND(bp); bp+=GET_LINELEN(bp)) {
+    tp = FIND_EXEC(bp);
+    if (*tp!=BASTOKEN_DEF || *(tp+1)!=BASTOKEN_XFNPROCALL) continue;
+    tp = GET_SRCADDR(tp+1);     /* Find address of PROC/FN name */
+    ep = skip_name(tp);
+    if (*(ep-1)=='(') ep--;
+    namelen = ep-tp;
+    if (namelen>=MAXNAMELEN) continue;
+    if (*count==size) {
+      size = size==0 ? 64 : size*2;
+      newindex = realloc(index, size*sizeof(fnprocindex));
+      if (newindex==NIL) {
+        free(index);
+        *count = 0;
+        return NIL;
+      }
+      index = newindex;
+    }
+    memmove(pfname, tp, namelen);
+    pfname[namelen] = asc_NUL;
+    index[*count].fpoffset = bp-base;
+    index[*count].fphash = hash(pfname);
+    (*count)++;
+  }
+  if (index!=NIL) qsort(index, *count, sizeof(fnprocindex), compare_index);
   DEBUGFUNCMSGOUT;
+  return index;
+}
+
+/*
+** 'search_libindex' looks for procedure or function 'name' in the index
+** of a library mapped from the cache. The index is sorted by hash value
+** so the first entry with the right hash is found with a binary search.
+** Only the lines whose hash values match are looked at, so the rest of
+** the library is not touched. It returns a pointer to the XFNPROCALL
+** token in the 'DEF' line or NIL if the procedure or function is not in
+** the library
+*/
+static byte *search_libindex(library *lp, char *name, int32 hashvalue) {
+  byte *bp, *tp, *base, *ep;
+  int32 n, low, high, mid, namelen;
+
+  namelen = strlen(name);
+  low = 0;
+  high = lp->libindexsize;
+  while (low<high) {
+    mid = (low+high)/2;
+    if (lp->libindex[mid].fphash<hashvalue)
+      low = mid+1;
+    else {
+      high = mid;
+    }
+  }
+  for (n=low; n<lp->libindexsize && lp->libindex[n].fphash==hashvalue; n++) {
+    bp = lp->libstart+lp->libindex[n].fpoffset;
+    tp = FIND_EXEC(bp);
+    if (*tp!=BASTOKEN_DEF || *(tp+1)!=BASTOKEN_XFNPROCALL) continue;
+    base = GET_SRCADDR(tp+1);
+    ep = skip_name(base);
+    if (*(ep-1)=='(') ep--;
+    if (ep-base==namelen && memcmp(base, name, namelen)==0) return tp+1;
+  }
+  return NIL;
 }
 
 /*
@@ -1022,23 +1326,29 @@ static variable *search_library(library *lp, char *name) {
   int namelen;
   libfnproc *fpp;
   variable *vp;
+  byte *marker;
 
   DEBUGFUNCMSGIN;
-  if (lp->libfplist==NIL) scan_library(lp);     /* Create list of PROCs and FNs in library */
   hashvalue = hash(name);
   namelen = strlen(name);
-  fpp = lp->libfplist;
-  if (fpp==NIL) return NIL;             /* Return if library does not contain anything */
-  do {
-    if (fpp->fphash==hashvalue && memcmp(fpp->fpname, name, namelen)==0) break; /* Found it */
-    fpp = fpp->fpflink;
-  } while (fpp!=NIL);
-  if (fpp==NIL) return NIL;             /* Entry not found in library */
+  if (lp->libindex!=NIL) {      /* Library was mapped from the cache with an index */
+    if (!lp->libscanned) scan_library(lp);
+    marker = search_libindex(lp, name, hashvalue);
+    if (marker==NIL) return NIL;
+  }
+  else {
+    if (lp->libfplist==NIL) scan_library(lp);   /* Create list of PROCs and FNs in library */
+    if (lp->libfphash==NIL) return NIL; /* Return if library does not contain anything */
+    fpp = lp->libfphash[hashvalue & lp->libfphashmask];
+    while (fpp!=NIL && (fpp->fphash!=hashvalue || memcmp(fpp->fpname, name, namelen)!=0)) fpp = fpp->fphashflink;
+    if (fpp==NIL) return NIL;           /* Entry not found in library */
+    marker = fpp->fpmarker;
+  }
   vp = allocmem(sizeof(variable), 1);   /* Entry found. Create symbol table entry for it */
   vp->varname = allocmem(namelen+1, 1); /* +1 for NUL at end of name */
   STRLCPY(vp->varname, name, namelen+1);
   vp->varhash = hashvalue;
-  vp->varentry.varmarker = fpp->fpmarker;       /* Needed in 'scan_parmlist' */
+  vp->varentry.varmarker = marker;      /* Needed in 'scan_parmlist' */
   vp->varflink = basicvars.varlists[hashvalue & VARMASK];
   basicvars.varlists[hashvalue & VARMASK] = vp;
   basicvars.runflags.has_variables = TRUE;      /* Say program has some variables */
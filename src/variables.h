@@ -30,10 +30,11 @@ extern void clear_varlists(void);
 extern void list_variables(char);
 extern void list_libraries(char);
 extern void detail_library(library *);
+extern fnprocindex *index_procfns(byte *, int32 *);
 extern variable *find_variable(byte *, int);
 extern variable *find_fnproc(byte *, int);
 extern variable *create_variable(byte *, int32, library *);
-extern void define_array(variable *, boolean, boolean);
+extern void define_array(variable *, boolean, int32);
 extern void init_staticvars(void);
 extern void clear_offheaparrays(void);
 extern void exec_clear_himem(void);
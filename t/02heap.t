@@ -0,0 +1,49 @@
+#!sbrandy
+REM https://testanything.org/
+PRINT "1..5"
+
+REM Memory released by CLEAR HIMEM is reused by the Basic heap
+DIM HIMEM a%(10)
+CLEAR HIMEM a%()
+E%=END
+FOR I%=1 TO 1000
+DIM HIMEM a%(10)
+a%(10)=I%
+CLEAR HIMEM a%()
+NEXT
+IF END=E% THEN PRINT "ok 1" ELSE PRINT "not ok 1"
+
+DIM HIMEM a%(10), b%(10)
+CLEAR HIMEM
+E%=END
+FOR I%=1 TO 1000
+DIM HIMEM a%(10), b%(10)
+CLEAR HIMEM
+NEXT
+IF END=E% THEN PRINT "ok 2" ELSE PRINT "not ok 2"
+
+REM CASE tables are returned to the heap and rebuilt when references are reset
+C0%=0: C1%=0: C2%=0
+FOR I%=1 TO 1000
+DIM HIMEM a%(10)
+CASE I% MOD 3 OF
+WHEN 1: C1%+=1
+WHEN 2: C2%+=1
+OTHERWISE C0%+=1
+ENDCASE
+CLEAR HIMEM
+IF I%=1 THEN E%=END
+NEXT
+IF END=E% AND C0%=333 AND C1%=334 AND C2%=333 THEN PRINT "ok 3" ELSE PRINT "not ok 3"
+
+REM Off-heap arrays mapped from a file see each other's writes
+F$="heap02.tmp"
+DIM HIMEM a%(9) OPENUP F$
+FOR I%=0 TO 9: a%(I%)=I%*I%: NEXT
+DIM HIMEM b%(9) OPENIN F$
+IF SUM(b%())=285 THEN PRINT "ok 4" ELSE PRINT "not ok 4"
+a%(1)=&01020304
+DIM HIMEM c&(39) OPENIN F$
+IF c&(4)=4 AND c&(7)=1 THEN PRINT "ok 5" ELSE PRINT "not ok 5"
+CLEAR HIMEM
+OSCLI "DELETE "+F$
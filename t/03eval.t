@@ -0,0 +1,26 @@
+#!sbrandy
+REM https://testanything.org/
+PRINT "1..4"
+
+REM Repeated EVALs of the same expression give the current values
+a%=1
+FOR I%=1 TO 3: a%=I%: R%=EVAL("a%*10"): NEXT
+IF R%=30 THEN PRINT "ok 1" ELSE PRINT "not ok 1"
+
+REM Expressions still work after CLEAR HIMEM removes what they refer to
+DIM HIMEM h%(3)
+h%(2)=5
+R%=EVAL("h%(2)")
+CLEAR HIMEM
+DIM HIMEM h%(3)
+h%(2)=7
+IF EVAL("h%(2)")=7 AND R%=5 THEN PRINT "ok 2" ELSE PRINT "not ok 2"
+
+REM Nested EVAL and functions
+DEF FNtwice(x)=EVAL("x*2")
+IF EVAL("FNtwice(EVAL(""a%+1""))")=8 THEN PRINT "ok 3" ELSE PRINT "not ok 3"
+
+REM More distinct expressions than the cache holds
+S%=0
+FOR I%=1 TO 1500: S%+=EVAL(STR$(I%)+"+a%"): NEXT
+IF S%=1500*1501/2+1500*3 THEN PRINT "ok 4" ELSE PRINT "not ok 4"
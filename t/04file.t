@@ -0,0 +1,163 @@
+#!sbrandy
+REM https://testanything.org/
+PRINT "1..14"
+F$="file04.tmp"
+
+REM Blocks transferred with GET$# BY and OS_GBPB
+DIM blk% 255, r%(63)
+FOR I%=0 TO 255: blk%?I%=I%: NEXT
+X%=OPENOUT(F$)
+SYS "OS_GBPB",2,X%,blk%,256 TO ,,,R3%,R4%
+CLOSE#X%
+ok%=R3%=0 AND R4%=256
+X%=OPENIN(F$)
+A$=GET$#X% BY 10
+B$=GET$#X% BY 1000
+SYS "OS_GBPB",3,X%,](PTR(r%())+8),256,0 TO ,,,R3%,R4%
+IF ok% AND LEN A$=10 AND ASC MID$(A$,10)=9 AND LEN B$=246 AND ASC B$=10 AND R3%=0 AND R4%=256 AND r%(1)=&07060504 THEN PRINT "ok 1" ELSE PRINT "not ok 1"
+
+REM A negative length or a block outside the workspace is refused
+ok%=FNgbpb(X%,blk%,-1)="Bad OSGBPB call" AND FNgbpb(X%,blk%,&7FFFFFF0)="Address exception"
+CLOSE#X%
+IF ok% AND blk%?0=0 THEN PRINT "ok 2" ELSE PRINT "not ok 2"
+OSCLI "DELETE "+F$
+
+REM Files of 64K or more opened with OPENIN are read from memory. Lines
+REM stop at a NUL, and data added to the file or the file being cut
+REM short by another handle are picked up
+X%=OPENOUT(F$)
+BPUT#X%, "first"
+BPUT#X%, "ab"+CHR$0+"cd"
+FOR I%=1 TO 7000: BPUT#X%, "line "+STR$I%: NEXT
+CLOSE#X%
+X%=OPENIN(F$)
+E%=EXT#X%
+ok%=GET$#X%="first" AND GET$#X%="ab" AND BGET#X%=ASC"l" AND PTR#X%=13
+PTR#X%=E%-5
+ok%=ok% AND GET$#X% BY 3="700" AND GET$#X%="0" AND EOF#X%
+Y%=OPENUP(F$)
+PTR#Y%=E%
+BPUT#Y%, "more"
+CLOSE#Y%
+IF ok% AND NOT EOF#X% AND EXT#X%=E%+5 AND GET$#X%="more" AND EOF#X% THEN PRINT "ok 3" ELSE PRINT "not ok 3"
+PTR#X%=0
+Y%=OPENUP(F$)
+EXT#Y%=10
+CLOSE#Y%
+A$=FNgetby(X%,65536)
+ok%=(A$="Unable to read from file" OR A$="first"+CHR$10+"ab"+CHR$0+"c") AND EXT#X%=10
+PTR#X%=6
+IF ok% AND GET$#X%="ab" AND EOF#X% THEN PRINT "ok 4" ELSE PRINT "not ok 4"
+CLOSE#X%
+OSCLI "DELETE "+F$
+
+REM Files read ahead and written behind by a background thread
+X%=OPENOUT(F$)
+SYS "Brandy_AsyncFile",X%,1 TO W%
+FOR I%=1 TO 3000: BPUT#X%, "line "+STR$I%: NEXT
+P%=PTR#X%
+CLOSE#X%
+X%=OPENIN(F$)
+SYS "Brandy_AsyncFile",X%,1 TO R%
+N%=0: ok%=W%=1 AND R%=1
+WHILE NOT EOF#X%: N%+=1: IF GET$#X%<>"line "+STR$N% THEN ok%=FALSE
+ENDWHILE
+PTR#X%=0
+A$=GET$#X%
+IF ok% AND N%=3000 AND P%=EXT#X% AND A$="line 1" THEN PRINT "ok 5" ELSE PRINT "not ok 5"
+CLOSE#X%
+OSCLI "DELETE "+F$
+
+REM Handles beyond 254 and the lowest free handle used first
+X%=OPENOUT(F$): BPUT#X%, "line 1": CLOSE#X%
+DIM h%(299)
+FOR I%=0 TO 299: h%(I%)=OPENIN(F$): NEXT
+ok%=h%(0)=254 AND h%(253)=1 AND h%(254)=256 AND h%(299)=301 AND GET$#h%(299)="line 1"
+CLOSE#h%(0): CLOSE#h%(1): CLOSE#h%(260)
+A%=OPENIN(F$): B%=OPENIN(F$): C%=OPENIN(F$)
+CLOSE#0
+IF ok% AND A%=254 AND B%=253 AND C%=262 THEN PRINT "ok 6" ELSE PRINT "not ok 6"
+OSCLI "DELETE "+F$
+
+REM Whole arrays written and read with PRINT# and INPUT#
+DIM a(99), b%(9), c$(3), f(99), g%(9), h$(3), i%(9)
+FOR I%=0 TO 99: a(I%)=I%/3-10: NEXT
+b%()=1,-2,300000,-4,5,6,7,8,9,&3FFFFFFF
+c$()="one","",STRING$(300,"x"),"four"
+X%=OPENOUT(F$)
+PRINT#X%, a(), 42, b%(), c$(), b%()*2
+PRINT#X% BY a(), b%()
+CLOSE#X%
+X%=OPENIN(F$)
+INPUT#X%, f(), N%, g%(), h$(), i%()
+ok%=TRUE
+FOR I%=0 TO 99: IF f(I%)<>a(I%) THEN ok%=FALSE
+NEXT
+IF ok% AND N%=42 THEN PRINT "ok 7" ELSE PRINT "not ok 7"
+ok%=TRUE
+FOR I%=0 TO 9: IF g%(I%)<>b%(I%) OR i%(I%)<>b%(I%)*2 THEN ok%=FALSE
+NEXT
+IF ok% THEN PRINT "ok 8" ELSE PRINT "not ok 8"
+IF h$(0)="one" AND h$(1)="" AND h$(2)=STRING$(300,"x") AND h$(3)="four" THEN PRINT "ok 9" ELSE PRINT "not ok 9"
+f()=0: g%()=0
+INPUT#X% BY f(), g%()
+IF f(99)=a(99) AND g%(9)=b%(9) AND EOF#X% THEN PRINT "ok 10" ELSE PRINT "not ok 10"
+CLOSE#X%
+
+REM Values written individually can be read as a whole array
+X%=OPENOUT(F$)
+FOR I%=0 TO 10: PRINT#X%, I%*I%: NEXT
+CLOSE#X%
+X%=OPENIN(F$)
+INPUT#X%, f(0), g%()
+CLOSE#X%
+IF f(0)=0 AND g%(0)=1 AND g%(8)=81 THEN PRINT "ok 11" ELSE PRINT "not ok 11"
+OSCLI "DELETE "+F$
+
+REM Delimited text split into arrays
+READ LINE "a,,""b,""""c"""""",12" TO h$(), N%
+ok%=N%=4 AND h$(0)="a" AND h$(1)="" AND h$(2)="b,""c""" AND h$(3)="12"
+h$(0)="alpha;beta;gamma"
+READ LINE h$(0) BY ";" TO h$()
+IF ok% AND h$(0)="alpha" AND h$(1)="beta" AND h$(2)="gamma" THEN PRINT "ok 12" ELSE PRINT "not ok 12"
+X%=OPENOUT(F$)
+BPUT#X%, "one;1;1.5"
+BPUT#X%, ""
+BPUT#X%, "two;-2"
+CLOSE#X%
+X%=OPENIN(F$)
+INPUT#X% LINE BY ";" TO h$(), g%(), f(), N%
+CLOSE#X%
+IF N%=2 AND h$(1)="two" AND g%(0)=1 AND g%(1)=-2 AND f(0)=1.5 AND f(1)=0 THEN PRINT "ok 13" ELSE PRINT "not ok 13"
+OSCLI "DELETE "+F$
+
+REM Compressed files read and written through OPENIN and OPENOUT
+SYS "Brandy_CompressedFiles",1
+X%=OPENOUT(F$+".gz")
+FOR I%=1 TO 20000: BPUT#X%, "line "+STR$I%: NEXT
+CLOSE#X%
+X%=OPENIN(F$+".gz")
+ok%=GET$#X%="line 1" AND BGET#X%=ASC"l"
+PTR#X%=0
+N%=0: WHILE NOT EOF#X%: A$=GET$#X%: N%+=1: ENDWHILE
+CLOSE#X%
+SYS "Brandy_CompressedFiles",0
+X%=OPENIN(F$+".gz")
+B0%=BGET#X%: B1%=BGET#X%
+CLOSE#X%
+IF B0%=ASC"l" THEN
+  PRINT "ok 14 # skip Built without zlib"
+ELSE
+  IF ok% AND N%=20000 AND A$="line 20000" AND B0%=&1F AND B1%=&8B THEN PRINT "ok 14" ELSE PRINT "not ok 14"
+ENDIF
+OSCLI "DELETE "+F$+".gz"
+END
+
+DEF FNgbpb(X%,A%,L%)
+ON ERROR LOCAL =REPORT$
+SYS "OS_GBPB",4,X%,A%,L%
+=""
+
+DEF FNgetby(X%,L%)
+ON ERROR LOCAL =REPORT$
+=GET$#X% BY L%
@@ -0,0 +1,144 @@
+#!sbrandy
+REM https://testanything.org/
+REM Command line options, tested by running the interpreter named by the
+REM BRANDY environment variable (sbrandy if it is not set) on scratch files
+PRINT "1..8"
+DIM out$(20)
+B$="${BRANDY:-sbrandy}"
+
+REM -cachedir: the second run uses the cached copy, which holds tokens
+REM for indirection on a static variable, an unknown PROC, a string with
+REM a '"' in it and a 64-bit constant
+F$="options05.tmp": C$="options05.dir"
+F%=OPENOUT F$
+BPUT#F%, "B%=8: DIM B% 8: B%!4=7: PROCp: PRINT ""a""""b""; B%!4; ""/""; 12345678901 MOD 1000"
+BPUT#F%, "DEF PROCp: PRINT ""one"";: ENDPROC"
+CLOSE#F%
+OSCLI "touch -d 2020-01-01 "+F$
+OSCLI B$+" -cachedir "+C$+" -quit "+F$ TO out$(), N%
+F%=OPENOUT F$
+BPUT#F%, "B%=8: DIM B% 8: B%!4=7: PROCp: PRINT ""a""""b""; B%!4; ""/""; 12345678901 MOD 1000"
+BPUT#F%, "DEF PROCp: PRINT ""two"";: ENDPROC"
+CLOSE#F%
+OSCLI "touch -d 2020-01-01 "+F$
+OSCLI B$+" -cachedir "+C$+" -quit "+F$ TO out$(), N%
+IF N%=1 AND out$(1)="onea""b7/901" THEN PRINT "ok 1" ELSE PRINT "not ok 1"
+OSCLI "DELETE "+F$
+OSCLI "ls "+C$ TO out$(), N%
+FOR I%=1 TO N%: OSCLI "DELETE "+C$+"/"+out$(I%): NEXT
+OSCLI "DELETE "+C$
+
+REM -link: line number references filled in at load time go to the same
+REM lines as they do when they are first used, and a missing line is
+REM still reported when the statement runs
+F%=OPENOUT F$
+BPUT#F%, "10 GOSUB 100: GOSUB 200"
+BPUT#F%, "20 ON 2 GOTO 30, 40, 50"
+BPUT#F%, "30 PRINT ""bad"": END"
+BPUT#F%, "40 RESTORE 310: READ A$: PRINT A$;"
+BPUT#F%, "50 IF A$=""y"" THEN 60 ELSE 30"
+BPUT#F%, "60 ON ERROR GOTO 90"
+BPUT#F%, "70 GOTO 1000"
+BPUT#F%, "90 PRINT ;ERR: END"
+BPUT#F%, "100 PRINT ""a"";: RETURN"
+BPUT#F%, "200 PRINT ""b"";: RETURN"
+BPUT#F%, "300 DATA x"
+BPUT#F%, "310 DATA y"
+CLOSE#F%
+OSCLI B$+" -link -quit "+F$ TO out$(), N%
+IF N%=1 AND out$(1)="aby41" THEN PRINT "ok 2" ELSE PRINT "not ok 2"
+OSCLI "DELETE "+F$
+
+REM *SNAPSHOT saves the program and its variables and -restore carries on
+REM from the procedure named, without running the rest of the program
+S$="options05.snap"
+F%=OPENOUT F$
+BPUT#F%, "A%=42: B$=""hello"": DIM C(3): C(2)=1.5"
+BPUT#F%, "OSCLI ""SNAPSHOT "+S$+" PROCmain"""
+BPUT#F%, "PRINT ""init"": END"
+BPUT#F%, "DEF PROCmain: PRINT B$; A%; C(2): ENDPROC"
+CLOSE#F%
+OSCLI B$+" -quit "+F$ TO out$(), N%
+OK%=N%=1 AND out$(1)="init"
+OSCLI B$+" -restore "+S$ TO out$(), N%
+IF OK% AND N%=1 AND out$(1)="hello421.5" THEN PRINT "ok 3" ELSE PRINT "not ok 3"
+OSCLI "DELETE "+F$
+OSCLI "DELETE "+S$
+
+REM -cachedir: a library loaded with INSTALL is mapped from the cache and
+REM its procedures and functions are found through the index saved with it
+L$="options05.lib"
+F%=OPENOUT F$
+BPUT#F%, "INSTALL """+L$+""": PROCone: PRINT FNtwice(21); FNthrice(2)"
+CLOSE#F%
+FOR I%=1 TO 2
+F%=OPENOUT L$
+BPUT#F%, "DEF FNtwice(x)=x*2"
+IF I%=1 THEN BPUT#F%, "DEF PROCone: PRINT ""one"";: ENDPROC" ELSE BPUT#F%, "DEF PROCone: PRINT ""two"";: ENDPROC"
+BPUT#F%, "DEF FNthrice(x)=x*3"
+CLOSE#F%
+OSCLI "touch -d 2020-01-01 "+L$
+OSCLI B$+" -cachedir "+C$+" -quit "+F$ TO out$(), N%
+IF I%=1 THEN OK%=N%=1 AND out$(1)="one        426"
+NEXT
+IF OK% AND N%=1 AND out$(1)="one        426" THEN PRINT "ok 4" ELSE PRINT "not ok 4"
+OSCLI "DELETE "+F$
+OSCLI "DELETE "+L$
+OSCLI "ls "+C$ TO out$(), N%
+FOR I%=1 TO N%: OSCLI "DELETE "+C$+"/"+out$(I%): NEXT
+OSCLI "DELETE "+C$
+
+REM Output to a pipe is buffered but still comes out complete and in
+REM order with the output of commands run by OSCLI
+F%=OPENOUT F$
+BPUT#F%, "PRINT ""a"";: VDU 66: PRINT ""c"""
+BPUT#F%, "OSCLI ""echo d"""
+BPUT#F%, "PRINT STRING$(40000,""x"")"
+BPUT#F%, "PRINT STRING$(40000,""y"")"
+BPUT#F%, "OSCLI ""echo e"""
+BPUT#F%, "PRINT ""f"";"
+CLOSE#F%
+OSCLI B$+" -quit "+F$ TO out$(), N%
+IF N%=6 AND out$(1)="aBc" AND out$(2)="d" AND out$(3)=STRING$(40000,"x") AND out$(4)=STRING$(40000,"y") AND out$(5)="e" AND out$(6)="f" THEN PRINT "ok 5" ELSE PRINT "not ok 5"
+OSCLI "DELETE "+F$
+
+REM The interpreter still announces itself when its output is a pipe
+OSCLI "echo QUIT | "+B$ TO out$(), N%
+IF N%>=2 AND LEFT$(out$(2),14)="Matrix Brandy " THEN PRINT "ok 6" ELSE PRINT "not ok 6"
+
+REM -batch reports the number of statements run, not counting the ':'
+REM between them, after the program's own output
+F%=OPENOUT F$
+BPUT#F%, "FOR I%=1 TO 1000: A%+=1: NEXT"
+BPUT#F%, "PRINT A%"
+CLOSE#F%
+OSCLI B$+" -batch -quit "+F$+" 2>&1" TO out$(), N%
+IF N%=2 AND VAL out$(1)=1000 AND LEFT$(out$(2),30)="2002 statements executed in 0." THEN PRINT "ok 7" ELSE PRINT "not ok 7"
+OSCLI "DELETE "+F$
+
+REM *SPOOL output is complete and in order once the spool file has been
+REM closed with *SPOOL and, when it is left open, once the interpreter
+REM has finished, with and without the background writer
+P$="options05.sp1": Q$="options05.sp2"
+F%=OPENOUT F$
+BPUT#F%, "*SPOOL "+P$
+BPUT#F%, "FOR I%=1 TO 20000: PRINT ""line "";I%: NEXT"
+BPUT#F%, "*SPOOL"
+BPUT#F%, "SYS ""Brandy_AsyncSpool"",1"
+BPUT#F%, "*SPOOL "+Q$
+BPUT#F%, "FOR I%=1 TO 20000: PRINT ""line "";I%: NEXT"
+CLOSE#F%
+OSCLI B$+" -quit "+F$+" >/dev/null"
+OK%=TRUE
+FOR J%=1 TO 2
+IF J%=1 THEN X%=OPENIN P$ ELSE X%=OPENIN Q$
+N%=0
+WHILE NOT EOF#X%: N%+=1: IF GET$#X%<>"line "+STR$N% THEN OK%=FALSE
+ENDWHILE
+CLOSE#X%
+IF N%<>20000 THEN OK%=FALSE
+NEXT
+IF OK% THEN PRINT "ok 8" ELSE PRINT "not ok 8"
+OSCLI "DELETE "+F$
+OSCLI "DELETE "+P$
+OSCLI "DELETE "+Q$
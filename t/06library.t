@@ -0,0 +1,38 @@
+#!sbrandy
+REM https://testanything.org/
+REM Finding procedures and functions in libraries loaded with LIBRARY
+PRINT "1..4"
+L$="library06.tmp": M$="library06b.tmp"
+
+REM Enough functions in the library that they are spread over several
+REM hash chains, with a second definition of FNf7 that is never used
+F%=OPENOUT L$
+FOR I%=1 TO 100
+BPUT#F%, "DEF FNf"+STR$I%+"(x)=x+"+STR$I%
+NEXT
+BPUT#F%, "DEF FNf7(x)=0"
+BPUT#F%, "DEF PROCp(RETURN a%): a%=a%*2: ENDPROC"
+CLOSE#F%
+LIBRARY L$
+T%=0
+FOR I%=1 TO 100
+T%+=EVAL("FNf"+STR$I%+"(1)")
+NEXT
+IF T%=5150 THEN PRINT "ok 1" ELSE PRINT "not ok 1"
+IF FNf7(0)=7 THEN PRINT "ok 2" ELSE PRINT "not ok 2"
+A%=21: PROCp(A%)
+IF A%=42 THEN PRINT "ok 3" ELSE PRINT "not ok 3"
+
+REM A function not in any library is reported as missing, and is found
+REM once a library that defines it has been loaded
+E%=0
+ON ERROR LOCAL E%=ERR
+IF E%=0 THEN A%=FNmissing
+RESTORE ERROR
+F%=OPENOUT M$
+BPUT#F%, "DEF FNmissing=99"
+CLOSE#F%
+LIBRARY M$
+IF E%<>0 AND FNmissing=99 THEN PRINT "ok 4" ELSE PRINT "not ok 4"
+OSCLI "DELETE "+L$
+OSCLI "DELETE "+M$